@@ -0,0 +1,717 @@
+// Microbenchmarks of the interpreter, from the tokenizer up to whole programs.
+//
+//   scheme_bench [--filter=SUBSTR] [--repetitions=N] [--perf] [--json=FILE]
+//
+// Every benchmark runs --repetitions times on fresh state and reports its best run: time and
+// heap allocations per op, and the peak RSS of the process so far. Time per op of the
+// multithreaded benchmarks is wall time times their threads, i.e. per core. --perf adds hardware
+// counters per op, of the whole run and of the heap collections in it, where the kernel
+// allows them. --json writes the same results for regression tracking ("-" for stdout).
+
+#include <sys/resource.h>
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "bench/perf_counters.h"
+#include "src/form_cache.h"
+#include "src/heap.h"
+#include "src/jit.h"
+#include "src/object.h"
+#include "src/parser.h"
+#include "src/printer.h"
+#include "src/scheme.h"
+#include "src/tokenizer.h"
+
+namespace {
+
+constexpr size_t kDefaultRepetitions = 5;
+constexpr int kNameWidth = 16;
+constexpr size_t kPreludeDefinitions = 1000;
+
+using CounterValues = std::array<std::optional<double>, PerfCounters::kCounters>;
+
+// The timed part of a run; returns the number of ops it did.
+using Run = std::function<uint64_t()>;
+
+struct Benchmark {
+    std::string name;
+    // What one op is, e.g. "token" or "call".
+    std::string unit;
+    // Builds the state of one run, untimed, and returns the timed part.
+    std::function<Run()> prepare;
+    // Threads the timed part keeps busy; ns/op is multiplied by it.
+    size_t threads = 1;
+    // Runs with the fixnum lambda JIT, like scheme --jit.
+    bool jit = false;
+};
+
+struct Result {
+    std::string name;
+    std::string unit;
+    uint64_t ops;
+    double ns_per_op;
+    double allocations_per_op;
+    // Peak RSS of the whole process after the benchmark, so it never goes down.
+    int64_t peak_rss_kb;
+    // Per op, of the whole run and of the collections during it; empty without --perf.
+    CounterValues counters;
+    CounterValues collection_counters;
+};
+
+struct Options {
+    std::string filter;
+    size_t repetitions = kDefaultRepetitions;
+    bool perf = false;
+    std::string json;
+};
+
+// Counts only during heap collections.
+class CollectionCounters : public HeapCheckListener {
+public:
+    PerfCounters counters;
+
+    virtual void OnCheckStart() override {
+        counters.Start();
+    }
+
+    virtual void OnCheckEnd() override {
+        counters.Stop();
+    }
+};
+
+[[noreturn]] void Usage() {
+    std::cerr << "usage: scheme_bench [--filter=SUBSTR] [--repetitions=N] [--perf] "
+                 "[--json=FILE]\n";
+    std::exit(2);
+}
+
+Options ParseOptions(int argc, char** argv) {
+    Options options;
+    for (int i = 1; i < argc; ++i) {
+        std::string_view arg = argv[i];
+        if (arg.starts_with("--filter=")) {
+            options.filter = arg.substr(arg.find('=') + 1);
+        } else if (arg.starts_with("--repetitions=")) {
+            options.repetitions = std::stoull(std::string(arg.substr(arg.find('=') + 1)));
+        } else if (arg == "--perf") {
+            options.perf = true;
+        } else if (arg.starts_with("--json=")) {
+            options.json = arg.substr(arg.find('=') + 1);
+        } else {
+            Usage();
+        }
+    }
+    if (options.repetitions == 0) {
+        Usage();
+    }
+    return options;
+}
+
+uint64_t GetAllocations() {
+    return GetInstance<Heap>().GetStats().allocations;
+}
+
+int64_t GetPeakRssKb() {
+    rusage usage = {};
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+// A quoted list of 1..count, for the list benchmarks.
+std::string MakeList(size_t count) {
+    std::string list = "'(";
+    for (size_t i = 1; i <= count; ++i) {
+        list += std::to_string(i) + (i < count ? " " : ")");
+    }
+    return list;
+}
+
+// Definitions of f0 .. f<count - 1>, typical forms.
+std::string MakeDefinitions(size_t count) {
+    std::string source;
+    for (size_t i = 0; i < count; ++i) {
+        source += "(define (f" + std::to_string(i) + " x y) (if (< x 1.5) '(a b . c) (+ x y -" +
+                  std::to_string(i) + " 123456789012345678901234567890)))\n";
+    }
+    return source;
+}
+
+// A script for the reader benchmarks.
+const std::string& GetSource() {
+    static const std::string source = MakeDefinitions(5000);
+    return source;
+}
+
+// A data file for the bulk reader benchmarks, large enough to split between many threads.
+const std::string& GetData() {
+    static const std::string data = MakeDefinitions(20000);
+    return data;
+}
+
+// A prelude for the startup benchmarks. It redefines a builtin first, so the collections
+// after the other definitions free the original while the image still needs it.
+const std::string& GetPrelude() {
+    static const std::string prelude =
+        "(define (abs x) 'redefined)\n" + MakeDefinitions(kPreludeDefinitions);
+    return prelude;
+}
+
+void CheckResult(const std::string& result, const std::string& expected) {
+    if (result != expected) {
+        throw std::runtime_error("returned " + result + ", expected " + expected);
+    }
+}
+
+// A file in the temporary directory, removed with the object.
+class TempFile {
+public:
+    explicit TempFile(const std::string& name)
+        : path_(std::filesystem::temp_directory_path() / name) {
+    }
+
+    TempFile(const TempFile& other) = delete;
+
+    TempFile& operator=(const TempFile& other) = delete;
+
+    ~TempFile() {
+        std::error_code error;
+        std::filesystem::remove(path_, error);
+    }
+
+    std::string GetPath() const {
+        return path_.string();
+    }
+
+private:
+    std::filesystem::path path_;
+};
+
+// Parses GetSource into a form cache at path; returns the number of forms.
+uint64_t WriteFormCache(const std::string& path) {
+    const auto& source = GetSource();
+    Tokenizer tokenizer(source);
+    FormCacheWriter writer;
+    ReadStats stats;
+    uint64_t forms = 0;
+    for (; !tokenizer.IsEnd(); ++forms) {
+        writer.Add(Read(&tokenizer, &stats), stats);
+    }
+    if (!writer.Write(path, HashSource(source), source.size())) {
+        throw std::runtime_error("can't write " + path);
+    }
+    return forms;
+}
+
+// Evaluates expr with a fresh interpreter that already ran the prelude. Each run counts as
+// ops ops; a result other than expected fails the benchmark, unless expected is empty.
+Benchmark Program(std::string name, std::string unit, std::string prelude, std::string expr,
+                  std::string expected, uint64_t ops) {
+    return {std::move(name), std::move(unit), [=] {
+                auto interpreter = std::make_shared<Interpreter>();
+                std::ostringstream sink;
+                interpreter->RunScript(prelude, &sink, PrintMode::NONE);
+                return Run([=] {
+                    auto result = interpreter->Run(expr);
+                    if (!expected.empty() && result != expected) {
+                        throw std::runtime_error(expr + " returned " + result + ", expected " +
+                                                 expected);
+                    }
+                    return ops;
+                });
+            }};
+}
+
+// Sorts a permutation of 0 .. size - 1, loaded as data, with the comparator less.
+Benchmark SortList(std::string name, size_t size, std::string less, bool jit) {
+    Benchmark benchmark = {std::move(name), "element", [size, less] {
+                               std::string data;
+                               for (size_t i = 0; i < size; ++i) {
+                                   data += std::to_string(i * 7919 % size) + ' ';
+                               }
+                               auto interpreter = std::make_shared<Interpreter>();
+                               interpreter->LoadData("xs", data);
+                               return Run([interpreter, size, less] {
+                                   CheckResult(interpreter->Run("(let ((s (sort xs " + less +
+                                                                "))) (list (car s) (list-ref s " +
+                                                                std::to_string(size - 1) + ")))"),
+                                               "(0 " + std::to_string(size - 1) + ")");
+                                   return size;
+                               });
+                           }};
+    benchmark.jit = jit;
+    return benchmark;
+}
+
+std::vector<Benchmark> MakeBenchmarks() {
+    std::vector<Benchmark> benchmarks;
+
+    benchmarks.push_back({"tokenizer", "token", [] {
+                              return Run([] {
+                                  Tokenizer tokenizer(GetSource());
+                                  uint64_t tokens = 0;
+                                  for (; !tokenizer.IsEnd(); tokenizer.Next()) {
+                                      ++tokens;
+                                  }
+                                  return tokens;
+                              });
+                          }});
+
+    benchmarks.push_back({"parser", "form", [] {
+                              return Run([] {
+                                  Tokenizer tokenizer(GetSource());
+                                  uint64_t forms = 0;
+                                  for (; !tokenizer.IsEnd(); ++forms) {
+                                      Read(&tokenizer);
+                                  }
+                                  return forms;
+                              });
+                          }});
+
+    // Interpreter::LoadData on 1, 2, 4, ... threads up to one per hardware thread.
+    size_t hardware_threads = std::max(std::thread::hardware_concurrency(), 1u);
+    for (size_t threads = 1;; threads = std::min(threads * 2, hardware_threads)) {
+        benchmarks.push_back({"bulk-read-" + std::to_string(threads), "form",
+                              [threads] {
+                                  auto interpreter = std::make_shared<Interpreter>();
+                                  return Run([interpreter, threads] {
+                                      auto result =
+                                          interpreter->LoadData("data", GetData(), threads);
+                                      uint64_t forms = result.forms.size();
+                                      CheckResult(interpreter->Run("(length data)"),
+                                                  std::to_string(forms));
+                                      return forms;
+                                  });
+                              },
+                              threads});
+        if (threads == hardware_threads) {
+            break;
+        }
+    }
+
+    benchmarks.push_back({"heap-make", "object", [] {
+                              return Run([] {
+                                  constexpr uint64_t kObjects = 1'000'000;
+                                  auto& heap = GetInstance<Heap>();
+                                  for (uint64_t i = 0; i < kObjects; ++i) {
+                                      heap.Make<Number>(i);
+                                  }
+                                  return kObjects;
+                              });
+                          }});
+
+    benchmarks.push_back({"heap-check", "object", [] {
+                              // Half of the heap reachable through a global list, half garbage.
+                              constexpr uint64_t kObjects = 200'000;
+                              auto& heap = GetInstance<Heap>();
+                              auto root = heap.Make<Scope>(nullptr);
+                              Object* list = nullptr;
+                              for (uint64_t i = 0; i < kObjects / 2; ++i) {
+                                  list = heap.Make<Cell>(nullptr, list);
+                                  heap.Make<Number>(i);
+                              }
+                              As<Scope>(root)->Add("list", list);
+                              return Run([root] {
+                                  GetInstance<Heap>().Check(root);
+                                  return kObjects;
+                              });
+                          }});
+
+    for (auto [name, variable] : {std::pair{"lookup-local", "y"}, {"lookup-global", "x"}}) {
+        benchmarks.push_back({name, "lookup", [variable] {
+                                  // The global is four frames up from the reference.
+                                  constexpr uint64_t kLookups = 1'000'000;
+                                  constexpr int kDepth = 4;
+                                  auto& heap = GetInstance<Heap>();
+                                  auto scope = heap.Make<Scope>(nullptr);
+                                  As<Scope>(scope)->Add("x", heap.Make<Number>(1));
+                                  for (int i = 0; i < kDepth; ++i) {
+                                      scope = heap.Make<Scope>(scope);
+                                  }
+                                  As<Scope>(scope)->Add("y", heap.Make<Number>(2));
+                                  Tokenizer tokenizer(variable);
+                                  auto symbol = Read(&tokenizer);
+                                  symbol->AddScope(scope);
+                                  return Run([symbol] {
+                                      for (uint64_t i = 0; i < kLookups; ++i) {
+                                          symbol->Calculate();
+                                      }
+                                      return kLookups;
+                                  });
+                              }});
+    }
+
+    // Reading GetSource through the form cache: parsing it and writing the cache, and
+    // reading the forms back from the cache file.
+    benchmarks.push_back({"cache-cold", "form", [] {
+                              auto cache = std::make_shared<TempFile>("scheme_bench.forms");
+                              return Run([cache] { return WriteFormCache(cache->GetPath()); });
+                          }});
+
+    benchmarks.push_back({"cache-warm", "form", [] {
+                              auto cache = std::make_shared<TempFile>("scheme_bench.forms");
+                              WriteFormCache(cache->GetPath());
+                              // Drop the parsed forms, so the run starts on an empty heap too.
+                              GetInstance<Heap>() = Heap();
+                              return Run([cache] {
+                                  const auto& source = GetSource();
+                                  MappedFile file(cache->GetPath());
+                                  FormCacheReader reader(file.GetData());
+                                  if (!reader.IsValid(HashSource(source), source.size())) {
+                                      throw std::runtime_error("form cache is invalid");
+                                  }
+                                  uint64_t forms = 0;
+                                  for (; !reader.IsEnd(); ++forms) {
+                                      reader.Next();
+                                  }
+                                  return forms;
+                              });
+                          }});
+
+    // Time to the first evaluation after the prelude, evaluated from source or restored from
+    // a heap image of it.
+    benchmarks.push_back({"prelude-eval", "start", [] {
+                              auto interpreter = std::make_shared<Interpreter>();
+                              return Run([interpreter] {
+                                  std::ostringstream sink;
+                                  interpreter->RunScript(GetPrelude(), &sink, PrintMode::NONE);
+                                  CheckResult(interpreter->Run("(f999 1 2)"), "(a b . c)");
+                                  CheckResult(interpreter->Run("(abs -1)"), "redefined");
+                                  return 1;
+                              });
+                          }});
+
+    benchmarks.push_back({"image-load", "start", [] {
+                              auto image = std::make_shared<TempFile>("scheme_bench.img");
+                              {
+                                  Interpreter interpreter;
+                                  std::ostringstream sink;
+                                  interpreter.RunScript(GetPrelude(), &sink, PrintMode::NONE);
+                                  interpreter.SaveImage(image->GetPath());
+                              }
+                              auto interpreter = std::make_shared<Interpreter>();
+                              return Run([image, interpreter] {
+                                  interpreter->LoadImage(image->GetPath());
+                                  CheckResult(interpreter->Run("(f999 1 2)"), "(a b . c)");
+                                  CheckResult(interpreter->Run("(abs -1)"), "redefined");
+                                  return 1;
+                              });
+                          }});
+
+    benchmarks.push_back(Program("arithmetic", "iteration", "",
+                                 "(do ((i 0 (+ i 1)) (acc 0 (+ acc (* i 3) (- i 1)))) "
+                                 "((= i 20000) acc))",
+                                 "799940000", 20000));
+
+    benchmarks.push_back(Program("flonum", "iteration", "",
+                                 "(do ((i 0 (+ i 1)) (x 0.0 (+ (* x 0.5) 1.25))) "
+                                 "((= i 20000) x))",
+                                 "2.5", 20000));
+
+    // Printing round trips, mixed exact/inexact arithmetic and NaN ordering; fails on the
+    // first wrong answer, so it doubles as the accuracy check of the numeric tower.
+    benchmarks.push_back({"flonum-check", "check", [] {
+                              static const std::vector<std::pair<std::string, std::string>>
+                                  kChecks = {
+                                      {"0.1", "0.1"},
+                                      {"(+ 0.1 0.2)", "0.30000000000000004"},
+                                      {"(= 0.30000000000000004 (+ 0.1 0.2))", "#t"},
+                                      {"(/ 1.0 3)", "0.3333333333333333"},
+                                      {"1e21", "1e+21"},
+                                      {"(= 1e+21 1e21)", "#t"},
+                                      {"1.5e-7", "1.5e-07"},
+                                      {"-0.0", "-0.0"},
+                                      {"(exact->inexact 123456789012345678901234567890)",
+                                       "1.2345678901234568e+29"},
+                                      {"(+ 1 0.5)", "1.5"},
+                                      {"(/ 7 2)", "3"},
+                                      {"(/ 7 2.0)", "3.5"},
+                                      {"(* 99999999999999999999 1.0)", "1e+20"},
+                                      {"(max 1 2.0)", "2.0"},
+                                      {"(= 9007199254740993 9007199254740992.0)", "#f"},
+                                      {"(< 9007199254740992.0 9007199254740993)", "#t"},
+                                      {"(= 9007199254740992 9007199254740992.0)", "#t"},
+                                      {"(< 100000000000000000000000 1e23)", "#f"},
+                                      {"(< -2 -1.5 -1)", "#t"},
+                                      {"(/ -1.0 0)", "-inf.0"},
+                                      {"(< 123456789012345678901234567890 (/ 1.0 0))", "#t"},
+                                      {"nan", "+nan.0"},
+                                      {"(= nan nan)", "#f"},
+                                      {"(< nan 1)", "#f"},
+                                      {"(> nan 1)", "#f"},
+                                      {"(< 1 nan 2)", "#f"},
+                                  };
+                              auto interpreter = std::make_shared<Interpreter>();
+                              interpreter->Run("(define nan (- (/ 1.0 0) (/ 1.0 0)))");
+                              return Run([interpreter] {
+                                  for (const auto& [expr, expected] : kChecks) {
+                                      auto result = interpreter->Run(expr);
+                                      if (result != expected) {
+                                          throw std::runtime_error(expr + " returned " + result +
+                                                                   ", expected " + expected);
+                                      }
+                                  }
+                                  return kChecks.size();
+                              });
+                          }});
+
+    // Factorials that stay fixnums, and a product tree whose top multiplications are far past
+    // BigInt::kKaratsubaThreshold. Big results are checked modulo a prime.
+    benchmarks.push_back(Program("factorial-small", "factorial",
+                                 "(define (fact n) (if (= n 0) 1 (* n (fact (- n 1)))))",
+                                 "(do ((i 0 (+ i 1)) (f 0 (fact 20))) ((= i 1000) f))",
+                                 "2432902008176640000", 1000));
+
+    const std::string product =
+        "(define (product lo hi) (if (= lo hi) lo (let ((mid (/ (+ lo hi) 2))) "
+        "(* (product lo mid) (product (+ mid 1) hi)))))"
+        "(define (mod-p x) (- x (* 1000000007 (/ x 1000000007))))";
+    benchmarks.push_back(Program("factorial-large", "program", product,
+                                 "(mod-p (product 1 5000))", "541108809", 1));
+
+    // Squares of 3000! (947 limbs) and 12000! (4540 limbs): about 11 times slower for the
+    // bigger one with Karatsuba, about 23 times with schoolbook multiplication.
+    for (auto [name, n, expected] : {std::tuple{"bignum-mul-1k", 3000, "846982551"},
+                                     {"bignum-mul-4k", 12000, "68668519"}}) {
+        benchmarks.push_back(Program(name, "multiply",
+                                     product + "(define a (product 1 " + std::to_string(n) + "))",
+                                     "(mod-p (* a a))", expected, 1));
+    }
+
+    benchmarks.push_back(Program("lambda-call", "call", "(define (id x) x)",
+                                 "(do ((i 0 (+ i 1))) ((= i 20000) i) (id i))", "20000", 20000));
+
+    benchmarks.push_back(Program("list-cons", "cons",
+                                 "(define (build n acc) "
+                                 "(if (= n 0) acc (build (- n 1) (cons n acc))))",
+                                 "(length (build 1000 '()))", "1000", 1000));
+
+    benchmarks.push_back(Program("list-map", "element", "(define xs " + MakeList(10000) + ")",
+                                 "(length (map (lambda (x) (+ x 1)) xs))", "10000", 10000));
+
+    benchmarks.push_back(
+        Program("list-print", "element", "(define xs " + MakeList(10000) + ")", "xs", "", 10000));
+
+    // The builtin < compares fixnums directly, a lambda is called for every comparison. An
+    // interpreted lambda sorting a million elements doesn't fit in memory, as nothing is
+    // collected before the sort returns, so that one runs compiled.
+    benchmarks.push_back(SortList("sort-10k", 10'000, "<", false));
+    benchmarks.push_back(SortList("sort-1m", 1'000'000, "<", false));
+    benchmarks.push_back(SortList("sort-10k-lambda", 10'000, "(lambda (a b) (< a b))", false));
+    benchmarks.push_back(SortList("sort-1m-lambda", 1'000'000, "(lambda (a b) (< a b))", true));
+
+    benchmarks.push_back(Program("fib", "program",
+                                 "(define (fib n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2)))))",
+                                 "(fib 18)", "2584", 1));
+
+    benchmarks.push_back(Program("tak", "program",
+                                 "(define (tak x y z) (if (not (< y x)) z "
+                                 "(tak (tak (- x 1) y z) (tak (- y 1) z x) (tak (- z 1) x y))))",
+                                 "(tak 12 8 4)", "5", 1));
+
+    benchmarks.push_back(Program(
+        "nqueens", "program",
+        "(define (ok? row dist placed) (if (null? placed) #t "
+        "(and (not (= (car placed) (+ row dist))) (not (= (car placed) (- row dist))) "
+        "(ok? row (+ dist 1) (cdr placed)))))"
+        "(define (try-queens x y z) (if (null? x) (if (null? y) 1 0) "
+        "(+ (if (ok? (car x) 1 z) (try-queens (append (cdr x) y) '() (cons (car x) z)) 0) "
+        "(if (null? (cdr x)) 0 (try-queens (cdr x) (cons (car x) y) z)))))",
+        "(try-queens '(1 2 3 4 5 6) '() '())", "4", 1));
+
+    benchmarks.push_back(Program("ackermann", "program",
+                                 "(define (ack m n) (if (= m 0) (+ n 1) (if (= n 0) "
+                                 "(ack (- m 1) 1) (ack (- m 1) (ack m (- n 1))))))",
+                                 "(ack 2 9)", "21", 1));
+
+    return benchmarks;
+}
+
+CounterValues PerOp(const PerfCounters& counters, uint64_t ops) {
+    CounterValues values;
+    for (size_t i = 0; i < PerfCounters::kCounters; ++i) {
+        if (auto value = counters.Get(static_cast<PerfCounters::Counter>(i))) {
+            values[i] = static_cast<double>(*value) / ops;
+        }
+    }
+    return values;
+}
+
+// counters and collections are null without --perf.
+Result Measure(const Benchmark& benchmark, size_t repetitions, PerfCounters* counters,
+               CollectionCounters* collections) {
+    Result result = {benchmark.name, benchmark.unit, 0, 0, 0, 0, {}, {}};
+    for (size_t i = 0; i < repetitions; ++i) {
+        {
+            SetJitEnabled(benchmark.jit);
+            auto run = benchmark.prepare();
+            if (counters != nullptr) {
+                counters->Reset();
+                collections->counters.Reset();
+                GetInstance<Heap>().SetCheckListener(collections);
+                counters->Start();
+            }
+            auto allocations = GetAllocations();
+            auto start = std::chrono::steady_clock::now();
+            auto ops = run();
+            std::chrono::duration<double, std::nano> elapsed =
+                std::chrono::steady_clock::now() - start;
+            allocations = GetAllocations() - allocations;
+            if (counters != nullptr) {
+                counters->Stop();
+                GetInstance<Heap>().SetCheckListener(nullptr);
+            }
+
+            auto ns_per_op = elapsed.count() * benchmark.threads / ops;
+            if (i == 0 || ns_per_op < result.ns_per_op) {
+                result.ops = ops;
+                result.ns_per_op = ns_per_op;
+                result.allocations_per_op = static_cast<double>(allocations) / ops;
+                if (counters != nullptr) {
+                    result.counters = PerOp(*counters, ops);
+                    result.collection_counters = PerOp(collections->counters, ops);
+                }
+            }
+        }
+        SetJitEnabled(false);
+        // Runs without an interpreter leave their objects behind.
+        GetInstance<Heap>() = Heap();
+    }
+    result.peak_rss_kb = GetPeakRssKb();
+    return result;
+}
+
+void PrintTable(const std::vector<Result>& results, std::ostream* out) {
+    *out << std::left << std::setw(kNameWidth) << "benchmark" << std::setw(10) << "unit"
+         << std::right << std::setw(10) << "ops" << std::setw(14) << "ns/op" << std::setw(12)
+         << "allocs/op" << std::setw(12) << "peak RSS" << '\n';
+    for (const auto& result : results) {
+        *out << std::left << std::setw(kNameWidth) << result.name << std::setw(10) << result.unit
+             << std::right << std::setw(10) << result.ops << std::fixed << std::setprecision(1)
+             << std::setw(14) << result.ns_per_op << std::setw(12) << std::setprecision(2)
+             << result.allocations_per_op << std::setw(9) << result.peak_rss_kb / 1024 << " MB"
+             << '\n';
+    }
+}
+
+void PrintCounter(const std::optional<double>& value, std::ostream* out) {
+    if (value) {
+        *out << std::setw(14) << *value;
+    } else {
+        *out << std::setw(14) << "-";
+    }
+}
+
+// Counters per op, a line for the whole run and one for the collections during it.
+void PrintCounters(const std::vector<Result>& results, std::ostream* out) {
+    *out << '\n' << std::left << std::setw(kNameWidth + 5) << "counters per op" << std::right;
+    for (auto name : PerfCounters::kNames) {
+        *out << std::setw(14) << name;
+    }
+    *out << '\n' << std::fixed << std::setprecision(1);
+    for (const auto& result : results) {
+        for (auto [suffix, counters] : {std::pair{"", &result.counters},
+                                        {" (gc)", &result.collection_counters}}) {
+            *out << std::left << std::setw(kNameWidth + 5) << result.name + suffix << std::right;
+            for (const auto& value : *counters) {
+                PrintCounter(value, out);
+            }
+            *out << '\n';
+        }
+    }
+}
+
+void WriteCounters(const CounterValues& values, std::ostream* out) {
+    *out << '{';
+    for (size_t i = 0; i < values.size(); ++i) {
+        *out << (i != 0 ? ", " : "") << '"' << PerfCounters::kNames[i] << "\": ";
+        if (values[i]) {
+            *out << *values[i];
+        } else {
+            *out << "null";
+        }
+    }
+    *out << '}';
+}
+
+void WriteJson(const std::vector<Result>& results, bool perf, std::ostream* out) {
+    *out << "{\"benchmarks\": [\n";
+    for (size_t i = 0; i < results.size(); ++i) {
+        const auto& result = results[i];
+        *out << "{\"name\": ";
+        WriteJsonString(out, result.name);
+        *out << ", \"unit\": ";
+        WriteJsonString(out, result.unit);
+        *out << ", \"ops\": " << result.ops << ", \"ns_per_op\": " << result.ns_per_op
+             << ", \"allocations_per_op\": " << result.allocations_per_op
+             << ", \"peak_rss_kb\": " << result.peak_rss_kb;
+        if (perf) {
+            *out << ", \"counters\": ";
+            WriteCounters(result.counters, out);
+            *out << ", \"collection_counters\": ";
+            WriteCounters(result.collection_counters, out);
+        }
+        *out << '}' << (i + 1 < results.size() ? ",\n" : "\n");
+    }
+    *out << "]}\n";
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    auto options = ParseOptions(argc, argv);
+    std::unique_ptr<PerfCounters> counters;
+    std::unique_ptr<CollectionCounters> collections;
+    if (options.perf) {
+        counters = std::make_unique<PerfCounters>();
+        collections = std::make_unique<CollectionCounters>();
+        if (!counters->GetError().empty()) {
+            std::cerr << (counters->IsAvailable() ? "some perf counters unavailable: "
+                                                  : "perf counters unavailable: ")
+                      << counters->GetError() << '\n';
+        }
+    }
+
+    std::vector<Result> results;
+    try {
+        for (const auto& benchmark : MakeBenchmarks()) {
+            if (benchmark.name.find(options.filter) != std::string::npos) {
+                results.push_back(Measure(benchmark, options.repetitions, counters.get(),
+                                          collections.get()));
+            }
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "error: " << e.what() << std::endl;
+        return 1;
+    }
+
+    PrintTable(results, &std::cout);
+    if (counters != nullptr && counters->IsAvailable()) {
+        PrintCounters(results, &std::cout);
+    }
+    if (options.json == "-") {
+        WriteJson(results, options.perf, &std::cout);
+    } else if (!options.json.empty()) {
+        std::ofstream json(options.json);
+        WriteJson(results, options.perf, &json);
+    }
+    return 0;
+}
@@ -0,0 +1,7 @@
+(define (count-down n) (if (= n 0) 0 (count-down (- n 1))))
+(do ((i 0 (+ i 1))) ((= i 40) i) (count-down 5000))
+(define (collatz-steps n steps)
+  (if (= n 1)
+      steps
+      (collatz-steps (if (= (- n (* 2 (/ n 2))) 0) (/ n 2) (+ (* 3 n) 1)) (+ steps 1))))
+(do ((n 1 (+ n 1)) (best 0 (max best (collatz-steps n 0)))) ((= n 3000) best))
@@ -0,0 +1,139 @@
+#include "perf_counters.h"
+#include <cerrno>
+#include <cstring>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+#ifdef __linux__
+struct CounterConfig {
+    uint32_t type;
+    uint64_t config;
+};
+
+constexpr uint64_t CacheConfig(uint64_t cache) {
+    return cache | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+}
+
+constexpr std::array<CounterConfig, PerfCounters::kCounters> kConfigs = {{
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+    {PERF_TYPE_HW_CACHE, CacheConfig(PERF_COUNT_HW_CACHE_L1D)},
+    {PERF_TYPE_HW_CACHE, CacheConfig(PERF_COUNT_HW_CACHE_LL)},
+}};
+
+int OpenCounter(const CounterConfig& counter) {
+    perf_event_attr attr = {};
+    attr.size = sizeof(attr);
+    attr.type = counter.type;
+    attr.config = counter.config;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+// With PERF_FORMAT_TOTAL_TIME_*: value, time enabled, time running.
+bool ReadCounter(int fd, uint64_t (&values)[3]) {
+    return fd >= 0 && read(fd, values, sizeof(values)) == sizeof(values);
+}
+#endif
+
+}  // namespace
+
+PerfCounters::PerfCounters() {
+    fds_.fill(-1);
+#ifdef __linux__
+    for (size_t i = 0; i < kCounters; ++i) {
+        fds_[i] = OpenCounter(kConfigs[i]);
+        if (fds_[i] < 0 && error_.empty()) {
+            error_ = std::string(kNames[i]) + ": " + std::strerror(errno);
+        }
+    }
+#else
+    error_ = "perf_event_open needs Linux";
+#endif
+}
+
+PerfCounters::~PerfCounters() {
+#ifdef __linux__
+    for (auto fd : fds_) {
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+#endif
+}
+
+bool PerfCounters::IsAvailable() const {
+    for (auto fd : fds_) {
+        if (fd >= 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+const std::string& PerfCounters::GetError() const {
+    return error_;
+}
+
+void PerfCounters::Start() {
+#ifdef __linux__
+    for (auto fd : fds_) {
+        if (fd >= 0) {
+            ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+#endif
+}
+
+void PerfCounters::Stop() {
+#ifdef __linux__
+    for (auto fd : fds_) {
+        if (fd >= 0) {
+            ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+        }
+    }
+#endif
+}
+
+void PerfCounters::Reset() {
+#ifdef __linux__
+    for (size_t i = 0; i < kCounters; ++i) {
+        uint64_t values[3];
+        if (fds_[i] >= 0) {
+            ioctl(fds_[i], PERF_EVENT_IOC_RESET, 0);
+        }
+        if (ReadCounter(fds_[i], values)) {
+            enabled_at_reset_[i] = values[1];
+            running_at_reset_[i] = values[2];
+        }
+    }
+#endif
+}
+
+std::optional<uint64_t> PerfCounters::Get(Counter counter) const {
+#ifdef __linux__
+    uint64_t values[3];
+    if (!ReadCounter(fds_[counter], values)) {
+        return std::nullopt;
+    }
+    auto enabled = values[1] - enabled_at_reset_[counter];
+    auto running = values[2] - running_at_reset_[counter];
+    if (running == 0 || running == enabled) {
+        return values[0];
+    }
+    return static_cast<uint64_t>(static_cast<double>(values[0]) * enabled / running);
+#else
+    return std::nullopt;
+#endif
+}
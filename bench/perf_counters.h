@@ -0,0 +1,51 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+
+// Hardware counters of the calling thread, user space only, read through Linux
+// perf_event_open. Counters the kernel refuses (no PMU in a VM, perf_event_paranoid, not
+// Linux) are simply missing; the rest still work. The counters run only between Start and
+// Stop and add up over several such intervals until Reset.
+class PerfCounters {
+public:
+    enum Counter { CYCLES, INSTRUCTIONS, BRANCH_MISSES, L1D_MISSES, LLC_MISSES, kCounters };
+
+    static constexpr std::array<const char*, kCounters> kNames = {
+        "cycles", "instructions", "branch_misses", "l1d_misses", "llc_misses"};
+
+    PerfCounters();
+
+    PerfCounters(const PerfCounters& other) = delete;
+
+    PerfCounters& operator=(const PerfCounters& other) = delete;
+
+    ~PerfCounters();
+
+    // Whether any counter could be opened.
+    bool IsAvailable() const;
+
+    // Why the first counter that failed couldn't be opened, empty if none failed.
+    const std::string& GetError() const;
+
+    void Start();
+
+    void Stop();
+
+    void Reset();
+
+    // Counted events, scaled up if the kernel had to multiplex the counters; std::nullopt for
+    // a counter that isn't available.
+    std::optional<uint64_t> Get(Counter counter) const;
+
+private:
+    std::array<int, kCounters> fds_;
+    // Times enabled and running at the last Reset, which leaves them running on: multiplexed
+    // counts are scaled by the ratio since then.
+    std::array<uint64_t, kCounters> enabled_at_reset_ = {};
+    std::array<uint64_t, kCounters> running_at_reset_ = {};
+    std::string error_;
+};
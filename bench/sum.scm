@@ -0,0 +1,4 @@
+(define (sum-to n acc) (if (= n 0) acc (sum-to (- n 1) (+ acc n))))
+(do ((i 0 (+ i 1)) (total 0 (+ total (sum-to 5000 i)))) ((= i 40) total))
+(define (sum-squares n acc) (if (= n 0) acc (sum-squares (- n 1) (+ acc (* n n)))))
+(do ((i 0 (+ i 1)) (total 0 (+ total (sum-squares 5000 i)))) ((= i 40) total))
@@ -1,15 +1,229 @@
+#include <chrono>
+#include <cstdlib>
+#include <exception>
+#include <filesystem>
+#include <fstream>
 #include <iostream>
+#include <iterator>
 #include <string>
+#include <string_view>
 
+#include "src/feedback.h"
+#include "src/jit.h"
 #include "src/scheme.h"
+#include "src/tokenizer.h"
 
-int main() {
-    Interpreter interpreter;
-    std::string input;
+namespace {
 
-    while (std::getline(std::cin, input)) {
-        std::cout << interpreter.Run(input) << std::endl;
+constexpr size_t kOutputBufferSize = 1 << 16;
+constexpr size_t kFeedbackStatsSites = 20;
+
+struct Options {
+    std::string script;
+    PrintMode print_mode = PrintMode::ALL;
+    PrintOptions print_options;
+    bool optimize = true;
+    bool optimizer_stats = false;
+    bool jit = false;
+    bool feedback_stats = false;
+    bool gc_stats = false;
+    std::string heap_snapshot;
+    std::string image;
+    std::string save_image;
+    std::string form_cache;
+    std::string trace;
+    std::chrono::microseconds trace_threshold = Tracer::kDefaultLambdaThreshold;
+    ProfileMode profile = ProfileMode::OFF;
+    std::string profile_stacks;
+};
+
+[[noreturn]] void Usage() {
+    std::cerr << "usage: scheme [--print=all|last|none] [--max-length=N] [--max-depth=N] "
+                 "[--no-optimize] [--optimizer-stats] [--feedback-stats] [--gc-stats] [--jit] "
+                 "[--profile=calls|sample] [--profile-stacks=FILE] [--heap-snapshot=FILE] "
+                 "[--trace=FILE] [--trace-threshold=US] [--image=FILE] [--save-image=FILE] "
+                 "[--cache[=DIR]] [file.scm | -]\n";
+    std::exit(2);
+}
+
+// $XDG_CACHE_HOME/scheme, ~/.cache/scheme without it, and the temporary directory without a
+// home.
+std::string GetDefaultCacheDirectory() {
+    if (auto cache = std::getenv("XDG_CACHE_HOME"); cache != nullptr && *cache != '\0') {
+        return (std::filesystem::path(cache) / "scheme").string();
+    }
+    if (auto home = std::getenv("HOME"); home != nullptr && *home != '\0') {
+        return (std::filesystem::path(home) / ".cache" / "scheme").string();
+    }
+    return (std::filesystem::temp_directory_path() / "scheme").string();
+}
+
+bool ParseFlag(std::string_view arg, std::string_view name, std::string_view* value) {
+    if (!arg.starts_with(name) || arg.size() == name.size() || arg[name.size()] != '=') {
+        return false;
+    }
+    *value = arg.substr(name.size() + 1);
+    return true;
+}
+
+Options ParseOptions(int argc, char** argv) {
+    Options options;
+    if (auto gc_stats = std::getenv("SCHEME_GC_STATS")) {
+        options.gc_stats = std::string_view(gc_stats) != "" && std::string_view(gc_stats) != "0";
+    }
+    for (int i = 1; i < argc; ++i) {
+        std::string_view arg = argv[i];
+        std::string_view value;
+        if (ParseFlag(arg, "--print", &value)) {
+            if (value == "all") {
+                options.print_mode = PrintMode::ALL;
+            } else if (value == "last") {
+                options.print_mode = PrintMode::LAST;
+            } else if (value == "none") {
+                options.print_mode = PrintMode::NONE;
+            } else {
+                Usage();
+            }
+        } else if (ParseFlag(arg, "--max-length", &value)) {
+            options.print_options.max_length = std::stoull(std::string(value));
+        } else if (ParseFlag(arg, "--max-depth", &value)) {
+            options.print_options.max_depth = std::stoull(std::string(value));
+        } else if (ParseFlag(arg, "--profile", &value)) {
+            if (value == "calls") {
+                options.profile = ProfileMode::CALLS;
+            } else if (value == "sample") {
+                options.profile = ProfileMode::SAMPLE;
+            } else {
+                Usage();
+            }
+        } else if (ParseFlag(arg, "--profile-stacks", &value)) {
+            options.profile_stacks = value;
+        } else if (ParseFlag(arg, "--heap-snapshot", &value)) {
+            options.heap_snapshot = value;
+        } else if (ParseFlag(arg, "--image", &value)) {
+            options.image = value;
+        } else if (ParseFlag(arg, "--save-image", &value)) {
+            options.save_image = value;
+        } else if (ParseFlag(arg, "--trace", &value)) {
+            options.trace = value;
+        } else if (ParseFlag(arg, "--trace-threshold", &value)) {
+            options.trace_threshold = std::chrono::microseconds(std::stoll(std::string(value)));
+        } else if (ParseFlag(arg, "--cache", &value)) {
+            options.form_cache = value;
+        } else if (arg == "--cache") {
+            options.form_cache = GetDefaultCacheDirectory();
+        } else if (arg == "--no-optimize") {
+            options.optimize = false;
+        } else if (arg == "--optimizer-stats") {
+            options.optimizer_stats = true;
+        } else if (arg == "--feedback-stats") {
+            options.feedback_stats = true;
+        } else if (arg == "--gc-stats") {
+            options.gc_stats = true;
+        } else if (arg == "--jit") {
+            options.jit = true;
+        } else if ((arg == "-" || !arg.starts_with("-")) && options.script.empty()) {
+            options.script = arg;
+        } else {
+            Usage();
+        }
     }
+    return options;
+}
 
+int RunRepl(Interpreter* interpreter) {
+    std::string input;
+    while (std::getline(std::cin, input)) {
+        std::cout << interpreter->Run(input) << std::endl;
+    }
     return 0;
 }
+
+int RunBatch(Interpreter* interpreter, const Options& options) {
+    // Results are flushed once per buffer instead of once per line; the buffer has to stay
+    // alive until std::cout is destroyed.
+    static char buffer[kOutputBufferSize];
+    std::cout.rdbuf()->pubsetbuf(buffer, sizeof(buffer));
+
+    int status = 0;
+    try {
+        if (options.script == "-") {
+            std::string source(std::istreambuf_iterator<char>(std::cin), {});
+            interpreter->RunScript(source, &std::cout, options.print_mode);
+        } else {
+            MappedFile file(options.script);
+            interpreter->RunScript(file.GetData(), &std::cout, options.print_mode);
+        }
+    } catch (const std::exception& e) {
+        std::cout.flush();
+        std::cerr << "error: " << e.what() << std::endl;
+        status = 1;
+    }
+    std::cout.flush();
+    return status;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    std::ios::sync_with_stdio(false);
+    auto options = ParseOptions(argc, argv);
+
+    Interpreter interpreter;
+    interpreter.SetPrintOptions(options.print_options);
+    interpreter.SetOptimize(options.optimize);
+    interpreter.SetFormCacheDirectory(options.form_cache);
+    SetJitEnabled(options.jit);
+    GetInstance<SiteRegistry>().SetEnabled(options.feedback_stats);
+    if (options.optimizer_stats) {
+        interpreter.SetStatsOutput(&std::cerr);
+    }
+
+    interpreter.SetProfileMode(options.profile);
+    if (!options.trace.empty()) {
+        interpreter.SetTrace(true, options.trace_threshold);
+    }
+
+    if (!options.image.empty()) {
+        try {
+            interpreter.LoadImage(options.image);
+        } catch (const std::exception& e) {
+            std::cerr << "error: " << e.what() << std::endl;
+            return 1;
+        }
+    }
+
+    auto status = options.script.empty() ? RunRepl(&interpreter) : RunBatch(&interpreter, options);
+    if (!options.save_image.empty() && status == 0) {
+        try {
+            interpreter.SaveImage(options.save_image);
+        } catch (const std::exception& e) {
+            std::cerr << "error: " << e.what() << std::endl;
+            status = 1;
+        }
+    }
+    if (options.profile != ProfileMode::OFF) {
+        interpreter.SetProfileMode(ProfileMode::OFF);
+        std::ofstream stacks;
+        if (!options.profile_stacks.empty()) {
+            stacks.open(options.profile_stacks);
+        }
+        interpreter.WriteProfile(&std::cerr, stacks.is_open() ? &stacks : nullptr);
+    }
+    if (options.feedback_stats) {
+        GetInstance<SiteRegistry>().Print(&std::cerr, kFeedbackStatsSites);
+    }
+    if (options.gc_stats) {
+        GetInstance<Heap>().GetStats().Print(&std::cerr);
+    }
+    if (!options.trace.empty()) {
+        interpreter.SetTrace(false);
+        std::ofstream trace(options.trace);
+        interpreter.WriteTrace(&trace);
+    }
+    if (!options.heap_snapshot.empty()) {
+        std::ofstream snapshot(options.heap_snapshot);
+        interpreter.WriteHeapSnapshot(&snapshot);
+    }
+    return status;
+}
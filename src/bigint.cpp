@@ -0,0 +1,432 @@
+#include "bigint.h"
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include "error.h"
+
+namespace {
+
+using Limbs = BigInt::Limbs;
+
+constexpr uint64_t kBase = uint64_t(1) << 32;
+constexpr uint32_t kDecimalChunk = 1000000000;
+constexpr size_t kDecimalChunkDigits = 9;
+
+void Trim(Limbs* limbs) {
+    while (!limbs->empty() && limbs->back() == 0) {
+        limbs->pop_back();
+    }
+}
+
+int CompareMagnitude(const Limbs& lhs, const Limbs& rhs) {
+    if (lhs.size() != rhs.size()) {
+        return lhs.size() < rhs.size() ? -1 : 1;
+    }
+    for (size_t i = lhs.size(); i-- > 0;) {
+        if (lhs[i] != rhs[i]) {
+            return lhs[i] < rhs[i] ? -1 : 1;
+        }
+    }
+    return 0;
+}
+
+Limbs AddMagnitude(const Limbs& lhs, const Limbs& rhs) {
+    const auto& longer = lhs.size() >= rhs.size() ? lhs : rhs;
+    const auto& shorter = lhs.size() >= rhs.size() ? rhs : lhs;
+    Limbs result(longer.size() + 1);
+    uint64_t carry = 0;
+    for (size_t i = 0; i < longer.size(); ++i) {
+        carry += uint64_t(longer[i]) + (i < shorter.size() ? shorter[i] : 0);
+        result[i] = static_cast<uint32_t>(carry);
+        carry >>= 32;
+    }
+    result.back() = static_cast<uint32_t>(carry);
+    Trim(&result);
+    return result;
+}
+
+// lhs has to be at least rhs.
+Limbs SubMagnitude(const Limbs& lhs, const Limbs& rhs) {
+    Limbs result(lhs.size());
+    int64_t borrow = 0;
+    for (size_t i = 0; i < lhs.size(); ++i) {
+        int64_t diff = int64_t(lhs[i]) - (i < rhs.size() ? rhs[i] : 0) - borrow;
+        borrow = diff < 0;
+        result[i] = static_cast<uint32_t>(diff + (borrow ? int64_t(kBase) : 0));
+    }
+    Trim(&result);
+    return result;
+}
+
+// Adds value << (32 * shift) into result, which is long enough to hold the sum.
+void AddShifted(Limbs* result, const Limbs& value, size_t shift) {
+    uint64_t carry = 0;
+    size_t i = 0;
+    for (; i < value.size(); ++i) {
+        carry += uint64_t((*result)[i + shift]) + value[i];
+        (*result)[i + shift] = static_cast<uint32_t>(carry);
+        carry >>= 32;
+    }
+    for (; carry != 0; ++i) {
+        carry += (*result)[i + shift];
+        (*result)[i + shift] = static_cast<uint32_t>(carry);
+        carry >>= 32;
+    }
+}
+
+Limbs SchoolbookMultiply(const Limbs& lhs, const Limbs& rhs) {
+    Limbs result(lhs.size() + rhs.size());
+    for (size_t i = 0; i < lhs.size(); ++i) {
+        uint64_t carry = 0;
+        for (size_t j = 0; j < rhs.size(); ++j) {
+            carry += uint64_t(lhs[i]) * rhs[j] + result[i + j];
+            result[i + j] = static_cast<uint32_t>(carry);
+            carry >>= 32;
+        }
+        result[i + rhs.size()] = static_cast<uint32_t>(carry);
+    }
+    Trim(&result);
+    return result;
+}
+
+Limbs Slice(const Limbs& limbs, size_t begin, size_t end) {
+    begin = std::min(begin, limbs.size());
+    end = std::min(end, limbs.size());
+    Limbs result(limbs.begin() + begin, limbs.begin() + end);
+    Trim(&result);
+    return result;
+}
+
+Limbs MultiplyMagnitude(const Limbs& lhs, const Limbs& rhs) {
+    if (lhs.empty() || rhs.empty()) {
+        return {};
+    }
+    if (std::min(lhs.size(), rhs.size()) < BigInt::kKaratsubaThreshold) {
+        return SchoolbookMultiply(lhs, rhs);
+    }
+
+    // (a1 B^k + a0)(b1 B^k + b0) = z2 B^2k + z1 B^k + z0, z1 = (a0 + a1)(b0 + b1) - z2 - z0
+    size_t half = std::max(lhs.size(), rhs.size()) / 2;
+    auto lhs_low = Slice(lhs, 0, half);
+    auto lhs_high = Slice(lhs, half, lhs.size());
+    auto rhs_low = Slice(rhs, 0, half);
+    auto rhs_high = Slice(rhs, half, rhs.size());
+
+    auto low = MultiplyMagnitude(lhs_low, rhs_low);
+    auto high = MultiplyMagnitude(lhs_high, rhs_high);
+    auto middle = MultiplyMagnitude(AddMagnitude(lhs_low, lhs_high),
+                                    AddMagnitude(rhs_low, rhs_high));
+    middle = SubMagnitude(SubMagnitude(middle, low), high);
+
+    Limbs result(lhs.size() + rhs.size() + 1);
+    AddShifted(&result, low, 0);
+    AddShifted(&result, middle, half);
+    AddShifted(&result, high, 2 * half);
+    Trim(&result);
+    return result;
+}
+
+uint32_t DivModSmall(Limbs* limbs, uint32_t divisor) {
+    uint64_t remainder = 0;
+    for (size_t i = limbs->size(); i-- > 0;) {
+        uint64_t cur = (remainder << 32) | (*limbs)[i];
+        (*limbs)[i] = static_cast<uint32_t>(cur / divisor);
+        remainder = cur % divisor;
+    }
+    Trim(limbs);
+    return static_cast<uint32_t>(remainder);
+}
+
+// Knuth's algorithm D (TAOCP 4.3.1) on 32-bit digits.
+void DivModMagnitude(const Limbs& lhs, const Limbs& rhs, Limbs* quotient, Limbs* remainder) {
+    if (CompareMagnitude(lhs, rhs) < 0) {
+        *quotient = {};
+        *remainder = lhs;
+        return;
+    }
+    if (rhs.size() == 1) {
+        *quotient = lhs;
+        auto rest = DivModSmall(quotient, rhs[0]);
+        *remainder = rest == 0 ? Limbs() : Limbs{rest};
+        return;
+    }
+
+    size_t n = rhs.size();
+    size_t m = lhs.size() - n;
+    int shift = std::countl_zero(rhs.back());
+
+    Limbs divisor(n);
+    for (size_t i = n; i-- > 0;) {
+        uint64_t lower = i > 0 ? uint64_t(rhs[i - 1]) >> (32 - shift) : 0;
+        divisor[i] = static_cast<uint32_t>((uint64_t(rhs[i]) << shift) | lower);
+    }
+    Limbs dividend(lhs.size() + 1);
+    dividend[lhs.size()] = static_cast<uint32_t>(uint64_t(lhs.back()) >> (32 - shift));
+    for (size_t i = lhs.size(); i-- > 0;) {
+        uint64_t lower = i > 0 ? uint64_t(lhs[i - 1]) >> (32 - shift) : 0;
+        dividend[i] = static_cast<uint32_t>((uint64_t(lhs[i]) << shift) | lower);
+    }
+
+    quotient->assign(m + 1, 0);
+    for (size_t j = m + 1; j-- > 0;) {
+        uint64_t top = (uint64_t(dividend[j + n]) << 32) | dividend[j + n - 1];
+        uint64_t qhat = top / divisor[n - 1];
+        uint64_t rhat = top % divisor[n - 1];
+        while (qhat >= kBase ||
+               qhat * divisor[n - 2] > ((rhat << 32) | dividend[j + n - 2])) {
+            --qhat;
+            rhat += divisor[n - 1];
+            if (rhat >= kBase) {
+                break;
+            }
+        }
+
+        int64_t borrow = 0;
+        int64_t diff = 0;
+        for (size_t i = 0; i < n; ++i) {
+            uint64_t product = qhat * divisor[i];
+            diff = int64_t(dividend[i + j]) - borrow - int64_t(product & 0xffffffff);
+            dividend[i + j] = static_cast<uint32_t>(diff);
+            borrow = int64_t(product >> 32) - (diff >> 32);
+        }
+        diff = int64_t(dividend[j + n]) - borrow;
+        dividend[j + n] = static_cast<uint32_t>(diff);
+
+        (*quotient)[j] = static_cast<uint32_t>(qhat);
+        if (diff < 0) {
+            --(*quotient)[j];
+            uint64_t carry = 0;
+            for (size_t i = 0; i < n; ++i) {
+                carry += uint64_t(dividend[i + j]) + divisor[i];
+                dividend[i + j] = static_cast<uint32_t>(carry);
+                carry >>= 32;
+            }
+            dividend[j + n] += static_cast<uint32_t>(carry);
+        }
+    }
+    Trim(quotient);
+
+    remainder->assign(n, 0);
+    for (size_t i = 0; i < n; ++i) {
+        uint64_t upper = (uint64_t(dividend[i + 1]) << 32) >> shift;
+        (*remainder)[i] = static_cast<uint32_t>((dividend[i] >> shift) | upper);
+    }
+    Trim(remainder);
+}
+
+}  // namespace
+
+BigInt::BigInt(int64_t value) : negative_(value < 0) {
+    uint64_t magnitude = negative_ ? ~static_cast<uint64_t>(value) + 1 : value;
+    while (magnitude != 0) {
+        limbs_.push_back(static_cast<uint32_t>(magnitude));
+        magnitude >>= 32;
+    }
+}
+
+BigInt::BigInt(Limbs limbs, bool negative) : limbs_(std::move(limbs)), negative_(negative) {
+    Normalize();
+}
+
+void BigInt::Normalize() {
+    Trim(&limbs_);
+    if (limbs_.empty()) {
+        negative_ = false;
+    }
+}
+
+BigInt BigInt::FromString(std::string_view str) {
+    bool negative = false;
+    if (!str.empty() && (str[0] == '-' || str[0] == '+')) {
+        negative = str[0] == '-';
+        str.remove_prefix(1);
+    }
+    if (str.empty()) {
+        throw SyntaxError("Invalid integer literal");
+    }
+
+    Limbs limbs;
+    size_t first_chunk = str.size() % kDecimalChunkDigits;
+    if (first_chunk == 0) {
+        first_chunk = kDecimalChunkDigits;
+    }
+    for (size_t pos = 0; pos < str.size();) {
+        size_t len = pos == 0 ? first_chunk : kDecimalChunkDigits;
+        uint64_t chunk = 0;
+        uint64_t scale = 1;
+        for (size_t i = pos; i < pos + len; ++i) {
+            if (str[i] < '0' || str[i] > '9') {
+                throw SyntaxError("Invalid integer literal");
+            }
+            chunk = chunk * 10 + (str[i] - '0');
+            scale *= 10;
+        }
+        uint64_t carry = chunk;
+        for (auto& limb : limbs) {
+            carry += uint64_t(limb) * scale;
+            limb = static_cast<uint32_t>(carry);
+            carry >>= 32;
+        }
+        if (carry != 0) {
+            limbs.push_back(static_cast<uint32_t>(carry));
+        }
+        pos += len;
+    }
+    return BigInt(std::move(limbs), negative);
+}
+
+std::string BigInt::ToString() const {
+    if (limbs_.empty()) {
+        return "0";
+    }
+    std::vector<uint32_t> chunks;
+    auto rest = limbs_;
+    while (!rest.empty()) {
+        chunks.push_back(DivModSmall(&rest, kDecimalChunk));
+    }
+
+    std::string result = negative_ ? "-" : "";
+    result += std::to_string(chunks.back());
+    for (size_t i = chunks.size() - 1; i-- > 0;) {
+        auto digits = std::to_string(chunks[i]);
+        result.append(kDecimalChunkDigits - digits.size(), '0');
+        result += digits;
+    }
+    return result;
+}
+
+bool BigInt::IsZero() const {
+    return limbs_.empty();
+}
+
+BigInt BigInt::FromDouble(double value) {
+    value = std::trunc(value);
+    if (std::abs(value) < 0x1p63) {
+        return BigInt(static_cast<int64_t>(value));
+    }
+    // value = mantissa * 2^shift with a 53-bit mantissa; shift is positive this far out.
+    int exponent;
+    auto mantissa = static_cast<uint64_t>(std::ldexp(std::frexp(std::abs(value), &exponent), 53));
+    size_t shift = exponent - 53;
+    auto bits = shift % 32;
+    Limbs limbs(shift / 32 + 3);
+    auto low = mantissa << bits;
+    limbs[shift / 32] = static_cast<uint32_t>(low);
+    limbs[shift / 32 + 1] = static_cast<uint32_t>(low >> 32);
+    limbs[shift / 32 + 2] = bits != 0 ? static_cast<uint32_t>(mantissa >> (64 - bits)) : 0;
+    return BigInt(std::move(limbs), value < 0);
+}
+
+BigInt BigInt::FromLimbs(Limbs limbs, bool negative) {
+    return BigInt(std::move(limbs), negative);
+}
+
+const BigInt::Limbs& BigInt::GetLimbs() const {
+    return limbs_;
+}
+
+bool BigInt::IsNegative() const {
+    return negative_;
+}
+
+bool BigInt::FitsInt64() const {
+    if (limbs_.size() > 2) {
+        return false;
+    }
+    uint64_t magnitude = 0;
+    for (size_t i = limbs_.size(); i-- > 0;) {
+        magnitude = (magnitude << 32) | limbs_[i];
+    }
+    uint64_t limit = uint64_t(std::numeric_limits<int64_t>::max()) + (negative_ ? 1 : 0);
+    return magnitude <= limit;
+}
+
+int64_t BigInt::ToInt64() const {
+    uint64_t magnitude = 0;
+    for (size_t i = limbs_.size(); i-- > 0;) {
+        magnitude = (magnitude << 32) | limbs_[i];
+    }
+    return static_cast<int64_t>(negative_ ? ~magnitude + 1 : magnitude);
+}
+
+double BigInt::ToDouble() const {
+    double result = 0;
+    for (size_t i = limbs_.size(); i-- > 0;) {
+        result = result * static_cast<double>(kBase) + limbs_[i];
+    }
+    return negative_ ? -result : result;
+}
+
+size_t BigInt::Hash() const {
+    size_t hash = negative_;
+    for (auto limb : limbs_) {
+        hash = hash * 1000003 ^ std::hash<uint32_t>()(limb);
+    }
+    return hash;
+}
+
+BigInt BigInt::Abs() const {
+    return BigInt(limbs_, false);
+}
+
+BigInt BigInt::operator-() const {
+    return BigInt(limbs_, !negative_);
+}
+
+BigInt operator+(const BigInt& lhs, const BigInt& rhs) {
+    if (lhs.negative_ == rhs.negative_) {
+        return BigInt(AddMagnitude(lhs.limbs_, rhs.limbs_), lhs.negative_);
+    }
+    if (CompareMagnitude(lhs.limbs_, rhs.limbs_) >= 0) {
+        return BigInt(SubMagnitude(lhs.limbs_, rhs.limbs_), lhs.negative_);
+    }
+    return BigInt(SubMagnitude(rhs.limbs_, lhs.limbs_), rhs.negative_);
+}
+
+BigInt operator-(const BigInt& lhs, const BigInt& rhs) {
+    return lhs + (-rhs);
+}
+
+BigInt operator*(const BigInt& lhs, const BigInt& rhs) {
+    return BigInt(MultiplyMagnitude(lhs.limbs_, rhs.limbs_), lhs.negative_ != rhs.negative_);
+}
+
+BigInt operator/(const BigInt& lhs, const BigInt& rhs) {
+    if (rhs.IsZero()) {
+        throw RuntimeError("Division by zero");
+    }
+    Limbs quotient;
+    Limbs remainder;
+    DivModMagnitude(lhs.limbs_, rhs.limbs_, &quotient, &remainder);
+    return BigInt(std::move(quotient), lhs.negative_ != rhs.negative_);
+}
+
+BigInt operator%(const BigInt& lhs, const BigInt& rhs) {
+    if (rhs.IsZero()) {
+        throw RuntimeError("Division by zero");
+    }
+    Limbs quotient;
+    Limbs remainder;
+    DivModMagnitude(lhs.limbs_, rhs.limbs_, &quotient, &remainder);
+    return BigInt(std::move(remainder), lhs.negative_);
+}
+
+int Compare(const BigInt& lhs, const BigInt& rhs) {
+    if (lhs.negative_ != rhs.negative_) {
+        return lhs.negative_ ? -1 : 1;
+    }
+    int result = CompareMagnitude(lhs.limbs_, rhs.limbs_);
+    return lhs.negative_ ? -result : result;
+}
+
+bool operator==(const BigInt& lhs, const BigInt& rhs) {
+    return lhs.negative_ == rhs.negative_ && lhs.limbs_ == rhs.limbs_;
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Arbitrary precision integer: sign and magnitude, 32-bit limbs, least significant first.
+// Only used once a result leaves the int64_t range, so the operations favour clarity over
+// constant factors, except for multiplication which switches to Karatsuba on big operands.
+class BigInt {
+public:
+    using Limbs = std::vector<uint32_t>;
+
+    // Operands with fewer limbs than this are multiplied by the schoolbook method.
+    static constexpr size_t kKaratsubaThreshold = 32;
+
+    BigInt() = default;
+
+    explicit BigInt(int64_t value);
+
+    // Decimal with an optional sign, e.g. "-123456789012345678901234567890".
+    static BigInt FromString(std::string_view str);
+
+    // Exact value of a finite double, truncated towards zero.
+    static BigInt FromDouble(double value);
+
+    std::string ToString() const;
+
+    // Magnitude and sign, as kept inside; for serializing without a decimal round trip.
+    static BigInt FromLimbs(Limbs limbs, bool negative);
+
+    const Limbs& GetLimbs() const;
+
+    bool IsZero() const;
+
+    bool IsNegative() const;
+
+    bool FitsInt64() const;
+
+    int64_t ToInt64() const;
+
+    double ToDouble() const;
+
+    size_t Hash() const;
+
+    BigInt Abs() const;
+
+    BigInt operator-() const;
+
+    friend BigInt operator+(const BigInt& lhs, const BigInt& rhs);
+
+    friend BigInt operator-(const BigInt& lhs, const BigInt& rhs);
+
+    friend BigInt operator*(const BigInt& lhs, const BigInt& rhs);
+
+    // Truncates towards zero, like int64_t division.
+    friend BigInt operator/(const BigInt& lhs, const BigInt& rhs);
+
+    friend BigInt operator%(const BigInt& lhs, const BigInt& rhs);
+
+    friend int Compare(const BigInt& lhs, const BigInt& rhs);
+
+    friend bool operator==(const BigInt& lhs, const BigInt& rhs);
+
+private:
+    Limbs limbs_;
+    bool negative_ = false;
+
+    BigInt(Limbs limbs, bool negative);
+
+    void Normalize();
+};
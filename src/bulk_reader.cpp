@@ -0,0 +1,117 @@
+#include "bulk_reader.h"
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <exception>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include "classes.h"
+#include "heap.h"
+#include "parser.h"
+#include "tokenizer.h"
+#include "tracer.h"
+
+namespace {
+
+bool IsSpace(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\v' || c == '\f' || c == '\r';
+}
+
+double SecondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+}  // namespace
+
+std::vector<size_t> FindFormBoundaries(std::string_view source, size_t chunks) {
+    std::vector<size_t> boundaries = {0};
+    size_t chunk_size = std::max<size_t>(source.size() / std::max<size_t>(chunks, 1), 1);
+    size_t next_cut = chunk_size;
+    int64_t depth = 0;
+    bool after_quote = false;
+
+    for (size_t i = 0; i < source.size(); ++i) {
+        char c = source[i];
+        if (IsSpace(c)) {
+            if (i >= next_cut && depth == 0 && !after_quote) {
+                boundaries.push_back(i);
+                next_cut = i + chunk_size;
+            }
+            continue;
+        }
+        after_quote = c == '\'';
+        if (c == '(') {
+            ++depth;
+        } else if (c == ')') {
+            --depth;
+        }
+    }
+    boundaries.push_back(source.size());
+    return boundaries;
+}
+
+BulkReadResult BulkRead(std::string_view source, size_t threads) {
+    TraceScope trace("bulk-read", "reader");
+    auto start = std::chrono::steady_clock::now();
+    if (threads == 0) {
+        threads = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+    auto boundaries = FindFormBoundaries(source, threads);
+    size_t chunks = boundaries.size() - 1;
+
+    std::vector<Heap> heaps(chunks);
+    std::vector<std::vector<Object*>> forms(chunks);
+    std::vector<BulkReadChunkStats> stats(chunks);
+    std::vector<std::exception_ptr> errors(chunks);
+
+    auto parse_chunk = [&](size_t index) {
+        TraceScope trace("read-chunk", "reader");
+        auto chunk_start = std::chrono::steady_clock::now();
+        auto chunk = source.substr(boundaries[index], boundaries[index + 1] - boundaries[index]);
+        auto& chunk_stats = stats[index];
+        chunk_stats.bytes = chunk.size();
+        try {
+            Tokenizer tokenizer(chunk);
+            ReadStats read_stats;
+            while (!tokenizer.IsEnd()) {
+                forms[index].push_back(Read(&tokenizer, &heaps[index], &read_stats));
+                chunk_stats.cells += read_stats.cells;
+                chunk_stats.atoms += read_stats.atoms;
+            }
+        } catch (...) {
+            errors[index] = std::current_exception();
+        }
+        chunk_stats.forms = forms[index].size();
+        trace.SetArg("forms", chunk_stats.forms);
+        chunk_stats.seconds = SecondsSince(chunk_start);
+    };
+
+    std::vector<std::thread> workers;
+    workers.reserve(chunks);
+    for (size_t i = 1; i < chunks; ++i) {
+        workers.emplace_back(parse_chunk, i);
+    }
+    if (chunks != 0) {
+        parse_chunk(0);
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    for (const auto& error : errors) {
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+
+    TraceScope splice("splice", "reader");
+    BulkReadResult result;
+    auto& heap = GetInstance<Heap>();
+    for (size_t i = 0; i < chunks; ++i) {
+        heap.Splice(&heaps[i]);
+        result.forms.insert(result.forms.end(), forms[i].begin(), forms[i].end());
+    }
+    result.chunks = std::move(stats);
+    result.seconds = SecondsSince(start);
+    return result;
+}
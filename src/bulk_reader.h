@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstddef>
+#include <string_view>
+#include <vector>
+#include "object.h"
+
+struct BulkReadChunkStats {
+    size_t bytes = 0;
+    size_t forms = 0;
+    size_t cells = 0;
+    size_t atoms = 0;
+    double seconds = 0;
+};
+
+struct BulkReadResult {
+    // Top-level data in source order. They live on the interpreter heap but nothing refers
+    // to them yet, so they have to be linked into a scope before the next collection.
+    std::vector<Object*> forms;
+    std::vector<BulkReadChunkStats> chunks;
+    double seconds = 0;
+};
+
+// Offsets at which source can be cut into about chunks pieces without splitting a
+// top-level form: outside of any list, on whitespace, and not right after a quote.
+// The first offset is always 0 and the last one is source.size().
+std::vector<size_t> FindFormBoundaries(std::string_view source, size_t chunks);
+
+// Parses the chunks on separate threads, each into its own heap, and splices the heaps
+// into the interpreter heap in order. threads == 0 means one per hardware thread.
+BulkReadResult BulkRead(std::string_view source, size_t threads = 0);
@@ -0,0 +1,297 @@
+#include "feedback.h"
+#include <algorithm>
+#include <functional>
+#include <iomanip>
+#include <optional>
+#include <utility>
+#include "profiler.h"
+
+namespace {
+
+constexpr size_t kTextWidth = 40;
+
+template <class Operation, class T, size_t N>
+bool FoldValues(const std::array<T, N>& values, size_t argc, T* result) {
+    *result = values[0];
+    for (size_t i = 1; i < argc; ++i) {
+        if constexpr (std::is_same_v<T, int64_t>) {
+            if (!Operation::Apply(*result, values[i], result)) {
+                return false;
+            }
+        } else {
+            *result = Operation::Apply(*result, values[i]);
+        }
+    }
+    return true;
+}
+
+template <class Compare, class T, size_t N>
+bool ChainValues(const std::array<T, N>& values, size_t argc) {
+    for (size_t i = 1; i < argc; ++i) {
+        if (!Compare()(values[i - 1], values[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// The result of a comparison, nullptr if the operation is arithmetic.
+template <class T, size_t N>
+Object* Compare(ArithmeticSite::Operation operation, const std::array<T, N>& values,
+                size_t argc) {
+    using Operation = ArithmeticSite::Operation;
+    bool result;
+    switch (operation) {
+        case Operation::LESS:
+            result = ChainValues<std::less<>>(values, argc);
+            break;
+        case Operation::GREATER:
+            result = ChainValues<std::greater<>>(values, argc);
+            break;
+        case Operation::EQUAL:
+            result = ChainValues<std::equal_to<>>(values, argc);
+            break;
+        case Operation::LESS_OR_EQUAL:
+            result = ChainValues<std::less_equal<>>(values, argc);
+            break;
+        case Operation::GREATER_OR_EQUAL:
+            result = ChainValues<std::greater_equal<>>(values, argc);
+            break;
+        default:
+            return nullptr;
+    }
+    return GetInstance<Heap>().Make<Symbol>(result);
+}
+
+// Folds the values, false on a fixnum overflow.
+template <class T, size_t N>
+bool Arithmetic(ArithmeticSite::Operation operation, const std::array<T, N>& values, size_t argc,
+                T* result) {
+    using Operation = ArithmeticSite::Operation;
+    switch (operation) {
+        case Operation::PLUS:
+            return FoldValues<PlusOperation>(values, argc, result);
+        case Operation::MINUS:
+            return FoldValues<MinusOperation>(values, argc, result);
+        default:
+            return FoldValues<MulOperation>(values, argc, result);
+    }
+}
+
+const char* StateName(SiteState state) {
+    switch (state) {
+        case SiteState::WARMUP:
+            return "warmup";
+        case SiteState::FIXNUM:
+            return "fixnum";
+        case SiteState::FLONUM:
+            return "flonum";
+        default:
+            return "generic";
+    }
+}
+
+}  // namespace
+
+ArithmeticSite::ArithmeticSite(Object* call, Object* builtin)
+    : ArithmeticSite(call, *GetOperation(builtin), &typeid(*builtin),
+                     GetInstance<SiteRegistry>().Make(call)) {
+}
+
+ArithmeticSite::ArithmeticSite(Object* call, Operation operation, const std::type_info* builtin,
+                               std::shared_ptr<SiteFeedback> feedback)
+    : call_(call), operation_(operation), builtin_(builtin), feedback_(std::move(feedback)) {
+    // The optimizer only makes sites of proper lists of at most kMaxArgs arguments.
+    auto cell = static_cast<Cell*>(call);
+    head_ = cell->GetFirst()->DeepCopy();
+    for (auto node = cell->GetSecond(); node != nullptr; node = cell->GetSecond()) {
+        cell = static_cast<Cell*>(node);
+        args_[argc_] = cell->GetFirst() != nullptr ? cell->GetFirst()->DeepCopy() : nullptr;
+        AddDependency(args_[argc_++]);
+    }
+    AddDependency(call_);
+    AddDependency(head_);
+}
+
+std::optional<ArithmeticSite::Operation> ArithmeticSite::GetOperation(Object* builtin) {
+    if (Is<Plus>(builtin)) {
+        return Operation::PLUS;
+    }
+    if (Is<Minus>(builtin)) {
+        return Operation::MINUS;
+    }
+    if (Is<Mul>(builtin)) {
+        return Operation::MUL;
+    }
+    if (Is<Less>(builtin)) {
+        return Operation::LESS;
+    }
+    if (Is<Greate>(builtin)) {
+        return Operation::GREATER;
+    }
+    if (Is<Equal>(builtin)) {
+        return Operation::EQUAL;
+    }
+    if (Is<LessOrEqual>(builtin)) {
+        return Operation::LESS_OR_EQUAL;
+    }
+    if (Is<GreateOrEqual>(builtin)) {
+        return Operation::GREATER_OR_EQUAL;
+    }
+    return std::nullopt;
+}
+
+Object* ArithmeticSite::GetCall() const {
+    return call_;
+}
+
+const std::type_info& ArithmeticSite::GetBuiltinType() const {
+    return *builtin_;
+}
+
+Object* ArithmeticSite::WithCall(Object* call) const {
+    return GetInstance<Heap>().Make<ArithmeticSite>(call, operation_, builtin_, feedback_);
+}
+
+std::string ArithmeticSite::ToString() {
+    return call_->ToString();
+}
+
+Object* ArithmeticSite::DeepCopy() {
+    return GetInstance<Heap>().Make<ArithmeticSite>(call_, operation_, builtin_, feedback_);
+}
+
+Object* ArithmeticSite::Calculate() {
+    ++feedback_->calls;
+    head_->AddScope(scope_);
+    auto function = head_->Calculate();
+    if (function == nullptr || typeid(*function) != *builtin_) [[unlikely]] {
+        // Rebound or shadowed: an ordinary call.
+        auto call = call_->DeepCopy();
+        call->AddScope(scope_);
+        return call->Calculate();
+    }
+    return Calculate(function);
+}
+
+Object* ArithmeticSite::Calculate(Object* function) {
+    auto& feedback = *feedback_;
+    std::array<Object*, kMaxArgs> args;
+    std::array<int64_t, kMaxArgs> fixnums;
+    std::array<double, kMaxArgs> flonums;
+    bool is_fixnum = true;
+    bool is_flonum = true;
+    for (size_t i = 0; i < argc_; ++i) {
+        args[i] = nullptr;
+        if (args_[i] != nullptr) {
+            args_[i]->AddScope(scope_);
+            args[i] = args_[i]->Calculate();
+        }
+        if (auto number = As<Number>(args[i])) {
+            fixnums[i] = number->GetValue();
+            is_flonum = false;
+        } else if (auto flonum = As<Float>(args[i])) {
+            flonums[i] = flonum->GetValue();
+            is_fixnum = false;
+        } else {
+            is_fixnum = is_flonum = false;
+        }
+    }
+    auto types = is_fixnum   ? SiteState::FIXNUM
+                 : is_flonum ? SiteState::FLONUM
+                             : SiteState::GENERIC;
+
+    // The builtin's frame covers the fold only, not the calls made for the arguments.
+    std::optional<ProfiledCall> call;
+    if (Profiler::IsActive()) [[unlikely]] {
+        call.emplace(function);
+    }
+    if (feedback.state == SiteState::FIXNUM || feedback.state == SiteState::FLONUM) {
+        if (types == feedback.state) [[likely]] {
+            auto result = types == SiteState::FIXNUM ? CalculateFixnums(fixnums)
+                                                     : CalculateFlonums(flonums);
+            if (result != nullptr) {
+                ++feedback.hits;
+                return result;
+            }
+            // A fixnum overflow, the builtin promotes the result to a bignum.
+        } else {
+            ++feedback.deopts;
+            feedback.state =
+                feedback.deopts < kMaxDeopts ? SiteState::WARMUP : SiteState::GENERIC;
+            feedback.streak = 0;
+        }
+    } else if (feedback.state == SiteState::WARMUP) {
+        feedback.streak = types == feedback.last_types ? feedback.streak + 1 : 1;
+        feedback.last_types = types;
+        if (types != SiteState::GENERIC && feedback.streak >= kWarmup) {
+            feedback.state = types;
+        }
+    }
+    return function->Apply(std::vector<Object*>(args.begin(), args.begin() + argc_));
+}
+
+Object* ArithmeticSite::CalculateFixnums(const std::array<int64_t, kMaxArgs>& values) {
+    if (auto result = Compare(operation_, values, argc_)) {
+        return result;
+    }
+    int64_t result;
+    if (!Arithmetic(operation_, values, argc_, &result)) {
+        return nullptr;
+    }
+    return GetInstance<Heap>().Make<Number>(result);
+}
+
+Object* ArithmeticSite::CalculateFlonums(const std::array<double, kMaxArgs>& values) {
+    if (auto result = Compare(operation_, values, argc_)) {
+        return result;
+    }
+    double result;
+    Arithmetic(operation_, values, argc_, &result);
+    return GetInstance<Heap>().Make<Float>(result);
+}
+
+void SiteRegistry::SetEnabled(bool enabled) {
+    enabled_ = enabled;
+}
+
+std::shared_ptr<SiteFeedback> SiteRegistry::Make(Object* call) {
+    auto site = std::make_shared<SiteFeedback>();
+    if (!enabled_) {
+        return site;
+    }
+    site->text = call->ToString();
+    if (site->text.size() > kTextWidth) {
+        site->text.resize(kTextWidth - 3);
+        site->text += "...";
+    }
+    // Forget the collected sites before the list grows, so it stays proportional to the live ones.
+    if (sites_.size() == sites_.capacity()) {
+        std::erase_if(sites_, [](const auto& entry) { return entry.expired(); });
+    }
+    sites_.push_back(site);
+    return site;
+}
+
+void SiteRegistry::Print(std::ostream* out, size_t limit) const {
+    std::vector<std::shared_ptr<const SiteFeedback>> sites;
+    for (const auto& entry : sites_) {
+        auto site = entry.lock();
+        if (site != nullptr && site->calls != 0) {
+            sites.push_back(std::move(site));
+        }
+    }
+    limit = std::min(limit, sites.size());
+    std::partial_sort(sites.begin(), sites.begin() + limit, sites.end(),
+                      [](const auto& lhs, const auto& rhs) { return lhs->calls > rhs->calls; });
+
+    *out << std::left << std::setw(kTextWidth) << "site" << std::right << std::setw(12) << "calls"
+         << std::setw(8) << "hit%" << std::setw(8) << "deopts" << "  state\n";
+    for (size_t i = 0; i < limit; ++i) {
+        const auto& site = sites[i];
+        *out << std::left << std::setw(kTextWidth) << site->text << std::right << std::setw(12)
+             << site->calls << std::setw(7) << std::fixed << std::setprecision(1)
+             << 100.0 * site->hits / site->calls << '%' << std::setw(8) << site->deopts << "  "
+             << StateName(site->state) << '\n';
+    }
+}
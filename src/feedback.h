@@ -0,0 +1,117 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <typeinfo>
+#include <vector>
+#include "classes.h"
+#include "heap.h"
+#include "object.h"
+
+enum class SiteState { WARMUP, FIXNUM, FLONUM, GENERIC };
+
+// What a call site has seen so far, shared by all copies of the site.
+struct SiteFeedback {
+    // Source of the call, for the statistics.
+    std::string text;
+    SiteState state = SiteState::WARMUP;
+    // Argument types of the last call during warm-up, and how many calls in a row had them.
+    SiteState last_types = SiteState::GENERIC;
+    uint32_t streak = 0;
+    uint32_t deopts = 0;
+    uint64_t calls = 0;
+    // Calls answered by the specialized code.
+    uint64_t hits = 0;
+};
+
+// Call of an arithmetic or comparison builtin with 2 to kMaxArgs arguments, put in place of the
+// plain call by the optimizer. Once kWarmup calls in a row got only fixnums, or only flonums,
+// the site computes the result itself: no argument vector, no generic type checks. A call with
+// other types deoptimizes it back to the warm-up, and after kMaxDeopts of those the site stays
+// generic. The operator is still evaluated on every call, so rebinding or shadowing the builtin
+// turns the site into an ordinary call.
+class ArithmeticSite : public Object {
+public:
+    static constexpr size_t kMaxArgs = 4;
+    static constexpr uint32_t kWarmup = 4;
+    static constexpr uint32_t kMaxDeopts = 4;
+
+    enum class Operation {
+        PLUS,
+        MINUS,
+        MUL,
+        LESS,
+        GREATER,
+        EQUAL,
+        LESS_OR_EQUAL,
+        GREATER_OR_EQUAL,
+    };
+
+    // The operation of a builtin sites can specialize, std::nullopt for anything else.
+    static std::optional<Operation> GetOperation(Object* builtin);
+
+    // The call as written; never evaluated in place.
+    Object* GetCall() const;
+
+    const std::type_info& GetBuiltinType() const;
+
+    // A site of the same builtin for another spelling of the call, e.g. with renamed variables.
+    // It shares the feedback of this one.
+    Object* WithCall(Object* call) const;
+
+    virtual std::string ToString() override;
+
+    virtual Object* DeepCopy() override;
+
+    virtual Object* Calculate() override;
+
+private:
+    Object* call_;
+    Operation operation_;
+    // Type of the builtin, so the site doesn't keep the builtin itself alive.
+    const std::type_info* builtin_;
+    // Copies of the parts of call_, evaluated in place.
+    Object* head_;
+    std::array<Object*, kMaxArgs> args_;
+    size_t argc_ = 0;
+    // Shared by the copies of the site and freed with the last of them.
+    std::shared_ptr<SiteFeedback> feedback_;
+
+    friend Heap;
+
+    // A new site with fresh feedback.
+    ArithmeticSite(Object* call, Object* builtin);
+
+    ArithmeticSite(Object* call, Operation operation, const std::type_info* builtin,
+                   std::shared_ptr<SiteFeedback> feedback);
+
+    // The call, once the operator turned out to be the builtin.
+    Object* Calculate(Object* function);
+
+    Object* CalculateFixnums(const std::array<int64_t, kMaxArgs>& values);
+
+    Object* CalculateFlonums(const std::array<double, kMaxArgs>& values);
+};
+
+// Feedback of the live sites, for --feedback-stats. Sites are only listed while the statistics
+// are enabled, and the list doesn't keep them alive: a site collected with its code, e.g. of a
+// top-level form that ran once, drops out of the table.
+class SiteRegistry {
+public:
+    void SetEnabled(bool enabled);
+
+    // Feedback for a new site of call.
+    std::shared_ptr<SiteFeedback> Make(Object* call);
+
+    // A table of the busiest sites.
+    void Print(std::ostream* out, size_t limit) const;
+
+private:
+    bool enabled_ = false;
+    std::vector<std::weak_ptr<SiteFeedback>> sites_;
+};
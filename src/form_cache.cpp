@@ -0,0 +1,281 @@
+#include "form_cache.h"
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <typeinfo>
+#include "bigint.h"
+#include "error.h"
+#include "heap.h"
+
+namespace {
+
+constexpr std::string_view kMagic = "SCMFORMS";
+constexpr uint64_t kFnvOffset = 14695981039346656037ULL;
+constexpr uint64_t kFnvPrime = 1099511628211ULL;
+
+// Magic, version, source hash, source size and payload hash.
+constexpr size_t kHeaderSize = kMagic.size() + sizeof(uint32_t) + 3 * sizeof(uint64_t);
+
+enum class Op : uint8_t {
+    NIL,
+    NUMBER,
+    BIG_NUMBER,
+    FLOAT,
+    SYMBOL,
+    CONS,
+    END,
+};
+
+uint64_t Fnv1a(std::string_view data, uint64_t hash = kFnvOffset) {
+    for (auto c : data) {
+        hash = (hash ^ static_cast<uint8_t>(c)) * kFnvPrime;
+    }
+    return hash;
+}
+
+template <class T>
+void Put(std::string* out, T value) {
+    out->append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+void PutVarint(std::string* out, uint64_t value) {
+    while (value >= 0x80) {
+        out->push_back(static_cast<char>(value | 0x80));
+        value >>= 7;
+    }
+    out->push_back(static_cast<char>(value));
+}
+
+void PutOp(std::string* out, Op op) {
+    out->push_back(static_cast<char>(op));
+}
+
+void PutString(std::string* out, std::string_view str) {
+    PutVarint(out, str.size());
+    out->append(str);
+}
+
+[[noreturn]] void Corrupt() {
+    throw RuntimeError("Damaged form cache");
+}
+
+}  // namespace
+
+uint64_t HashSource(std::string_view source) {
+    return Fnv1a(source);
+}
+
+std::string GetFormCacheName(uint64_t source_hash) {
+    char name[32];
+    std::snprintf(name, sizeof(name), "%016llx.forms",
+                  static_cast<unsigned long long>(source_hash));
+    return name;
+}
+
+void FormCacheWriter::Add(Object* form, const ReadStats& stats) {
+    PutVarint(&forms_, stats.max_depth);
+    // Post-order walk; a pair is visited twice, the second time to emit CONS.
+    std::vector<std::pair<Object*, bool>> stack = {{form, false}};
+    while (!stack.empty()) {
+        auto [obj, children_done] = stack.back();
+        stack.pop_back();
+        if (obj == nullptr) {
+            PutOp(&forms_, Op::NIL);
+            continue;
+        }
+        // Reader output has no subclasses, so exact types do and are much cheaper than As.
+        const auto& type = typeid(*obj);
+        if (type == typeid(Cell)) {
+            auto cell = static_cast<Cell*>(obj);
+            if (children_done) {
+                PutOp(&forms_, Op::CONS);
+            } else {
+                stack.emplace_back(cell, true);
+                stack.emplace_back(cell->GetSecond(), false);
+                stack.emplace_back(cell->GetFirst(), false);
+            }
+        } else if (type == typeid(Symbol)) {
+            const auto& name = static_cast<Symbol*>(obj)->GetName();
+            auto it = symbol_ids_.find(name);
+            if (it == symbol_ids_.end()) {
+                it = symbol_ids_.emplace(name, symbols_.size()).first;
+                symbols_.push_back(it->first);
+            }
+            PutOp(&forms_, Op::SYMBOL);
+            PutVarint(&forms_, it->second);
+        } else if (type == typeid(Number)) {
+            auto value = static_cast<Number*>(obj)->GetValue();
+            PutOp(&forms_, Op::NUMBER);
+            PutVarint(&forms_, (static_cast<uint64_t>(value) << 1) ^ (value < 0 ? ~0ULL : 0));
+        } else if (type == typeid(BigNumber)) {
+            const auto& value = static_cast<BigNumber*>(obj)->GetValue();
+            PutOp(&forms_, Op::BIG_NUMBER);
+            PutVarint(&forms_, value.GetLimbs().size() << 1 | value.IsNegative());
+            for (auto limb : value.GetLimbs()) {
+                Put(&forms_, limb);
+            }
+        } else if (type == typeid(Float)) {
+            PutOp(&forms_, Op::FLOAT);
+            Put(&forms_, static_cast<Float*>(obj)->GetValue());
+        } else {
+            throw RuntimeError("Only forms straight from the reader can be cached");
+        }
+    }
+    PutOp(&forms_, Op::END);
+    ++count_;
+}
+
+bool FormCacheWriter::Write(const std::string& path, uint64_t source_hash,
+                            size_t source_size) const {
+    std::string payload;
+    PutVarint(&payload, symbols_.size());
+    for (auto symbol : symbols_) {
+        PutString(&payload, symbol);
+    }
+    PutVarint(&payload, count_);
+
+    std::string header(kMagic);
+    Put(&header, kFormCacheVersion);
+    Put(&header, source_hash);
+    Put(&header, static_cast<uint64_t>(source_size));
+    // forms_ follows payload, so the hash runs over both.
+    Put(&header, Fnv1a(forms_, Fnv1a(payload)));
+
+    auto temporary = path + ".tmp";
+    {
+        std::ofstream out(temporary, std::ios::binary);
+        out.write(header.data(), header.size());
+        out.write(payload.data(), payload.size());
+        out.write(forms_.data(), forms_.size());
+        if (!out) {
+            std::remove(temporary.c_str());
+            return false;
+        }
+    }
+    return std::rename(temporary.c_str(), path.c_str()) == 0;
+}
+
+FormCacheReader::FormCacheReader(std::string_view data) : data_(data) {
+}
+
+bool FormCacheReader::IsValid(uint64_t source_hash, size_t source_size) {
+    if (data_.size() < kHeaderSize || data_.substr(0, kMagic.size()) != kMagic) {
+        return false;
+    }
+    uint32_t version;
+    uint64_t header[3];
+    std::memcpy(&version, data_.data() + kMagic.size(), sizeof(version));
+    std::memcpy(header, data_.data() + kMagic.size() + sizeof(version), sizeof(header));
+    if (version != kFormCacheVersion || header[0] != source_hash || header[1] != source_size ||
+        header[2] != Fnv1a(data_.substr(kHeaderSize))) {
+        return false;
+    }
+
+    pos_ = kHeaderSize;
+    symbols_.resize(GetVarint());
+    for (auto& symbol : symbols_) {
+        symbol = GetBytes(GetVarint());
+    }
+    forms_left_ = GetVarint();
+    return true;
+}
+
+bool FormCacheReader::IsEnd() const {
+    return forms_left_ == 0;
+}
+
+Object* FormCacheReader::Next(ReadStats* stats) {
+    if (forms_left_ == 0) {
+        Corrupt();
+    }
+    --forms_left_;
+    auto& heap = GetInstance<Heap>();
+    ReadStats form_stats;
+    form_stats.max_depth = GetVarint();
+    stack_.clear();
+    while (true) {
+        if (pos_ == data_.size()) {
+            Corrupt();
+        }
+        auto op = static_cast<Op>(data_[pos_++]);
+        switch (op) {
+            case Op::NIL:
+                stack_.push_back(nullptr);
+                continue;
+            case Op::NUMBER: {
+                auto value = GetVarint();
+                stack_.push_back(heap.Make<Number>(static_cast<int64_t>(value >> 1) ^
+                                                   -static_cast<int64_t>(value & 1)));
+                break;
+            }
+            case Op::BIG_NUMBER: {
+                auto header = GetVarint();
+                BigInt::Limbs limbs(header >> 1);
+                auto bytes = GetBytes(limbs.size() * sizeof(uint32_t));
+                std::memcpy(limbs.data(), bytes.data(), bytes.size());
+                stack_.push_back(
+                    heap.Make<BigNumber>(BigInt::FromLimbs(std::move(limbs), header & 1)));
+                break;
+            }
+            case Op::FLOAT: {
+                double value;
+                std::memcpy(&value, GetBytes(sizeof(value)).data(), sizeof(value));
+                stack_.push_back(heap.Make<Float>(value));
+                break;
+            }
+            case Op::SYMBOL: {
+                auto id = GetVarint();
+                if (id >= symbols_.size()) {
+                    Corrupt();
+                }
+                stack_.push_back(heap.Make<Symbol>(std::string(symbols_[id])));
+                break;
+            }
+            case Op::CONS: {
+                if (stack_.size() < 2) {
+                    Corrupt();
+                }
+                auto second = stack_.back();
+                stack_.pop_back();
+                stack_.back() = heap.Make<Cell>(stack_.back(), second);
+                ++form_stats.cells;
+                continue;
+            }
+            case Op::END:
+                if (stack_.size() != 1) {
+                    Corrupt();
+                }
+                if (stats != nullptr) {
+                    *stats = form_stats;
+                }
+                return stack_.back();
+            default:
+                Corrupt();
+        }
+        ++form_stats.atoms;
+    }
+}
+
+uint64_t FormCacheReader::GetVarint() {
+    uint64_t value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        if (pos_ == data_.size()) {
+            Corrupt();
+        }
+        auto byte = static_cast<uint8_t>(data_[pos_++]);
+        value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0) {
+            return value;
+        }
+    }
+    Corrupt();
+}
+
+std::string_view FormCacheReader::GetBytes(size_t size) {
+    if (data_.size() - pos_ < size) {
+        Corrupt();
+    }
+    auto bytes = data_.substr(pos_, size);
+    pos_ += size;
+    return bytes;
+}
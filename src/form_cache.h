@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "object.h"
+#include "parser.h"
+
+// On-disk cache of the parsed top-level forms of a script, so running the same source again
+// skips the tokenizer and the parser. A cache file is named after the FNV-1a hash of the
+// source and holds its forms as they came out of the reader, before any evaluation; forms
+// after optimization depend on the bindings at the time and aren't cached.
+//
+// Layout, in host byte order: the magic "SCMFORMS", kFormCacheVersion, the hash and size of
+// the source, the FNV-1a hash of the rest of the file, then the symbol names and the forms.
+// Integers after the header are LEB128 varints. Every form is postfix code for a stack
+// machine, so neither writing nor reading it recurses:
+//   NIL | NUMBER zigzag | BIG_NUMBER size*2+sign limbs | FLOAT bits | SYMBOL index | CONS | END.
+// CONS pops the cdr and then the car and pushes the pair, END finishes the form.
+
+// Bump on every change of the layout or of what the parser produces.
+constexpr uint32_t kFormCacheVersion = 1;
+
+uint64_t HashSource(std::string_view source);
+
+// File name of the cache of the source with the given hash.
+std::string GetFormCacheName(uint64_t source_hash);
+
+class FormCacheWriter {
+public:
+    // Appends a form straight from the reader; it must not have been evaluated yet.
+    void Add(Object* form, const ReadStats& stats);
+
+    // Writes the cache of a source with the given hash and size to path, through a temporary
+    // file renamed into place so a concurrent reader never sees half of it. Returns false if
+    // that failed.
+    bool Write(const std::string& path, uint64_t source_hash, size_t source_size) const;
+
+private:
+    std::unordered_map<std::string, uint32_t> symbol_ids_;
+    std::vector<std::string_view> symbols_;
+    std::string forms_;
+    size_t count_ = 0;
+};
+
+// Decodes the forms of a cache file, one at a time, into the interpreter heap. data has to
+// stay alive while the reader is used.
+class FormCacheReader {
+public:
+    explicit FormCacheReader(std::string_view data);
+
+    // Whether data is an intact cache of the source with the given hash and size, written by
+    // this version of the interpreter. Reading the forms is only allowed after it returned true.
+    bool IsValid(uint64_t source_hash, size_t source_size);
+
+    bool IsEnd() const;
+
+    // The next form; throws RuntimeError if the cache is damaged after all.
+    Object* Next(ReadStats* stats = nullptr);
+
+private:
+    std::string_view data_;
+    size_t pos_ = 0;
+    std::vector<std::string_view> symbols_;
+    size_t forms_left_ = 0;
+    std::vector<Object*> stack_;
+
+    uint64_t GetVarint();
+
+    std::string_view GetBytes(size_t size);
+};
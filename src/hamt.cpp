@@ -0,0 +1,428 @@
+#include "hamt.h"
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <string>
+#include <utility>
+#include <vector>
+#include "classes.h"
+#include "error.h"
+
+namespace {
+
+uint64_t MixHash(uint64_t x) {
+    x += 0x9e3779b97f4a7c15ull;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+    return x ^ (x >> 31);
+}
+
+uint32_t SlotBit(uint64_t hash, size_t shift) {
+    return 1u << ((hash >> shift) & HamtNode::kLevelMask);
+}
+
+}  // namespace
+
+uint64_t HashKey(Object* key) {
+    if (Is<Number>(key)) {
+        return MixHash(static_cast<uint64_t>(As<Number>(key)->GetValue()));
+    }
+    if (Is<BigNumber>(key)) {
+        return MixHash(As<BigNumber>(key)->GetValue().Hash());
+    }
+    if (Is<Float>(key)) {
+        // +0.0 and -0.0 are equal keys, so they have to share a hash.
+        double value = As<Float>(key)->GetValue();
+        return MixHash(std::bit_cast<uint64_t>(value == 0 ? 0.0 : value));
+    }
+    if (Is<Symbol>(key)) {
+        return MixHash(std::hash<std::string>()(As<Symbol>(key)->GetName()));
+    }
+    throw RuntimeError("Invalid type of map key");
+}
+
+bool IsSameKey(Object* lhs, Object* rhs) {
+    if (lhs == rhs) {
+        return true;
+    }
+    if (Is<Number>(lhs) && Is<Number>(rhs)) {
+        return As<Number>(lhs)->GetValue() == As<Number>(rhs)->GetValue();
+    }
+    if (Is<BigNumber>(lhs) && Is<BigNumber>(rhs)) {
+        return As<BigNumber>(lhs)->GetValue() == As<BigNumber>(rhs)->GetValue();
+    }
+    if (Is<Float>(lhs) && Is<Float>(rhs)) {
+        return As<Float>(lhs)->GetValue() == As<Float>(rhs)->GetValue();
+    }
+    if (Is<Symbol>(lhs) && Is<Symbol>(rhs)) {
+        return As<Symbol>(lhs)->GetName() == As<Symbol>(rhs)->GetName();
+    }
+    return false;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+
+HamtNode::HamtNode(uint32_t bitmap, bool is_collision, std::vector<Entry> entries)
+    : bitmap_(bitmap), is_collision_(is_collision), entries_(std::move(entries)) {
+    for (const auto& entry : entries_) {
+        AddDependency(entry.key);
+        AddDependency(entry.value);
+        AddDependency(entry.child);
+    }
+}
+
+HamtNode* HamtNode::Make(uint32_t bitmap, bool is_collision, std::vector<Entry> entries) {
+    return static_cast<HamtNode*>(
+        GetInstance<Heap>().Make<HamtNode>(bitmap, is_collision, std::move(entries)));
+}
+
+size_t HamtNode::Position(uint32_t bit) const {
+    return std::popcount(bitmap_ & (bit - 1));
+}
+
+HamtNode* HamtNode::MergeLeaves(size_t shift, Entry first, uint64_t first_hash, Entry second,
+                                uint64_t second_hash) {
+    if (shift >= kMaxShift) {
+        return Make(0, true, {first, second});
+    }
+    auto first_bit = SlotBit(first_hash, shift);
+    auto second_bit = SlotBit(second_hash, shift);
+    if (first_bit == second_bit) {
+        auto child = MergeLeaves(shift + kBitsPerLevel, first, first_hash, second, second_hash);
+        return Make(first_bit, false, {Entry{nullptr, nullptr, child}});
+    }
+    if (first_bit > second_bit) {
+        std::swap(first, second);
+    }
+    return Make(first_bit | second_bit, false, {first, second});
+}
+
+HamtNode* HamtNode::Assoc(HamtNode* node, size_t shift, uint64_t hash, Object* key,
+                          Object* value, bool* added) {
+    if (node == nullptr) {
+        *added = true;
+        if (shift >= kMaxShift) {
+            return Make(0, true, {Entry{key, value, nullptr}});
+        }
+        return Make(SlotBit(hash, shift), false, {Entry{key, value, nullptr}});
+    }
+
+    if (node->is_collision_) {
+        auto entries = node->entries_;
+        for (auto& entry : entries) {
+            if (IsSameKey(entry.key, key)) {
+                entry.value = value;
+                return Make(0, true, std::move(entries));
+            }
+        }
+        *added = true;
+        entries.push_back(Entry{key, value, nullptr});
+        return Make(0, true, std::move(entries));
+    }
+
+    auto bit = SlotBit(hash, shift);
+    auto pos = node->Position(bit);
+    auto entries = node->entries_;
+
+    if ((node->bitmap_ & bit) == 0) {
+        *added = true;
+        entries.insert(entries.begin() + pos, Entry{key, value, nullptr});
+        return Make(node->bitmap_ | bit, false, std::move(entries));
+    }
+
+    auto& entry = entries[pos];
+    if (entry.child != nullptr) {
+        entry.child = Assoc(entry.child, shift + kBitsPerLevel, hash, key, value, added);
+    } else if (IsSameKey(entry.key, key)) {
+        if (entry.value == value) {
+            return node;
+        }
+        entry.value = value;
+    } else {
+        *added = true;
+        entry = Entry{nullptr, nullptr,
+                      MergeLeaves(shift + kBitsPerLevel, entry, HashKey(entry.key),
+                                  Entry{key, value, nullptr}, hash)};
+    }
+    return Make(node->bitmap_, false, std::move(entries));
+}
+
+HamtNode* HamtNode::Dissoc(HamtNode* node, size_t shift, uint64_t hash, Object* key,
+                           bool* removed) {
+    if (node == nullptr) {
+        return nullptr;
+    }
+
+    if (node->is_collision_) {
+        for (size_t i = 0; i < node->entries_.size(); ++i) {
+            if (IsSameKey(node->entries_[i].key, key)) {
+                *removed = true;
+                if (node->entries_.size() == 1) {
+                    return nullptr;
+                }
+                auto entries = node->entries_;
+                entries.erase(entries.begin() + i);
+                return Make(0, true, std::move(entries));
+            }
+        }
+        return node;
+    }
+
+    auto bit = SlotBit(hash, shift);
+    if ((node->bitmap_ & bit) == 0) {
+        return node;
+    }
+    auto pos = node->Position(bit);
+    const auto& entry = node->entries_[pos];
+
+    if (entry.child != nullptr) {
+        auto child = Dissoc(entry.child, shift + kBitsPerLevel, hash, key, removed);
+        if (!*removed) {
+            return node;
+        }
+        if (child != nullptr) {
+            auto entries = node->entries_;
+            // A subtree that shrank to a single leaf is pulled up into this level.
+            if (child->entries_.size() == 1 && child->entries_[0].child == nullptr) {
+                entries[pos] = child->entries_[0];
+            } else {
+                entries[pos].child = child;
+            }
+            return Make(node->bitmap_, false, std::move(entries));
+        }
+    } else if (!IsSameKey(entry.key, key)) {
+        return node;
+    }
+
+    *removed = true;
+    if (node->entries_.size() == 1) {
+        return nullptr;
+    }
+    auto entries = node->entries_;
+    entries.erase(entries.begin() + pos);
+    return Make(node->bitmap_ & ~bit, false, std::move(entries));
+}
+
+Object* HamtNode::Find(HamtNode* node, uint64_t hash, Object* key, bool* found) {
+    size_t shift = 0;
+    while (node != nullptr) {
+        if (node->is_collision_) {
+            for (const auto& entry : node->entries_) {
+                if (IsSameKey(entry.key, key)) {
+                    *found = true;
+                    return entry.value;
+                }
+            }
+            break;
+        }
+        auto bit = SlotBit(hash, shift);
+        if ((node->bitmap_ & bit) == 0) {
+            break;
+        }
+        const auto& entry = node->entries_[node->Position(bit)];
+        if (entry.child == nullptr) {
+            if (IsSameKey(entry.key, key)) {
+                *found = true;
+                return entry.value;
+            }
+            break;
+        }
+        node = entry.child;
+        shift += kBitsPerLevel;
+    }
+    *found = false;
+    return nullptr;
+}
+
+void HamtNode::ForEach(std::vector<Entry>* out) const {
+    for (const auto& entry : entries_) {
+        if (entry.child != nullptr) {
+            entry.child->ForEach(out);
+        } else {
+            out->push_back(entry);
+        }
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+
+PersistentMap::PersistentMap(HamtNode* root, size_t size) : root_(root), size_(size) {
+    AddDependency(root_);
+}
+
+size_t PersistentMap::GetSize() const {
+    return size_;
+}
+
+Object* PersistentMap::Get(Object* key, bool* found) const {
+    return HamtNode::Find(root_, HashKey(key), key, found);
+}
+
+PersistentMap* PersistentMap::Assoc(Object* key, Object* value) {
+    bool added = false;
+    auto root = HamtNode::Assoc(root_, 0, HashKey(key), key, value, &added);
+    if (root == root_) {
+        return this;
+    }
+    return As<PersistentMap>(GetInstance<Heap>().Make<PersistentMap>(root, size_ + added));
+}
+
+PersistentMap* PersistentMap::Dissoc(Object* key) {
+    bool removed = false;
+    auto root = HamtNode::Dissoc(root_, 0, HashKey(key), key, &removed);
+    if (!removed) {
+        return this;
+    }
+    return As<PersistentMap>(GetInstance<Heap>().Make<PersistentMap>(root, size_ - 1));
+}
+
+std::vector<HamtNode::Entry> PersistentMap::GetEntries() const {
+    std::vector<HamtNode::Entry> entries;
+    entries.reserve(size_);
+    if (root_ != nullptr) {
+        root_->ForEach(&entries);
+    }
+    return entries;
+}
+
+std::string PersistentMap::ToString() {
+    return "#[map " + std::to_string(size_) + "]";
+}
+
+Object* PersistentMap::DeepCopy() {
+    return this;  // immutable, so versions can be shared freely
+}
+
+Object* PersistentMap::Calculate() {
+    return this;
+}
+
+////////////////////////////////FUNCTIONS//////////////////////////////////////////////////
+
+Object* MakeMap::operator()(Object* root) {
+    ThrowScope();
+    auto args = GetArgs(root);
+    if (args.size() % 2 != 0) {
+        throw RuntimeError("Invalid number of arguments");
+    }
+    auto map = As<PersistentMap>(GetInstance<Heap>().Make<PersistentMap>(nullptr, 0));
+    for (size_t i = 0; i < args.size(); i += 2) {
+        map = map->Assoc(args[i], args[i + 1]);
+    }
+    return map;
+}
+
+Object* MakeMap::DeepCopy() {
+    return GetInstance<Heap>().Make<MakeMap>();
+}
+
+Object* MapAssoc::operator()(Object* root) {
+    ThrowScope();
+    auto args = GetArgs(root);
+    RequireArgsRE(args, 3, std::numeric_limits<size_t>::max());
+    CheckExpectedType<PersistentMap>({args[0]});
+    if (args.size() % 2 == 0) {
+        throw RuntimeError("Invalid number of arguments");
+    }
+    auto map = As<PersistentMap>(args[0]);
+    for (size_t i = 1; i < args.size(); i += 2) {
+        map = map->Assoc(args[i], args[i + 1]);
+    }
+    return map;
+}
+
+Object* MapAssoc::DeepCopy() {
+    return GetInstance<Heap>().Make<MapAssoc>();
+}
+
+Object* MapDissoc::operator()(Object* root) {
+    ThrowScope();
+    auto args = GetArgs(root);
+    RequireArgsRE(args, 2, std::numeric_limits<size_t>::max());
+    CheckExpectedType<PersistentMap>({args[0]});
+    auto map = As<PersistentMap>(args[0]);
+    for (size_t i = 1; i < args.size(); ++i) {
+        map = map->Dissoc(args[i]);
+    }
+    return map;
+}
+
+Object* MapDissoc::DeepCopy() {
+    return GetInstance<Heap>().Make<MapDissoc>();
+}
+
+Object* MapGet::operator()(Object* root) {
+    ThrowScope();
+    auto args = GetArgs(root);
+    RequireArgsRE(args, 2, 3);
+    CheckExpectedType<PersistentMap>({args[0]});
+    bool found = false;
+    auto value = As<PersistentMap>(args[0])->Get(args[1], &found);
+    if (found) {
+        return value;
+    }
+    if (args.size() == 3) {
+        return args[2];
+    }
+    throw RuntimeError("Key is not found");
+}
+
+Object* MapGet::DeepCopy() {
+    return GetInstance<Heap>().Make<MapGet>();
+}
+
+Object* MapContains::operator()(Object* root) {
+    ThrowScope();
+    auto args = GetArgs(root);
+    RequireArgsRE(args, 2, 2);
+    CheckExpectedType<PersistentMap>({args[0]});
+    bool found = false;
+    As<PersistentMap>(args[0])->Get(args[1], &found);
+    return GetInstance<Heap>().Make<Symbol>(found);
+}
+
+Object* MapContains::DeepCopy() {
+    return GetInstance<Heap>().Make<MapContains>();
+}
+
+Object* MapCount::operator()(Object* root) {
+    ThrowScope();
+    auto args = GetArgs(root);
+    RequireArgsRE(args, 1, 1);
+    CheckExpectedType<PersistentMap>(args);
+    return GetInstance<Heap>().Make<Number>(As<PersistentMap>(args[0])->GetSize());
+}
+
+Object* MapCount::DeepCopy() {
+    return GetInstance<Heap>().Make<MapCount>();
+}
+
+Object* MapPredicate::operator()(Object* root) {
+    ThrowScope();
+    auto args = GetArgs(root);
+    RequireArgsRE(args, 1, 1);
+    return GetInstance<Heap>().Make<Symbol>(IsExpectedType<PersistentMap>(args));
+}
+
+Object* MapPredicate::DeepCopy() {
+    return GetInstance<Heap>().Make<MapPredicate>();
+}
+
+Object* MapToList::operator()(Object* root) {
+    ThrowScope();
+    auto args = GetArgs(root);
+    RequireArgsRE(args, 1, 1);
+    CheckExpectedType<PersistentMap>(args);
+    Object* ptr = nullptr;
+    for (const auto& entry : As<PersistentMap>(args[0])->GetEntries()) {
+        ptr = GetInstance<Heap>().Make<Cell>(GetInstance<Heap>().Make<Cell>(entry.key, entry.value),
+                                             ptr);
+    }
+    return ptr;
+}
+
+Object* MapToList::DeepCopy() {
+    return GetInstance<Heap>().Make<MapToList>();
+}
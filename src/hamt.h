@@ -0,0 +1,182 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "classes.h"
+#include "heap.h"
+#include "object.h"
+
+// Persistent hash array mapped trie. Nodes are never mutated after construction, so every
+// map-assoc/map-dissoc copies only the path from the root to the changed slot (at most
+// one 32-wide node per level) and shares everything else with the previous version.
+
+class HamtNode : public Object {
+public:
+    struct Entry {
+        Object* key;
+        Object* value;
+        HamtNode* child;
+    };
+
+    static constexpr size_t kBitsPerLevel = 5;
+    static constexpr uint64_t kLevelMask = (1u << kBitsPerLevel) - 1;
+    static constexpr size_t kMaxShift = 64;
+
+    static HamtNode* Assoc(HamtNode* node, size_t shift, uint64_t hash, Object* key,
+                           Object* value, bool* added);
+
+    static HamtNode* Dissoc(HamtNode* node, size_t shift, uint64_t hash, Object* key,
+                            bool* removed);
+
+    static Object* Find(HamtNode* node, uint64_t hash, Object* key, bool* found);
+
+    void ForEach(std::vector<Entry>* out) const;
+
+private:
+    // Bitmap-indexed node: bit i is set if slot i of this level is occupied, entries_ holds
+    // the occupied slots in order. Collision nodes (below the last level) keep a plain list.
+    uint32_t bitmap_;
+    bool is_collision_;
+    std::vector<Entry> entries_;
+
+    HamtNode(uint32_t bitmap, bool is_collision, std::vector<Entry> entries);
+
+    size_t Position(uint32_t bit) const;
+
+    static HamtNode* Make(uint32_t bitmap, bool is_collision, std::vector<Entry> entries);
+
+    static HamtNode* MergeLeaves(size_t shift, Entry first, uint64_t first_hash, Entry second,
+                                 uint64_t second_hash);
+
+    friend Heap;
+};
+
+class PersistentMap : public Object {
+public:
+    size_t GetSize() const;
+
+    Object* Get(Object* key, bool* found) const;
+
+    PersistentMap* Assoc(Object* key, Object* value);
+
+    PersistentMap* Dissoc(Object* key);
+
+    std::vector<HamtNode::Entry> GetEntries() const;
+
+    virtual std::string ToString() override;
+
+    virtual Object* DeepCopy() override;
+
+    virtual Object* Calculate() override;
+
+private:
+    HamtNode* root_;
+    size_t size_;
+
+    PersistentMap(HamtNode* root, size_t size);
+
+    friend Heap;
+};
+
+uint64_t HashKey(Object* key);
+
+bool IsSameKey(Object* lhs, Object* rhs);
+
+////////////////////////////////FUNCTIONS//////////////////////////////////////////////////
+
+class MakeMap : public Object {
+public:
+    virtual Object* operator()(Object* root) override;
+
+    virtual Object* DeepCopy() override;
+
+private:
+    friend Heap;
+
+    MakeMap() = default;
+};
+
+class MapAssoc : public Object {
+public:
+    virtual Object* operator()(Object* root) override;
+
+    virtual Object* DeepCopy() override;
+
+private:
+    friend Heap;
+
+    MapAssoc() = default;
+};
+
+class MapDissoc : public Object {
+public:
+    virtual Object* operator()(Object* root) override;
+
+    virtual Object* DeepCopy() override;
+
+private:
+    friend Heap;
+
+    MapDissoc() = default;
+};
+
+class MapGet : public Object {
+public:
+    virtual Object* operator()(Object* root) override;
+
+    virtual Object* DeepCopy() override;
+
+private:
+    friend Heap;
+
+    MapGet() = default;
+};
+
+class MapContains : public Object {
+public:
+    virtual Object* operator()(Object* root) override;
+
+    virtual Object* DeepCopy() override;
+
+private:
+    friend Heap;
+
+    MapContains() = default;
+};
+
+class MapCount : public Object {
+public:
+    virtual Object* operator()(Object* root) override;
+
+    virtual Object* DeepCopy() override;
+
+private:
+    friend Heap;
+
+    MapCount() = default;
+};
+
+class MapPredicate : public Object {
+public:
+    virtual Object* operator()(Object* root) override;
+
+    virtual Object* DeepCopy() override;
+
+private:
+    friend Heap;
+
+    MapPredicate() = default;
+};
+
+class MapToList : public Object {
+public:
+    virtual Object* operator()(Object* root) override;
+
+    virtual Object* DeepCopy() override;
+
+private:
+    friend Heap;
+
+    MapToList() = default;
+};
@@ -1,10 +1,86 @@
 #include "heap.h"
+#include <cxxabi.h>
+#include <algorithm>
 #include <cstddef>
+#include <cstdlib>
+#include <iomanip>
 #include <iostream>
+#include <mutex>
 #include <ostream>
 #include <type_traits>
+#include <typeindex>
+#include <unordered_map>
 #include <vector>
 #include "object.h"
+#include "printer.h"
+#include "tracer.h"
+
+namespace {
+
+constexpr size_t kTypesPrinted = 15;
+constexpr int kTypeWidth = 40;
+
+struct TypeInfo {
+    const std::type_info* type;
+    std::string name;
+    size_t size;
+};
+
+// Types are registered on their first allocation, possibly by reader threads.
+std::mutex types_mutex;
+std::vector<TypeInfo> types;
+
+#ifdef SCHEME_TRACK_ALLOC_SITES
+std::mutex sites_mutex;
+std::vector<std::string> sites = {"<none>"};
+std::unordered_map<std::string, uint32_t> site_ids;
+#endif
+
+struct TypeId {
+    size_t id;
+    size_t size;
+};
+
+// Ids and sizes of the registered types by their std::type_info, read under the lock once so
+// that walking the heap doesn't need it.
+std::unordered_map<std::type_index, TypeId> GetTypeIds() {
+    std::lock_guard lock(types_mutex);
+    std::unordered_map<std::type_index, TypeId> ids;
+    for (size_t id = 0; id < types.size(); ++id) {
+        ids.emplace(*types[id].type, TypeId{id, types[id].size});
+    }
+    return ids;
+}
+
+std::string Demangle(const char* name) {
+    int status;
+    std::unique_ptr<char, decltype(&std::free)> demangled(
+        abi::__cxa_demangle(name, nullptr, nullptr, &status), &std::free);
+    return status == 0 ? demangled.get() : name;
+}
+
+double Milliseconds(std::chrono::nanoseconds time) {
+    return std::chrono::duration<double, std::milli>(time).count();
+}
+
+}  // namespace
+
+size_t Heap::RegisterType(const std::type_info& type, size_t size) {
+    std::lock_guard lock(types_mutex);
+    types.push_back({&type, Demangle(type.name()), size});
+    return types.size() - 1;
+}
+
+#ifdef SCHEME_TRACK_ALLOC_SITES
+uint32_t Heap::InternSite(const std::string& text) {
+    std::lock_guard lock(sites_mutex);
+    auto [it, is_new] = site_ids.emplace(text, sites.size());
+    if (is_new) {
+        sites.push_back(text);
+    }
+    return it->second;
+}
+#endif
 
 void Heap::PopBack() {
     while (!memory_.empty() && !memory_.back()->is_achivable_) {
@@ -12,11 +88,44 @@ void Heap::PopBack() {
     }
 }
 
+void Heap::Reserve(size_t count) {
+    if (memory_.size() + count > memory_.capacity()) {
+        memory_.reserve(std::max(memory_.size() + count, 2 * memory_.capacity()));
+    }
+}
+
+void Heap::Splice(Heap* other) {
+    Reserve(other->memory_.size());
+    for (auto& obj : other->memory_) {
+        memory_.push_back(std::move(obj));
+    }
+    other->memory_.clear();
+    if (allocations_.size() < other->allocations_.size()) {
+        allocations_.resize(other->allocations_.size());
+    }
+    for (size_t type = 0; type < other->allocations_.size(); ++type) {
+        allocations_[type] += other->allocations_[type];
+    }
+    other->allocations_.clear();
+}
+
 void Heap::Check(Object* root) {
+    Check({root});
+}
+
+void Heap::Check(std::initializer_list<Object*> roots) {
+    TraceScope trace("gc", "heap");
+    if (check_listener_ != nullptr) {
+        check_listener_->OnCheckStart();
+    }
+    auto start = std::chrono::steady_clock::now();
+    auto size_before = memory_.size();
     for (auto& obj : memory_) {
         obj->is_achivable_ = false;
     }
-    root->Mark();
+    for (auto root : roots) {
+        root->Mark();
+    }
 
     std::vector<size_t> indexes;
     size_t size_to_del = 0;
@@ -41,4 +150,152 @@ void Heap::Check(Object* root) {
     }
 
     PopBack();
+
+    auto pause = std::chrono::steady_clock::now() - start;
+    ++collections_;
+    freed_ += size_before - memory_.size();
+    live_after_gc_ = memory_.size();
+    total_pause_ += pause;
+    max_pause_ = std::max<std::chrono::nanoseconds>(max_pause_, pause);
+    auto bucket = std::upper_bound(HeapStats::kPauseBuckets.begin(),
+                                   HeapStats::kPauseBuckets.end(), pause);
+    ++pause_histogram_[bucket - HeapStats::kPauseBuckets.begin()];
+    trace.SetArg("freed", size_before - memory_.size());
+    if (check_listener_ != nullptr) {
+        check_listener_->OnCheckEnd();
+    }
+}
+
+void Heap::SetCheckListener(HeapCheckListener* listener) {
+    check_listener_ = listener;
+}
+
+HeapStats Heap::GetStats() const {
+    HeapStats stats;
+    {
+        std::lock_guard lock(types_mutex);
+        for (size_t type = 0; type < allocations_.size(); ++type) {
+            if (allocations_[type] != 0) {
+                auto bytes = allocations_[type] * types[type].size;
+                stats.types.push_back({types[type].name, allocations_[type], bytes});
+                stats.allocations += allocations_[type];
+                stats.bytes += bytes;
+            }
+        }
+    }
+    std::sort(stats.types.begin(), stats.types.end(),
+              [](const auto& lhs, const auto& rhs) { return lhs.allocations > rhs.allocations; });
+    stats.collections = collections_;
+    stats.freed = freed_;
+    stats.live = memory_.size();
+    stats.live_after_gc = live_after_gc_;
+    stats.total_pause = total_pause_;
+    stats.max_pause = max_pause_;
+    stats.pause_histogram = pause_histogram_;
+#ifdef SCHEME_TRACK_ALLOC_SITES
+    auto type_ids = GetTypeIds();
+    std::unordered_map<uint32_t, HeapStats::SiteStats> live_sites;
+    for (const auto& obj : memory_) {
+        auto& site = live_sites[obj->alloc_site_];
+        ++site.objects;
+        site.bytes += type_ids.at(typeid(*obj)).size;
+    }
+    {
+        std::lock_guard lock(sites_mutex);
+        for (auto& [site, site_stats] : live_sites) {
+            site_stats.text = sites[site];
+            stats.live_sites.push_back(std::move(site_stats));
+        }
+    }
+    std::sort(stats.live_sites.begin(), stats.live_sites.end(),
+              [](const auto& lhs, const auto& rhs) { return lhs.bytes > rhs.bytes; });
+#endif
+    return stats;
+}
+
+void Heap::WriteSnapshot(Object* root, std::ostream* out) const {
+    auto type_ids = GetTypeIds();
+    std::vector<Object*> objects = {root};
+    std::vector<int64_t> retainers = {-1};
+    std::unordered_map<Object*, size_t> ids = {{root, 0}};
+    for (size_t i = 0; i < objects.size(); ++i) {
+        for (auto neighbour : objects[i]->neighbours_) {
+            if (neighbour != nullptr && ids.emplace(neighbour, objects.size()).second) {
+                objects.push_back(neighbour);
+                retainers.push_back(i);
+            }
+        }
+    }
+
+    *out << "{\"types\": [";
+    {
+        std::lock_guard lock(types_mutex);
+        for (size_t type = 0; type < types.size(); ++type) {
+            *out << (type != 0 ? ", " : "");
+            WriteJsonString(out, types[type].name);
+        }
+    }
+    *out << "],\n\"sites\": [";
+#ifdef SCHEME_TRACK_ALLOC_SITES
+    {
+        std::lock_guard lock(sites_mutex);
+        for (size_t site = 0; site < sites.size(); ++site) {
+            *out << (site != 0 ? ", " : "");
+            WriteJsonString(out, sites[site]);
+        }
+    }
+#else
+    WriteJsonString(out, "<untracked>");
+#endif
+    *out << "],\n\"objects\": [\n";
+    for (size_t i = 0; i < objects.size(); ++i) {
+        auto obj = objects[i];
+        auto type = type_ids.at(typeid(*obj));
+        uint32_t site = 0;
+#ifdef SCHEME_TRACK_ALLOC_SITES
+        site = obj->alloc_site_;
+#endif
+        *out << "{\"id\": " << i << ", \"type\": " << type.id << ", \"size\": " << type.size
+             << ", \"site\": " << site << ", \"retainer\": " << retainers[i] << ", \"edges\": [";
+        bool is_first = true;
+        for (auto neighbour : obj->neighbours_) {
+            if (neighbour != nullptr) {
+                *out << (is_first ? "" : ", ") << ids.at(neighbour);
+                is_first = false;
+            }
+        }
+        *out << "]}" << (i + 1 < objects.size() ? ",\n" : "\n");
+    }
+    *out << "]}\n";
+}
+
+void HeapStats::Print(std::ostream* out) const {
+    *out << "allocations     " << allocations << " (" << bytes << " bytes)\n"
+         << "collections     " << collections << ", " << freed << " objects freed\n"
+         << "live            " << live << ", " << live_after_gc << " after the last collection\n"
+         << std::fixed << std::setprecision(3) << "pauses          " << Milliseconds(total_pause)
+         << " ms total, " << Milliseconds(max_pause) << " ms max\n";
+    for (size_t i = 0; i < pause_histogram.size(); ++i) {
+        *out << (i < kPauseBuckets.size() ? "   < " : "  >= ") << std::setw(6)
+             << kPauseBuckets[std::min(i, kPauseBuckets.size() - 1)].count() << " us"
+             << std::setw(12) << pause_histogram[i] << '\n';
+    }
+    *out << std::left << std::setw(kTypeWidth) << "type" << std::right << std::setw(12)
+         << "objects" << std::setw(14) << "bytes" << '\n';
+    for (size_t i = 0; i < std::min(types.size(), kTypesPrinted); ++i) {
+        *out << std::left << std::setw(kTypeWidth) << types[i].name << std::right << std::setw(12)
+             << types[i].allocations << std::setw(14) << types[i].bytes << '\n';
+    }
+#ifdef SCHEME_TRACK_ALLOC_SITES
+    *out << std::left << std::setw(kTypeWidth) << "live objects by site" << std::right
+         << std::setw(12) << "objects" << std::setw(14) << "bytes" << '\n';
+    for (size_t i = 0; i < std::min(live_sites.size(), kTypesPrinted); ++i) {
+        auto text = live_sites[i].text;
+        if (text.size() > kTypeWidth - 2) {
+            text = text.substr(0, kTypeWidth - 5) + "...";
+        }
+        *out << std::left << std::setw(kTypeWidth) << text << std::right << std::setw(12)
+             << live_sites[i].objects << std::setw(14) << live_sites[i].bytes << '\n';
+    }
+#endif
 }
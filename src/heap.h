@@ -1,25 +1,170 @@
 #pragma once
 
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
 #include <iostream>
 #include <memory>
+#include <ostream>
+#include <string>
+#include <typeinfo>
 #include <utility>
 #include <vector>
 #include "classes.h"
 
+// Allocation and collection counters of a Heap, see Heap::GetStats.
+struct HeapStats {
+    // Upper bounds of the pause histogram buckets; one more bucket takes the longer pauses.
+    static constexpr std::array<std::chrono::microseconds, 5> kPauseBuckets = {
+        std::chrono::microseconds(10), std::chrono::microseconds(100),
+        std::chrono::microseconds(1000), std::chrono::microseconds(10000),
+        std::chrono::microseconds(100000)};
+
+    struct TypeStats {
+        std::string name;
+        uint64_t allocations = 0;
+        uint64_t bytes = 0;
+    };
+
+    uint64_t allocations = 0;
+    // Sizes of the objects themselves, without the memory they own (strings, vectors, ...).
+    uint64_t bytes = 0;
+    uint64_t collections = 0;
+    uint64_t freed = 0;
+    // Objects in the heap now, and right after the last collection.
+    uint64_t live = 0;
+    uint64_t live_after_gc = 0;
+    std::chrono::nanoseconds total_pause{0};
+    std::chrono::nanoseconds max_pause{0};
+    std::array<uint64_t, kPauseBuckets.size() + 1> pause_histogram{};
+    // Most allocated types first.
+    std::vector<TypeStats> types;
+#ifdef SCHEME_TRACK_ALLOC_SITES
+    struct SiteStats {
+        std::string text;
+        uint64_t objects = 0;
+        uint64_t bytes = 0;
+    };
+
+    // Objects in the heap by the site that made them, most bytes first.
+    std::vector<SiteStats> live_sites;
+#endif
+
+    void Print(std::ostream* out) const;
+};
+
+// Told about every Heap::Check, e.g. to read hardware counters over collections only.
+class HeapCheckListener {
+public:
+    virtual ~HeapCheckListener() = default;
+
+    virtual void OnCheckStart() = 0;
+
+    virtual void OnCheckEnd() = 0;
+};
+
 class Heap {
 public:
     template <class T, class... Args>
     requires(std::is_convertible_v<T, Object>) Object* Make(Args&&... args) {
-        memory_.emplace_back(new T(std::forward<Args>(args)...));
-        return memory_.back().get();
+        auto type = GetTypeId<T>();
+        if (type >= allocations_.size()) [[unlikely]] {
+            allocations_.resize(type + 1);
+        }
+        ++allocations_[type];
+        auto object = new T(std::forward<Args>(args)...);
+#ifdef SCHEME_TRACK_ALLOC_SITES
+        object->alloc_site_ = current_site_;
+#endif
+        memory_.emplace_back(object);
+        return object;
     }
 
     void Check(Object* root);
 
+    // Frees everything none of roots reaches.
+    void Check(std::initializer_list<Object*> roots);
+
+    // Makes room for count more objects at once, e.g. for all the cells of a parsed datum.
+    void Reserve(size_t count);
+
+    // Takes over every object of other, e.g. one filled by a reader thread.
+    void Splice(Heap* other);
+
+    HeapStats GetStats() const;
+
+    // The listener of the following collections, nullptr for none. Not owned.
+    void SetCheckListener(HeapCheckListener* listener);
+
+    // Every object reachable from root as one JSON document, for offline analysis:
+    //   {"types": [name...], "sites": [text...], "objects": [{"id", "type", "size", "site",
+    //    "retainer", "edges"}...]}
+    // Ids are positions in "objects", the root is 0. "retainer" is the object that reached this
+    // one first in a breadth-first walk from the root, so following retainers gives a shortest
+    // path from the root, and -1 for the root itself. Sites are only recorded in builds with
+    // SCHEME_TRACK_ALLOC_SITES; otherwise every object has site 0.
+    void WriteSnapshot(Object* root, std::ostream* out) const;
+
+#ifdef SCHEME_TRACK_ALLOC_SITES
+    // Id of the source text of an allocation site, the same for the same text. Site 0 stands
+    // for objects made outside of any call, e.g. by the reader.
+    static uint32_t InternSite(const std::string& text);
+#endif
+
 private:
     std::vector<std::unique_ptr<Object>> memory_;
+    // Allocations per type, indexed by the id RegisterType gave the type.
+    std::vector<uint64_t> allocations_;
+    uint64_t collections_ = 0;
+    uint64_t freed_ = 0;
+    uint64_t live_after_gc_ = 0;
+    std::chrono::nanoseconds total_pause_{0};
+    std::chrono::nanoseconds max_pause_{0};
+    std::array<uint64_t, HeapStats::kPauseBuckets.size() + 1> pause_histogram_{};
+    HeapCheckListener* check_listener_ = nullptr;
+#ifdef SCHEME_TRACK_ALLOC_SITES
+    // Site charged with the objects made now, see AllocationSite.
+    uint32_t current_site_ = 0;
+
+    friend class AllocationSite;
+#endif
 
     friend Object;
 
+    // Id of an object type, the same for every heap and thread.
+    template <class T>
+    static size_t GetTypeId() {
+        static const size_t id = RegisterType(typeid(T), sizeof(T));
+        return id;
+    }
+
+    static size_t RegisterType(const std::type_info& type, size_t size);
+
     void PopBack();
 };
+
+#ifdef SCHEME_TRACK_ALLOC_SITES
+// Charges the objects made during its lifetime to a site of the global heap, unless the site
+// is 0; the enclosing site is restored afterwards.
+class AllocationSite {
+public:
+    explicit AllocationSite(uint32_t site) : saved_(GetInstance<Heap>().current_site_) {
+        if (site != 0) {
+            GetInstance<Heap>().current_site_ = site;
+        }
+    }
+
+    AllocationSite(const AllocationSite& other) = delete;
+
+    AllocationSite& operator=(const AllocationSite& other) = delete;
+
+    ~AllocationSite() {
+        GetInstance<Heap>().current_site_ = saved_;
+    }
+
+private:
+    uint32_t saved_;
+};
+#endif
@@ -0,0 +1,453 @@
+#include "image.h"
+#include <cstring>
+#include <typeindex>
+#include <unordered_set>
+#include <vector>
+#include "bigint.h"
+#include "error.h"
+#include "feedback.h"
+#include "hamt.h"
+#include "heap.h"
+#include "profiler.h"
+
+namespace {
+
+constexpr std::string_view kMagic = "SCMIMAGE";
+
+enum class Tag : uint8_t {
+    NUMBER,
+    BIG_NUMBER,
+    FLOAT,
+    SYMBOL,
+    CELL,
+    QUOTED,
+    LAMBDA,
+    SCOPE,
+    MAP,
+    SITE,
+    BUILTIN,
+};
+
+// Record ids: 0 is the empty list and 1 the global scope, the records follow from 2 on.
+constexpr uint32_t kNull = 0;
+constexpr uint32_t kGlobalScope = 1;
+
+struct ImageBinding {
+    std::string name;
+    uint32_t value;
+};
+
+struct ImageScope {
+    uint32_t id;
+    std::vector<ImageBinding> bindings;
+};
+
+// A guard only stands for its original code, which is what gets saved.
+Object* Unwrap(Object* obj) {
+    while (auto guarded = As<Guarded>(obj)) {
+        obj = guarded->GetOriginal();
+    }
+    return obj;
+}
+
+class ImageWriter {
+public:
+    ImageWriter(Scope* global, const Builtins& builtins) {
+        ids_[global] = kGlobalScope;
+        for (const auto& [name, builtin] : builtins) {
+            builtin_types_.insert(typeid(*builtin));
+        }
+    }
+
+    // Id of obj, writing the records of it and of everything it refers to first. Scopes are
+    // written without their bindings, see GetScopes.
+    uint32_t Add(Object* obj) {
+        obj = Unwrap(obj);
+        if (obj == nullptr) {
+            return kNull;
+        }
+        if (auto it = ids_.find(obj); it != ids_.end()) {
+            return it->second;
+        }
+        struct Frame {
+            Object* obj;
+            std::vector<Object*> children;
+            size_t next = 0;
+        };
+        std::vector<Frame> stack;
+        std::unordered_set<Object*> on_stack = {obj};
+        stack.push_back({obj, GetChildren(obj)});
+        while (!stack.empty()) {
+            auto& frame = stack.back();
+            if (frame.next < frame.children.size()) {
+                auto child = frame.children[frame.next++];
+                if (child == nullptr || ids_.contains(child)) {
+                    continue;
+                }
+                if (!on_stack.insert(child).second) {
+                    throw RuntimeError("Can't save circular data in an image");
+                }
+                stack.push_back({child, GetChildren(child)});
+                continue;
+            }
+            WriteRecord(frame.obj);
+            on_stack.erase(frame.obj);
+            stack.pop_back();
+        }
+        return ids_.at(obj);
+    }
+
+    // Local scopes written so far; adding their bindings may write more of them.
+    std::vector<Scope*>& GetScopes() {
+        return scopes_;
+    }
+
+    uint32_t GetId(Object* obj) const {
+        return ids_.at(obj);
+    }
+
+    void Write(const std::vector<ImageScope>& scopes, std::ostream* out) const {
+        std::string header(kMagic);
+        Put(&header, kImageVersion);
+        Put(&header, static_cast<uint32_t>(ids_.size() - 1));
+        out->write(header.data(), header.size());
+        out->write(records_.data(), records_.size());
+
+        std::string bindings;
+        Put(&bindings, static_cast<uint32_t>(scopes.size()));
+        for (const auto& scope : scopes) {
+            Put(&bindings, scope.id);
+            Put(&bindings, static_cast<uint32_t>(scope.bindings.size()));
+            for (const auto& [name, value] : scope.bindings) {
+                PutString(&bindings, name);
+                Put(&bindings, value);
+            }
+        }
+        out->write(bindings.data(), bindings.size());
+    }
+
+private:
+    std::unordered_set<std::type_index> builtin_types_;
+    std::unordered_map<Object*, uint32_t> ids_;
+    std::vector<Scope*> scopes_;
+    std::string records_;
+
+    template <class T>
+    static void Put(std::string* out, T value) {
+        out->append(reinterpret_cast<const char*>(&value), sizeof(value));
+    }
+
+    static void PutString(std::string* out, std::string_view str) {
+        Put(out, static_cast<uint32_t>(str.size()));
+        out->append(str);
+    }
+
+    void PutTag(Tag tag) {
+        Put(&records_, tag);
+    }
+
+    void PutRef(Object* obj) {
+        obj = Unwrap(obj);
+        Put(&records_, obj != nullptr ? ids_.at(obj) : kNull);
+    }
+
+    bool IsBuiltin(Object* obj) const {
+        return builtin_types_.contains(typeid(*obj));
+    }
+
+    std::vector<Object*> GetChildren(Object* obj) const {
+        std::vector<Object*> children;
+        if (auto cell = As<Cell>(obj)) {
+            children = {cell->GetFirst(), cell->GetSecond()};
+        } else if (auto quoted = As<Quoted>(obj)) {
+            children = {quoted->GetValue()};
+        } else if (auto lambda = As<Lambda>(obj)) {
+            children = lambda->GetParams();
+            children.push_back(lambda->GetBody());
+            children.push_back(lambda->GetScope());
+        } else if (auto scope = As<Scope>(obj)) {
+            children = {scope->GetParent()};
+        } else if (auto map = As<PersistentMap>(obj)) {
+            for (const auto& entry : map->GetEntries()) {
+                children.push_back(entry.key);
+                children.push_back(entry.value);
+            }
+        } else if (auto site = As<ArithmeticSite>(obj)) {
+            children = {site->GetCall()};
+        }
+        for (auto& child : children) {
+            child = Unwrap(child);
+        }
+        return children;
+    }
+
+    void WriteRecord(Object* obj) {
+        if (auto number = As<Number>(obj)) {
+            PutTag(Tag::NUMBER);
+            Put(&records_, number->GetValue());
+        } else if (auto big_number = As<BigNumber>(obj)) {
+            PutTag(Tag::BIG_NUMBER);
+            PutString(&records_, big_number->GetValue().ToString());
+        } else if (auto real = As<Float>(obj)) {
+            PutTag(Tag::FLOAT);
+            Put(&records_, real->GetValue());
+        } else if (auto symbol = As<Symbol>(obj)) {
+            PutTag(Tag::SYMBOL);
+            PutString(&records_, symbol->GetName());
+        } else if (auto cell = As<Cell>(obj)) {
+            PutTag(Tag::CELL);
+            PutRef(cell->GetFirst());
+            PutRef(cell->GetSecond());
+        } else if (auto quoted = As<Quoted>(obj)) {
+            PutTag(Tag::QUOTED);
+            PutRef(quoted->GetValue());
+        } else if (auto lambda = As<Lambda>(obj)) {
+            PutTag(Tag::LAMBDA);
+            PutRef(lambda->GetScope());
+            PutRef(lambda->GetBody());
+            Put(&records_, static_cast<uint8_t>(lambda->MayCaptureFrame()));
+            PutString(&records_, lambda->GetName() != Lambda::kAnonymous
+                                     ? GetInstance<Profiler>().GetText(lambda->GetName())
+                                     : std::string());
+            Put(&records_, static_cast<uint32_t>(lambda->GetParams().size()));
+            for (auto param : lambda->GetParams()) {
+                PutRef(param);
+            }
+        } else if (auto scope = As<Scope>(obj)) {
+            PutTag(Tag::SCOPE);
+            PutRef(scope->GetParent());
+            scopes_.push_back(scope);
+        } else if (auto map = As<PersistentMap>(obj)) {
+            PutTag(Tag::MAP);
+            auto entries = map->GetEntries();
+            Put(&records_, static_cast<uint32_t>(entries.size()));
+            for (const auto& entry : entries) {
+                PutRef(entry.key);
+                PutRef(entry.value);
+            }
+        } else if (auto site = As<ArithmeticSite>(obj)) {
+            PutTag(Tag::SITE);
+            PutRef(site->GetCall());
+            PutString(&records_, site->GetBuiltinType().name());
+        } else if (IsBuiltin(obj)) {
+            PutTag(Tag::BUILTIN);
+            PutString(&records_, typeid(*obj).name());
+        } else {
+            throw RuntimeError(std::string("Can't save ") + typeid(*obj).name() + " in an image");
+        }
+        auto id = static_cast<uint32_t>(ids_.size() + 1);
+        ids_[obj] = id;
+    }
+};
+
+// Reads the records of an image, checking every read against the end of the data and every
+// reference against the records read so far.
+class ImageReader {
+public:
+    ImageReader(std::string_view data, Scope* global, const Builtins& builtins)
+        : data_(data), objects_({nullptr, global}) {
+        for (const auto& [name, builtin] : builtins) {
+            builtins_[typeid(*builtin).name()] = builtin;
+        }
+    }
+
+    void Read() {
+        if (data_.substr(0, kMagic.size()) != kMagic) {
+            throw RuntimeError("Not a heap image");
+        }
+        pos_ = kMagic.size();
+        if (Get<uint32_t>() != kImageVersion) {
+            throw RuntimeError("Heap image of another interpreter version");
+        }
+        // Every record takes at least its tag.
+        auto records = GetCount(sizeof(Tag));
+        objects_.reserve(records + 2);
+        for (uint32_t i = 0; i < records; ++i) {
+            objects_.push_back(ReadRecord());
+        }
+
+        auto scopes = GetCount(2 * sizeof(uint32_t));
+        for (uint32_t i = 0; i < scopes; ++i) {
+            auto scope = As<Scope>(GetRef());
+            if (scope == nullptr) {
+                Corrupt();
+            }
+            auto bindings = GetCount(2 * sizeof(uint32_t));
+            for (uint32_t j = 0; j < bindings; ++j) {
+                auto name = GetString();
+                scope->Add(std::string(name), GetRef());
+            }
+        }
+        if (pos_ != data_.size()) {
+            Corrupt();
+        }
+    }
+
+private:
+    std::string_view data_;
+    size_t pos_ = 0;
+    std::vector<Object*> objects_;
+    std::unordered_map<std::string_view, Object*> builtins_;
+
+    [[noreturn]] static void Corrupt() {
+        throw RuntimeError("Damaged heap image");
+    }
+
+    template <class T>
+    T Get() {
+        if (data_.size() - pos_ < sizeof(T)) {
+            Corrupt();
+        }
+        T value;
+        std::memcpy(&value, data_.data() + pos_, sizeof(T));
+        pos_ += sizeof(T);
+        return value;
+    }
+
+    std::string_view GetString() {
+        auto size = Get<uint32_t>();
+        if (data_.size() - pos_ < size) {
+            Corrupt();
+        }
+        auto str = data_.substr(pos_, size);
+        pos_ += size;
+        return str;
+    }
+
+    // A count of items that take at least item_size bytes each, checked against the rest of
+    // the data before anything is allocated for them.
+    uint32_t GetCount(size_t item_size) {
+        auto count = Get<uint32_t>();
+        if ((data_.size() - pos_) / item_size < count) {
+            Corrupt();
+        }
+        return count;
+    }
+
+    Object* GetRef() {
+        auto id = Get<uint32_t>();
+        if (id >= objects_.size()) {
+            Corrupt();
+        }
+        return objects_[id];
+    }
+
+    // A reference to a scope, or null.
+    Object* GetScopeRef() {
+        auto scope = GetRef();
+        if (scope != nullptr && !Is<Scope>(scope)) {
+            Corrupt();
+        }
+        return scope;
+    }
+
+    // Whether call is a proper list of an operator and 2 to ArithmeticSite::kMaxArgs
+    // arguments, the only calls the optimizer makes sites of.
+    static bool IsSiteCall(Object* call) {
+        size_t args = 0;
+        auto cell = As<Cell>(call);
+        if (cell == nullptr || cell->GetFirst() == nullptr) {
+            return false;
+        }
+        for (auto node = cell->GetSecond(); node != nullptr; node = cell->GetSecond()) {
+            cell = As<Cell>(node);
+            if (cell == nullptr || ++args > ArithmeticSite::kMaxArgs) {
+                return false;
+            }
+        }
+        return args >= 2;
+    }
+
+    Object* GetBuiltin() {
+        auto it = builtins_.find(GetString());
+        if (it == builtins_.end()) {
+            Corrupt();
+        }
+        return it->second;
+    }
+
+    Object* ReadRecord() {
+        auto& heap = GetInstance<Heap>();
+        switch (Get<Tag>()) {
+            case Tag::NUMBER:
+                return heap.Make<Number>(Get<int64_t>());
+            case Tag::BIG_NUMBER:
+                return heap.Make<BigNumber>(BigInt::FromString(GetString()));
+            case Tag::FLOAT:
+                return heap.Make<Float>(Get<double>());
+            case Tag::SYMBOL:
+                return heap.Make<Symbol>(std::string(GetString()));
+            case Tag::CELL: {
+                auto first = GetRef();
+                return heap.Make<Cell>(first, GetRef());
+            }
+            case Tag::QUOTED:
+                return heap.Make<Quoted>(GetRef());
+            case Tag::LAMBDA: {
+                auto scope = GetScopeRef();
+                auto body = GetRef();
+                bool may_capture = Get<uint8_t>() != 0;
+                auto name = GetString();
+                std::vector<Object*> params(GetCount(sizeof(uint32_t)));
+                for (auto& param : params) {
+                    param = GetRef();
+                }
+                auto lambda = As<Lambda>(
+                    heap.Make<Lambda>(std::move(params), body, scope, may_capture));
+                if (!name.empty()) {
+                    lambda->SetName(GetInstance<Profiler>().Intern(std::string(name)));
+                }
+                return lambda;
+            }
+            case Tag::SCOPE:
+                return heap.Make<Scope>(GetScopeRef());
+            case Tag::MAP: {
+                auto map = As<PersistentMap>(heap.Make<PersistentMap>(nullptr, 0));
+                auto entries = GetCount(2 * sizeof(uint32_t));
+                for (uint32_t i = 0; i < entries; ++i) {
+                    auto key = GetRef();
+                    map = map->Assoc(key, GetRef());
+                }
+                return map;
+            }
+            case Tag::SITE: {
+                auto call = GetRef();
+                auto builtin = GetBuiltin();
+                if (!IsSiteCall(call) || !ArithmeticSite::GetOperation(builtin)) {
+                    Corrupt();
+                }
+                return heap.Make<ArithmeticSite>(call, builtin);
+            }
+            case Tag::BUILTIN:
+                return GetBuiltin()->DeepCopy();
+        }
+        Corrupt();
+    }
+};
+
+}  // namespace
+
+void WriteImage(Scope* scope, const Builtins& builtins, std::ostream* out) {
+    ImageWriter writer(scope, builtins);
+    std::vector<ImageScope> scopes(1, {kGlobalScope, {}});
+    for (const auto& [name, binding] : scope->GetBindings()) {
+        auto it = builtins.find(name);
+        if (it == builtins.end() || it->second != binding.value) {
+            scopes[0].bindings.push_back({name, writer.Add(binding.value)});
+        }
+    }
+    auto& locals = writer.GetScopes();
+    for (size_t i = 0; i < locals.size(); ++i) {
+        auto local = locals[i];
+        ImageScope saved = {writer.GetId(local), {}};
+        for (const auto& [name, binding] : local->GetBindings()) {
+            saved.bindings.push_back({name, writer.Add(binding.value)});
+        }
+        scopes.push_back(std::move(saved));
+    }
+    writer.Write(scopes, out);
+}
+
+void ReadImage(std::string_view image, Scope* scope, const Builtins& builtins) {
+    ImageReader(image, scope, builtins).Read();
+}
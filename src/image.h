@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include "object.h"
+
+// Heap images: the global bindings of an interpreter together with everything they reach
+// (lambdas with their closure scopes, quoted data, maps), so a prelude can be evaluated once
+// and later interpreters start from its result instead of reading and evaluating it again.
+//
+// Objects can't be mapped back as they are: they have vtables, std containers and pointers
+// into the heap they came from. An image is a flat stream of records instead, one per object,
+// each referring to earlier records by index; reading it maps the file and rebuilds the
+// objects in a single pass, relocating every reference through the index table. Optimizer
+// nodes are saved as the code they were made from, so feedback and guards start afresh.
+//
+// Layout, in host byte order: the magic "SCMIMAGE", kImageVersion, the number of records, the
+// records, then the bindings of every saved scope.
+
+constexpr uint32_t kImageVersion = 1;
+
+// Builtins of a fresh interpreter by name. Bindings to these very objects are left out of an
+// image, and saved copies of builtins are restored by type from them.
+using Builtins = std::unordered_map<std::string, Object*>;
+
+// Writes the bindings of the global scope scope that builtins doesn't already have. Throws
+// RuntimeError on circular lists and on values an image can't hold.
+void WriteImage(Scope* scope, const Builtins& builtins, std::ostream* out);
+
+// Binds the names saved in image in the global scope scope. Throws RuntimeError if image was
+// written by another version of the interpreter or is damaged.
+void ReadImage(std::string_view image, Scope* scope, const Builtins& builtins);
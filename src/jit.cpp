@@ -0,0 +1,639 @@
+#include "jit.h"
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
+#include <memory>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+#include "classes.h"
+#include "feedback.h"
+#include "heap.h"
+#include "let.h"
+#include "object.h"
+
+#if defined(SCHEME_JIT) && defined(__x86_64__) && defined(__linux__)
+#define SCHEME_JIT_X86_64
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+bool jit_enabled = false;
+
+}  // namespace
+
+void SetJitEnabled(bool enabled) {
+    jit_enabled = enabled;
+}
+
+bool IsJitEnabled() {
+    return jit_enabled;
+}
+
+// Shared by the entry trampoline and the body through r12.
+struct JitCode::Context {
+    // Stack pointer of the trampoline, restored when the code gives up.
+    uint64_t saved_rsp;
+    int64_t depth_left;
+};
+
+#ifdef SCHEME_JIT_X86_64
+
+namespace {
+
+constexpr uint8_t kDepthOffset = offsetof(JitCode::Context, depth_left);
+
+enum class Type { INT, BOOL };
+
+// Thrown as soon as the body leaves the supported subset.
+struct Unsupported {};
+
+// Low nibble of the jcc, setcc and cmovcc opcodes.
+enum Condition : uint8_t {
+    kOverflow = 0x0,
+    kEqual = 0x4,
+    kNotEqual = 0x5,
+    kSign = 0x8,
+    kLess = 0xC,
+    kGreaterOrEqual = 0xD,
+    kLessOrEqual = 0xE,
+    kGreater = 0xF,
+};
+
+class Assembler {
+public:
+    using Label = size_t;
+
+    void Emit(std::initializer_list<uint8_t> bytes) {
+        code_.insert(code_.end(), bytes);
+    }
+
+    void Emit32(int32_t value) {
+        for (int i = 0; i < 4; ++i) {
+            code_.push_back(static_cast<uint8_t>(static_cast<uint32_t>(value) >> (8 * i)));
+        }
+    }
+
+    void Emit64(int64_t value) {
+        for (int i = 0; i < 8; ++i) {
+            code_.push_back(static_cast<uint8_t>(static_cast<uint64_t>(value) >> (8 * i)));
+        }
+    }
+
+    void Patch32(size_t at, int32_t value) {
+        for (int i = 0; i < 4; ++i) {
+            code_[at + i] = static_cast<uint8_t>(static_cast<uint32_t>(value) >> (8 * i));
+        }
+    }
+
+    size_t Size() const {
+        return code_.size();
+    }
+
+    Label NewLabel() {
+        labels_.push_back(kUnbound);
+        return labels_.size() - 1;
+    }
+
+    void Bind(Label label) {
+        labels_[label] = code_.size();
+    }
+
+    void Jump(Label label) {
+        Emit({0xE9});
+        Fixup(label);
+    }
+
+    void JumpIf(Condition condition, Label label) {
+        Emit({0x0F, static_cast<uint8_t>(0x80 | condition)});
+        Fixup(label);
+    }
+
+    void Call(Label label) {
+        Emit({0xE8});
+        Fixup(label);
+    }
+
+    // The code with every rel32 resolved.
+    std::vector<uint8_t> Finish() {
+        for (auto [at, label] : fixups_) {
+            Patch32(at, static_cast<int32_t>(labels_[label] - (at + 4)));
+        }
+        return std::move(code_);
+    }
+
+private:
+    static constexpr size_t kUnbound = -1;
+
+    std::vector<uint8_t> code_;
+    std::vector<size_t> labels_;
+    std::vector<std::pair<size_t, Label>> fixups_;
+
+    void Fixup(Label label) {
+        fixups_.push_back({code_.size(), label});
+        Emit32(0);
+    }
+};
+
+bool ToVector(Object* list, std::vector<Object*>* items) {
+    items->clear();
+    for (; Is<Cell>(list); list = As<Cell>(list)->GetSecond()) {
+        items->push_back(As<Cell>(list)->GetFirst());
+    }
+    return list == nullptr;
+}
+
+// Template translation: every node leaves its value in rax, with rcx as the second operand of
+// binary operations. Parameters live above the frame of the body, let bindings in slots below
+// it, and r12 points to the JitCode::Context of the call.
+class Compiler {
+public:
+    Compiler(Lambda* lambda, Type result)
+        : lambda_(lambda), global_(As<Scope>(lambda->GetScope())), result_(result) {
+    }
+
+    // Entry trampoline followed by the body; throws Unsupported.
+    std::vector<uint8_t> Compile() {
+        std::vector<Object*> body;
+        if (!ToVector(lambda_->GetBody(), &body) || body.size() != 1) {
+            throw Unsupported{};
+        }
+        const auto& params = lambda_->GetParams();
+        for (size_t i = 0; i < params.size(); ++i) {
+            auto offset = static_cast<int32_t>(16 + 8 * (params.size() - 1 - i));
+            locals_.push_back({params[i]->ToString(), offset, Type::INT});
+        }
+        bail_ = asm_.NewLabel();
+        body_ = asm_.NewLabel();
+        loop_ = asm_.NewLabel();
+
+        // int entry(const int64_t* args, Context* context, int64_t* result)
+        asm_.Emit({0x55, 0x41, 0x54, 0x53});  // push rbp; push r12; push rbx
+        asm_.Emit({0x49, 0x89, 0xF4});        // mov r12, rsi
+        asm_.Emit({0x48, 0x89, 0xD3});        // mov rbx, rdx
+        asm_.Emit({0x49, 0x89, 0x24, 0x24});  // mov [r12 + saved_rsp], rsp
+        for (size_t i = 0; i < params.size(); ++i) {
+            asm_.Emit({0xFF, 0xB7});  // push qword [rdi + 8 * i]
+            asm_.Emit32(static_cast<int32_t>(8 * i));
+        }
+        asm_.Call(body_);
+        asm_.Emit({0x48, 0x89, 0x03});  // mov [rbx], rax
+        asm_.Emit({0x31, 0xC0});        // xor eax, eax
+        auto exit = asm_.NewLabel();
+        asm_.Bind(exit);
+        asm_.Emit({0x49, 0x8B, 0x24, 0x24});        // mov rsp, [r12 + saved_rsp]
+        asm_.Emit({0x5B, 0x41, 0x5C, 0x5D, 0xC3});  // pop rbx; pop r12; pop rbp; ret
+        asm_.Bind(bail_);
+        asm_.Emit({0xB8});  // mov eax, 1
+        asm_.Emit32(1);
+        asm_.Jump(exit);
+
+        asm_.Bind(body_);
+        asm_.Emit({0x55, 0x48, 0x89, 0xE5});  // push rbp; mov rbp, rsp
+        asm_.Emit({0x48, 0x81, 0xEC});        // sub rsp, frame size
+        auto frame_size = asm_.Size();
+        asm_.Emit32(0);
+        asm_.Emit({0x49, 0xFF, 0x4C, 0x24, kDepthOffset});  // dec qword [r12 + depth]
+        asm_.JumpIf(kEqual, bail_);
+        asm_.Bind(loop_);
+        if (Expr(body[0], true) != result_) {
+            throw Unsupported{};
+        }
+        asm_.Emit({0x49, 0xFF, 0x44, 0x24, kDepthOffset});  // inc qword [r12 + depth]
+        asm_.Emit({0x48, 0x89, 0xEC, 0x5D, 0xC3});          // mov rsp, rbp; pop rbp; ret
+        asm_.Patch32(frame_size, static_cast<int32_t>(8 * max_slots_));
+        return asm_.Finish();
+    }
+
+    std::vector<Guarded::Guard> TakeGuards() {
+        return std::move(guards_);
+    }
+
+private:
+    struct Local {
+        std::string name;
+        int32_t offset;
+        Type type;
+    };
+
+    Assembler asm_;
+    Lambda* lambda_;
+    Scope* global_;
+    Type result_;
+    std::vector<Local> locals_;
+    size_t slots_ = 0;
+    size_t max_slots_ = 0;
+    std::vector<Guarded::Guard> guards_;
+    Assembler::Label bail_;
+    Assembler::Label body_;
+    Assembler::Label loop_;
+
+    const Local* FindLocal(const std::string& name) const {
+        for (auto it = locals_.rbegin(); it != locals_.rend(); ++it) {
+            if (it->name == name) {
+                return &*it;
+            }
+        }
+        return nullptr;
+    }
+
+    // Global value of a name no local shadows, guarded on its binding.
+    Object* Resolve(Object* head) {
+        if (auto quoted = As<Quoted>(head)) {
+            return quoted->GetValue();
+        }
+        auto symbol = As<Symbol>(head);
+        if (symbol == nullptr || FindLocal(symbol->GetName()) != nullptr) {
+            throw Unsupported{};
+        }
+        auto binding = global_->Find(symbol->GetName());
+        if (binding == nullptr) {
+            throw Unsupported{};
+        }
+        guards_.push_back({binding, binding->version});
+        return binding->value;
+    }
+
+    void LoadConstant(int64_t value) {
+        asm_.Emit({0x48, 0xB8});  // mov rax, imm64
+        asm_.Emit64(value);
+    }
+
+    Type Constant(Object* value) {
+        if (auto number = As<Number>(value)) {
+            LoadConstant(number->GetValue());
+            return Type::INT;
+        }
+        if (Is<Symbol>(value) && (As<Symbol>(value)->GetName() == "#t" ||
+                                  As<Symbol>(value)->GetName() == "#f")) {
+            LoadConstant(As<Symbol>(value)->GetName() == "#t");
+            return Type::BOOL;
+        }
+        throw Unsupported{};
+    }
+
+    Type Expr(Object* expr, bool tail) {
+        if (auto guarded = As<Guarded>(expr)) {
+            const auto& guards = guarded->GetGuards();
+            for (const auto& guard : guards) {
+                if (guard.binding->version != guard.version) {
+                    return Expr(guarded->GetOriginal(), tail);
+                }
+            }
+            guards_.insert(guards_.end(), guards.begin(), guards.end());
+            return Expr(guarded->GetFast(), tail);
+        }
+        if (auto site = As<ArithmeticSite>(expr)) {
+            return Expr(site->GetCall(), tail);
+        }
+        if (auto quoted = As<Quoted>(expr)) {
+            return Constant(quoted->GetValue());
+        }
+        if (Is<Number>(expr)) {
+            return Constant(expr);
+        }
+        if (auto symbol = As<Symbol>(expr)) {
+            if (auto local = FindLocal(symbol->GetName())) {
+                asm_.Emit({0x48, 0x8B, 0x85});  // mov rax, [rbp + offset]
+                asm_.Emit32(local->offset);
+                return local->type;
+            }
+            return Constant(Resolve(symbol));
+        }
+        std::vector<Object*> items;
+        if (!Is<Cell>(expr) || !ToVector(expr, &items)) {
+            throw Unsupported{};
+        }
+        return Call(items, tail);
+    }
+
+    void Expect(Object* expr, Type type) {
+        if (Expr(expr, false) != type) {
+            throw Unsupported{};
+        }
+    }
+
+    // Evaluates expr into rcx, keeping rax.
+    void Operand(Object* expr) {
+        asm_.Emit({0x50});  // push rax
+        Expect(expr, Type::INT);
+        asm_.Emit({0x48, 0x89, 0xC1, 0x58});  // mov rcx, rax; pop rax
+    }
+
+    Type Call(const std::vector<Object*>& items, bool tail) {
+        auto function = Resolve(items[0]);
+        auto argc = items.size() - 1;
+        if (function == lambda_) {
+            return SelfCall(items, tail);
+        }
+        if (Is<Plus>(function) || Is<Mul>(function)) {
+            if (argc == 0) {
+                LoadConstant(Is<Plus>(function) ? 0 : 1);
+                return Type::INT;
+            }
+            return Chain(items, [&] {
+                if (Is<Plus>(function)) {
+                    asm_.Emit({0x48, 0x01, 0xC8});  // add rax, rcx
+                } else {
+                    asm_.Emit({0x48, 0x0F, 0xAF, 0xC1});  // imul rax, rcx
+                }
+                asm_.JumpIf(kOverflow, bail_);
+            });
+        }
+        if (Is<Minus>(function) && argc >= 2) {
+            return Chain(items, [&] {
+                asm_.Emit({0x48, 0x29, 0xC8});  // sub rax, rcx
+                asm_.JumpIf(kOverflow, bail_);
+            });
+        }
+        if (Is<Div>(function) && argc >= 2) {
+            return Chain(items, [&] { Divide(); });
+        }
+        if ((Is<Min>(function) || Is<Max>(function)) && argc >= 1) {
+            auto condition = Is<Min>(function) ? kGreater : kLess;
+            return Chain(items, [&] {
+                asm_.Emit({0x48, 0x39, 0xC8});  // cmp rax, rcx
+                asm_.Emit({0x48, 0x0F, static_cast<uint8_t>(0x40 | condition), 0xC1});  // cmov
+            });
+        }
+        if (Is<Abs>(function) && argc == 1) {
+            Expect(items[1], Type::INT);
+            asm_.Emit({0x48, 0x89, 0xC1, 0x48, 0xF7, 0xD8});  // mov rcx, rax; neg rax
+            asm_.JumpIf(kOverflow, bail_);
+            asm_.Emit({0x48, 0x0F, 0x40 | kSign, 0xC1});  // cmovs rax, rcx
+            return Type::INT;
+        }
+        if (argc == 2) {
+            if (auto condition = Comparison(function)) {
+                Expect(items[1], Type::INT);
+                Operand(items[2]);
+                asm_.Emit({0x48, 0x39, 0xC8});  // cmp rax, rcx
+                asm_.Emit({0x0F, static_cast<uint8_t>(0x90 | *condition), 0xC0});  // setcc al
+                asm_.Emit({0x0F, 0xB6, 0xC0});  // movzx eax, al
+                return Type::BOOL;
+            }
+        }
+        if (Is<IfFunc>(function) && argc == 3) {
+            return If(items, tail);
+        }
+        if (Is<NotFunction>(function) && argc == 1) {
+            Expect(items[1], Type::BOOL);
+            asm_.Emit({0x48, 0x83, 0xF0, 0x01});  // xor rax, 1
+            return Type::BOOL;
+        }
+        if (Is<AndFunction>(function) || Is<OrFunction>(function)) {
+            return AndOr(items, Is<AndFunction>(function));
+        }
+        if ((Is<Let>(function) || Is<LetStar>(function)) && argc == 2) {
+            return LetForm(items, Is<LetStar>(function), tail);
+        }
+        throw Unsupported{};
+    }
+
+    std::optional<Condition> Comparison(Object* function) {
+        if (Is<Less>(function)) {
+            return kLess;
+        }
+        if (Is<Greate>(function)) {
+            return kGreater;
+        }
+        if (Is<Equal>(function)) {
+            return kEqual;
+        }
+        if (Is<LessOrEqual>(function)) {
+            return kLessOrEqual;
+        }
+        if (Is<GreateOrEqual>(function)) {
+            return kGreaterOrEqual;
+        }
+        return std::nullopt;
+    }
+
+    // Left fold of the arguments with the given operation on rax and rcx.
+    template <class Operation>
+    Type Chain(const std::vector<Object*>& items, Operation operation) {
+        Expect(items[1], Type::INT);
+        for (size_t i = 2; i < items.size(); ++i) {
+            Operand(items[i]);
+            operation();
+        }
+        return Type::INT;
+    }
+
+    // rax / rcx truncated, giving up where DivOperation throws or overflows.
+    void Divide() {
+        auto general = asm_.NewLabel();
+        auto done = asm_.NewLabel();
+        asm_.Emit({0x48, 0x85, 0xC9});  // test rcx, rcx
+        asm_.JumpIf(kEqual, bail_);
+        asm_.Emit({0x48, 0x83, 0xF9, 0xFF});  // cmp rcx, -1
+        asm_.JumpIf(kNotEqual, general);
+        asm_.Emit({0x48, 0xF7, 0xD8});  // neg rax
+        asm_.JumpIf(kOverflow, bail_);
+        asm_.Jump(done);
+        asm_.Bind(general);
+        asm_.Emit({0x48, 0x99, 0x48, 0xF7, 0xF9});  // cqo; idiv rcx
+        asm_.Bind(done);
+    }
+
+    Type If(const std::vector<Object*>& items, bool tail) {
+        auto otherwise = asm_.NewLabel();
+        auto done = asm_.NewLabel();
+        Expect(items[1], Type::BOOL);
+        asm_.Emit({0x48, 0x85, 0xC0});  // test rax, rax
+        asm_.JumpIf(kEqual, otherwise);
+        auto type = Expr(items[2], tail);
+        asm_.Jump(done);
+        asm_.Bind(otherwise);
+        if (Expr(items[3], tail) != type) {
+            throw Unsupported{};
+        }
+        asm_.Bind(done);
+        return type;
+    }
+
+    Type AndOr(const std::vector<Object*>& items, bool is_and) {
+        if (items.size() == 1) {
+            LoadConstant(is_and);
+            return Type::BOOL;
+        }
+        auto done = asm_.NewLabel();
+        for (size_t i = 1; i < items.size(); ++i) {
+            Expect(items[i], Type::BOOL);
+            if (i + 1 < items.size()) {
+                asm_.Emit({0x48, 0x85, 0xC0});  // test rax, rax
+                asm_.JumpIf(is_and ? kEqual : kNotEqual, done);
+            }
+        }
+        asm_.Bind(done);
+        return Type::BOOL;
+    }
+
+    Type LetForm(const std::vector<Object*>& items, bool is_sequential, bool tail) {
+        std::vector<Object*> bindings;
+        if (!ToVector(items[1], &bindings)) {
+            throw Unsupported{};  // named let
+        }
+        auto mark = locals_.size();
+        auto first_slot = slots_;
+        slots_ += bindings.size();
+        max_slots_ = std::max(max_slots_, slots_);
+
+        std::vector<Local> added;
+        std::vector<Object*> parts;
+        for (size_t i = 0; i < bindings.size(); ++i) {
+            if (!ToVector(bindings[i], &parts) || parts.size() != 2 || !Is<Symbol>(parts[0])) {
+                throw Unsupported{};
+            }
+            auto offset = -static_cast<int32_t>(8 * (first_slot + i + 1));
+            auto type = Expr(parts[1], false);
+            asm_.Emit({0x48, 0x89, 0x85});  // mov [rbp + offset], rax
+            asm_.Emit32(offset);
+            Local local{As<Symbol>(parts[0])->GetName(), offset, type};
+            if (is_sequential) {
+                locals_.push_back(std::move(local));
+            } else {
+                added.push_back(std::move(local));
+            }
+        }
+        locals_.insert(locals_.end(), added.begin(), added.end());
+
+        auto type = Expr(items[2], tail);
+        locals_.resize(mark);
+        slots_ = first_slot;
+        return type;
+    }
+
+    Type SelfCall(const std::vector<Object*>& items, bool tail) {
+        auto argc = items.size() - 1;
+        if (argc != lambda_->GetParams().size()) {
+            throw Unsupported{};
+        }
+        for (size_t i = 1; i < items.size(); ++i) {
+            Expect(items[i], Type::INT);
+            asm_.Emit({0x50});  // push rax
+        }
+        if (tail) {
+            // By position: a let in between may shadow the names.
+            for (size_t i = argc; i-- > 0;) {
+                asm_.Emit({0x58, 0x48, 0x89, 0x85});  // pop rax; mov [rbp + offset], rax
+                asm_.Emit32(static_cast<int32_t>(16 + 8 * (argc - 1 - i)));
+            }
+            asm_.Jump(loop_);
+        } else {
+            asm_.Call(body_);
+            asm_.Emit({0x48, 0x81, 0xC4});  // add rsp, 8 * argc
+            asm_.Emit32(static_cast<int32_t>(8 * argc));
+        }
+        return result_;
+    }
+};
+
+}  // namespace
+
+std::unique_ptr<JitCode> JitCode::Compile(Lambda* lambda) {
+    auto scope = As<Scope>(lambda->GetScope());
+    if (scope == nullptr || !scope->IsGlobal() || lambda->GetParams().size() > kMaxParams) {
+        return nullptr;
+    }
+    for (auto result : {Type::INT, Type::BOOL}) {
+        Compiler compiler(lambda, result);
+        std::vector<uint8_t> code;
+        try {
+            code = compiler.Compile();
+        } catch (const Unsupported&) {
+            continue;
+        }
+
+        auto page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        auto size = (code.size() + page - 1) / page * page;
+        auto memory =
+            mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (memory == MAP_FAILED) {
+            return nullptr;
+        }
+        std::memcpy(memory, code.data(), code.size());
+        if (mprotect(memory, size, PROT_READ | PROT_EXEC) != 0) {
+            munmap(memory, size);
+            return nullptr;
+        }
+        return std::unique_ptr<JitCode>(
+            new JitCode(memory, size, result == Type::BOOL, compiler.TakeGuards()));
+    }
+    return nullptr;
+}
+
+JitCode::~JitCode() {
+    munmap(memory_, size_);
+}
+
+#else
+
+std::unique_ptr<JitCode> JitCode::Compile([[maybe_unused]] Lambda* lambda) {
+    return nullptr;
+}
+
+JitCode::~JitCode() = default;
+
+#endif
+
+JitCode::JitCode(void* memory, size_t size, bool returns_bool, std::vector<Guarded::Guard> guards)
+    : memory_(memory),
+      size_(size),
+      entry_(reinterpret_cast<Entry>(memory)),
+      returns_bool_(returns_bool),
+      guards_(std::move(guards)) {
+}
+
+bool JitCode::IsCurrent() const {
+    for (const auto& guard : guards_) {
+        if (guard.binding->version != guard.version) {
+            return false;
+        }
+    }
+    return true;
+}
+
+Object* JitCode::Run(const std::vector<Object*>& args) {
+    std::array<int64_t, kMaxParams> values;
+    for (size_t i = 0; i < args.size(); ++i) {
+        auto number = As<Number>(args[i]);
+        if (number == nullptr) {
+            return nullptr;
+        }
+        values[i] = number->GetValue();
+    }
+    Context context{0, kMaxDepth};
+    int64_t result;
+    if (entry_(values.data(), &context, &result) != 0) {
+        return nullptr;
+    }
+    auto& heap = GetInstance<Heap>();
+    return returns_bool_ ? heap.Make<Symbol>(result != 0) : heap.Make<Number>(result);
+}
+
+Object* JitState::Run(Lambda* lambda, const std::vector<Object*>& args) {
+    if (code_ != nullptr && !code_->IsCurrent()) {
+        code_.reset();
+        calls_ = 0;
+        threshold_ = kJitThreshold;
+    }
+    if (code_ == nullptr) {
+        if (++calls_ < threshold_) {
+            return nullptr;
+        }
+        code_ = JitCode::Compile(lambda);
+        if (code_ == nullptr) {
+            calls_ = 0;
+            threshold_ = std::min(2 * threshold_, kMaxThreshold);
+            return nullptr;
+        }
+    }
+    return code_->Run(args);
+}
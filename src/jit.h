@@ -0,0 +1,80 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "object.h"
+
+// Baseline JIT for fixnum kernels. A lambda closed over the global scope whose body is a single
+// expression built from fixnum constants, parameters, let/let*, if, and/or/not, the arithmetic
+// builtins, the comparisons and calls of the lambda itself is translated, node by node, into
+// x86-64 code. Self tail calls become jumps, other self calls native calls.
+//
+// The translated subset has no side effects, so whenever the native code can't produce the
+// result exactly as the interpreter would (an overflow into bignums, a division by zero, a too
+// deep recursion) it gives up and the whole call simply runs again in the interpreter.
+//
+// Only built for Linux on x86-64 with the SCHEME_JIT CMake option; elsewhere nothing compiles
+// and every call is interpreted.
+
+// Whether Lambda::Apply tries compiled code at all; off by default.
+void SetJitEnabled(bool enabled);
+
+bool IsJitEnabled();
+
+class JitCode {
+public:
+    // Lambdas with more parameters are never compiled.
+    static constexpr size_t kMaxParams = 8;
+    // Nested non-tail self calls before the native code gives up.
+    static constexpr int64_t kMaxDepth = 1 << 14;
+
+    // nullptr if the body is outside the supported subset.
+    static std::unique_ptr<JitCode> Compile(Lambda* lambda);
+
+    JitCode(const JitCode& other) = delete;
+
+    JitCode& operator=(const JitCode& other) = delete;
+
+    ~JitCode();
+
+    // Whether every global binding the code was compiled against is unchanged.
+    bool IsCurrent() const;
+
+    // Result of the call, or nullptr if the interpreter has to run it: an argument isn't a
+    // fixnum or the native code gave up.
+    Object* Run(const std::vector<Object*>& args);
+
+    // State of one native run, shared by all its frames.
+    struct Context;
+
+private:
+    using Entry = int (*)(const int64_t* args, Context* context, int64_t* result);
+
+    void* memory_;
+    size_t size_;
+    Entry entry_;
+    bool returns_bool_;
+    std::vector<Guarded::Guard> guards_;
+
+    JitCode(void* memory, size_t size, bool returns_bool, std::vector<Guarded::Guard> guards);
+};
+
+// Per-lambda bookkeeping: the lambda is compiled on its kJitThreshold-th call, and compiled
+// again after the code was invalidated by a redefinition. Whether the body compiles depends on
+// the global bindings it calls, which a later define may add or change, so a failed attempt is
+// retried after twice as many calls as the previous one, up to kMaxThreshold.
+class JitState {
+public:
+    static constexpr uint32_t kJitThreshold = 2;
+    static constexpr uint32_t kMaxThreshold = 1 << 16;
+
+    // Result of the compiled code, nullptr if the interpreter has to run the call.
+    Object* Run(Lambda* lambda, const std::vector<Object*>& args);
+
+private:
+    std::unique_ptr<JitCode> code_;
+    uint32_t calls_ = 0;
+    uint32_t threshold_ = kJitThreshold;
+};
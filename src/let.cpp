@@ -0,0 +1,324 @@
+#include "let.h"
+#include <cstddef>
+#include <optional>
+#include <string>
+#include <vector>
+#include "classes.h"
+#include "error.h"
+#include "feedback.h"
+#include "heap.h"
+#include "object.h"
+
+namespace {
+
+struct Binding {
+    std::string name;
+    Object* init;
+    Object* step;
+};
+
+std::vector<Object*> ListItems(Object* list) {
+    std::vector<Object*> items;
+    while (Is<Cell>(list)) {
+        items.push_back(As<Cell>(list)->GetFirst());
+        list = As<Cell>(list)->GetSecond();
+    }
+    if (list != nullptr) {
+        throw SyntaxError("Invalid binding");
+    }
+    return items;
+}
+
+// ((name init) ...), or ((name init [step]) ...) for do.
+std::vector<Binding> ParseBindings(Object* list, bool with_step) {
+    std::vector<Binding> bindings;
+    for (auto item : ListItems(list)) {
+        auto parts = ListItems(item);
+        if (parts.size() < 2 || parts.size() > (with_step ? 3 : 2) || !Is<Symbol>(parts[0])) {
+            throw SyntaxError("Invalid binding");
+        }
+        bindings.push_back({As<Symbol>(parts[0])->GetName(), parts[1],
+                            parts.size() == 3 ? parts[2] : nullptr});
+    }
+    return bindings;
+}
+
+Object* CheckBody(Object* body) {
+    if (!Is<Cell>(body)) {
+        throw SyntaxError("Let should return something");
+    }
+    return body;
+}
+
+Object* Evaluate(Object* expr, Object* scope) {
+    if (expr == nullptr) {
+        return nullptr;
+    }
+    expr->AddScope(scope);
+    return expr->Calculate();
+}
+
+Object* EvaluateBody(Object* body, Object* scope) {
+    Object* result = nullptr;
+    for (; Is<Cell>(body); body = As<Cell>(body)->GetSecond()) {
+        result = Evaluate(As<Cell>(body)->GetFirst(), scope);
+    }
+    return result;
+}
+
+// Whether name only occurs as the operator of calls in tail position of expr.
+bool IsTailOnly(Object* expr, const std::string& name, bool is_tail) {
+    if (auto symbol = As<Symbol>(expr)) {
+        return symbol->GetName() != name;
+    }
+    if (auto guarded = As<Guarded>(expr)) {
+        return IsTailOnly(guarded->GetFast(), name, false) &&
+               IsTailOnly(guarded->GetOriginal(), name, false);
+    }
+    if (auto site = As<ArithmeticSite>(expr)) {
+        return IsTailOnly(site->GetCall(), name, false);
+    }
+    if (!Is<Cell>(expr) || IsHead(expr, "quote")) {
+        return true;
+    }
+    auto head = As<Symbol>(As<Cell>(expr)->GetFirst());
+    bool is_self_call = head != nullptr && head->GetName() == name;
+    if (is_self_call && !is_tail) {
+        return false;
+    }
+    bool is_if = head != nullptr && head->GetName() == "if";
+
+    size_t index = 0;
+    auto node = is_self_call ? As<Cell>(expr)->GetSecond() : expr;
+    for (; Is<Cell>(node); node = As<Cell>(node)->GetSecond(), ++index) {
+        // The branches of an if in tail position are in tail position too.
+        bool is_branch = is_tail && is_if && index >= 2;
+        if (!IsTailOnly(As<Cell>(node)->GetFirst(), name, is_branch)) {
+            return false;
+        }
+    }
+    return IsTailOnly(node, name, false);
+}
+
+bool IsBodyTailOnly(Object* body, const std::string& name) {
+    for (; Is<Cell>(body); body = As<Cell>(body)->GetSecond()) {
+        bool is_last = As<Cell>(body)->GetSecond() == nullptr;
+        if (!IsTailOnly(As<Cell>(body)->GetFirst(), name, is_last)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// A pooled frame if nothing can capture it, a heap one otherwise.
+class Frame {
+public:
+    Frame(Object* parent, bool may_capture) {
+        if (may_capture) {
+            heap_frame_ = As<Scope>(GetInstance<Heap>().Make<Scope>(parent));
+        } else {
+            pooled_frame_.emplace(parent);
+        }
+    }
+
+    Scope* Get() const {
+        return pooled_frame_ ? pooled_frame_->Get() : heap_frame_;
+    }
+
+private:
+    std::optional<PooledFrame> pooled_frame_;
+    Scope* heap_frame_ = nullptr;
+};
+
+void Bind(Scope* frame, const std::vector<Binding>& bindings, const std::vector<Object*>& values) {
+    for (size_t i = 0; i < bindings.size(); ++i) {
+        frame->Add(bindings[i].name, values[i]);
+    }
+}
+
+// Runs the body of a named let in one frame, turning tail self calls into jumps.
+Object* RunLoop(Object* self, Scope* frame, const std::vector<Binding>& bindings, Object* body) {
+    while (true) {
+        auto form = body;
+        for (; As<Cell>(form)->GetSecond() != nullptr; form = As<Cell>(form)->GetSecond()) {
+            Evaluate(As<Cell>(form)->GetFirst(), frame);
+        }
+
+        auto expr = As<Cell>(form)->GetFirst();
+        while (true) {
+            auto call = As<Cell>(expr);
+            auto head = call != nullptr ? As<Symbol>(call->GetFirst()) : nullptr;
+            if (head == nullptr) {
+                return Evaluate(expr, frame);
+            }
+            auto function = frame->Get(head->GetName());
+            if (auto if_func = As<IfFunc>(function)) {
+                call->AddScope(frame);
+                call->ThrowScope();
+                expr = if_func->SelectBranch(call->GetSecond());
+                if (expr == nullptr) {
+                    return nullptr;
+                }
+                continue;
+            }
+            if (function != self) {
+                return Evaluate(expr, frame);
+            }
+
+            call->AddScope(frame);
+            call->ThrowScope();
+            auto values = GetArgs(call->GetSecond());
+            RequireArgsRE(values, bindings.size(), bindings.size());
+            Bind(frame, bindings, values);
+            break;
+        }
+    }
+}
+
+}  // namespace
+
+////////////////////////////////FUNCTIONS//////////////////////////////////////////////////
+
+Object* Let::operator()(Object* root) {
+    ThrowScope();
+    if (!Is<Cell>(root)) {
+        throw SyntaxError("Let should return something");
+    }
+    if (Is<Symbol>(As<Cell>(root)->GetFirst())) {
+        return NamedLet(root);
+    }
+    auto scope = root->GetScope();
+    auto bindings = ParseBindings(As<Cell>(root)->GetFirst(), false);
+    auto body = CheckBody(As<Cell>(root)->GetSecond());
+
+    std::vector<Object*> values;
+    for (const auto& binding : bindings) {
+        values.push_back(Evaluate(binding.init, scope));
+    }
+    Frame frame(scope, MayCapture(body));
+    Bind(frame.Get(), bindings, values);
+    return EvaluateBody(body, frame.Get());
+}
+
+Object* Let::NamedLet(Object* root) {
+    auto scope = root->GetScope();
+    auto name = As<Symbol>(As<Cell>(root)->GetFirst())->GetName();
+    auto rest = As<Cell>(root)->GetSecond();
+    if (!Is<Cell>(rest)) {
+        throw SyntaxError("Let should return something");
+    }
+    auto bindings = ParseBindings(As<Cell>(rest)->GetFirst(), false);
+    auto body = CheckBody(As<Cell>(rest)->GetSecond());
+
+    std::vector<Object*> values;
+    for (const auto& binding : bindings) {
+        values.push_back(Evaluate(binding.init, scope));
+    }
+
+    // The loop is a real procedure bound in its own scope, so any use of it outside the
+    // fast path below behaves exactly like a lambda.
+    std::vector<Object*> params;
+    for (const auto& binding : bindings) {
+        params.push_back(GetInstance<Heap>().Make<Symbol>(binding.name));
+    }
+    auto loop_scope = GetInstance<Heap>().Make<Scope>(scope);
+    auto self = GetInstance<Heap>().Make<Lambda>(params, body, loop_scope);
+    As<Scope>(loop_scope)->Add(name, self);
+
+    if (MayCapture(body) || !IsBodyTailOnly(body, name)) {
+        return self->Apply(values);
+    }
+    PooledFrame frame(loop_scope);
+    Bind(frame.Get(), bindings, values);
+    return RunLoop(self, frame.Get(), bindings, body);
+}
+
+Object* Let::DeepCopy() {
+    return GetInstance<Heap>().Make<Let>();
+}
+
+Object* LetStar::operator()(Object* root) {
+    ThrowScope();
+    if (!Is<Cell>(root)) {
+        throw SyntaxError("Let should return something");
+    }
+    auto bindings = ParseBindings(As<Cell>(root)->GetFirst(), false);
+    auto body = CheckBody(As<Cell>(root)->GetSecond());
+
+    // Every init sees the bindings before it, so the inits share the frame with the body.
+    Frame frame(root->GetScope(), MayCapture(root));
+    for (const auto& binding : bindings) {
+        frame.Get()->Add(binding.name, Evaluate(binding.init, frame.Get()));
+    }
+    return EvaluateBody(body, frame.Get());
+}
+
+Object* LetStar::DeepCopy() {
+    return GetInstance<Heap>().Make<LetStar>();
+}
+
+Object* Letrec::operator()(Object* root) {
+    ThrowScope();
+    if (!Is<Cell>(root)) {
+        throw SyntaxError("Let should return something");
+    }
+    auto bindings = ParseBindings(As<Cell>(root)->GetFirst(), false);
+    auto body = CheckBody(As<Cell>(root)->GetSecond());
+
+    Frame frame(root->GetScope(), MayCapture(root));
+    for (const auto& binding : bindings) {
+        frame.Get()->Add(binding.name, nullptr);
+    }
+    std::vector<Object*> values;
+    for (const auto& binding : bindings) {
+        values.push_back(Evaluate(binding.init, frame.Get()));
+    }
+    Bind(frame.Get(), bindings, values);
+    return EvaluateBody(body, frame.Get());
+}
+
+Object* Letrec::DeepCopy() {
+    return GetInstance<Heap>().Make<Letrec>();
+}
+
+Object* DoLoop::operator()(Object* root) {
+    ThrowScope();
+    auto parts = ListItems(root);
+    if (parts.size() < 2 || !Is<Cell>(parts[1])) {
+        throw SyntaxError("Invalid do loop");
+    }
+    auto scope = root->GetScope();
+    auto bindings = ParseBindings(parts[0], true);
+    auto test = As<Cell>(parts[1])->GetFirst();
+    auto result = As<Cell>(parts[1])->GetSecond();
+    auto body = As<Cell>(As<Cell>(root)->GetSecond())->GetSecond();
+
+    std::vector<Object*> values;
+    for (const auto& binding : bindings) {
+        values.push_back(Evaluate(binding.init, scope));
+    }
+    bool may_capture = MayCapture(root);
+    Frame frame(scope, may_capture);
+    auto current = frame.Get();
+    Bind(current, bindings, values);
+
+    while (!IsTrue(Evaluate(test, current))) {
+        EvaluateBody(body, current);
+        // Steps are computed from the old values and assigned together.
+        values.clear();
+        for (const auto& binding : bindings) {
+            values.push_back(binding.step != nullptr ? Evaluate(binding.step, current)
+                                                     : current->Get(binding.name));
+        }
+        // Closures made in the body keep the values of their own iteration.
+        if (may_capture) {
+            current = As<Scope>(GetInstance<Heap>().Make<Scope>(scope));
+        }
+        Bind(current, bindings, values);
+    }
+    return EvaluateBody(result, current);
+}
+
+Object* DoLoop::DeepCopy() {
+    return GetInstance<Heap>().Make<DoLoop>();
+}
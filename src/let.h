@@ -0,0 +1,63 @@
+#pragma once
+
+#include "classes.h"
+#include "heap.h"
+#include "object.h"
+
+// Binding forms evaluated directly instead of through a lambda call. When nothing in the
+// form can create a closure, the bindings live in a frame taken from the FramePool, and a
+// named let whose self calls are all in tail position runs as a loop in a single frame.
+
+// (let ((name init) ...) body ...) and (let loop ((name init) ...) body ...)
+class Let : public Object {
+public:
+    virtual Object* operator()(Object* root) override;
+
+    virtual Object* DeepCopy() override;
+
+private:
+    friend Heap;
+
+    Let() = default;
+
+    Object* NamedLet(Object* root);
+};
+
+// (let* ((name init) ...) body ...)
+class LetStar : public Object {
+public:
+    virtual Object* operator()(Object* root) override;
+
+    virtual Object* DeepCopy() override;
+
+private:
+    friend Heap;
+
+    LetStar() = default;
+};
+
+// (letrec ((name init) ...) body ...)
+class Letrec : public Object {
+public:
+    virtual Object* operator()(Object* root) override;
+
+    virtual Object* DeepCopy() override;
+
+private:
+    friend Heap;
+
+    Letrec() = default;
+};
+
+// (do ((name init step) ...) (test result ...) body ...)
+class DoLoop : public Object {
+public:
+    virtual Object* operator()(Object* root) override;
+
+    virtual Object* DeepCopy() override;
+
+private:
+    friend Heap;
+
+    DoLoop() = default;
+};
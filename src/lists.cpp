@@ -0,0 +1,326 @@
+#include "lists.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <utility>
+#include <vector>
+#include "classes.h"
+#include "error.h"
+#include "heap.h"
+#include "object.h"
+
+namespace {
+
+Object* CheckFunction(Object* function) {
+    if (function == nullptr || Is<Cell>(function)) {
+        throw RuntimeError("Invalid type of argument");
+    }
+    return function;
+}
+
+// Takes the heads of all lists into args and advances them; false once any list ends. Throws
+// RuntimeError on a tail that is neither a pair nor the empty list.
+bool NextArgs(std::vector<Object*>* lists, std::vector<Object*>* args) {
+    args->clear();
+    bool has_ended = false;
+    for (auto list : *lists) {
+        if (list == nullptr) {
+            has_ended = true;
+        } else if (!Is<Cell>(list)) {
+            throw RuntimeError("Invalid type of argument");
+        }
+    }
+    if (has_ended) {
+        return false;
+    }
+    for (auto& list : *lists) {
+        args->push_back(As<Cell>(list)->GetFirst());
+        list = As<Cell>(list)->GetSecond();
+    }
+    return true;
+}
+
+// Sorts fixnums by value if the comparator is the builtin < or >; false if it can't.
+bool SortFixnums(Object* less, std::vector<Object*>* items) {
+    bool ascending = Is<Less>(less);
+    if (!ascending && !Is<Greate>(less)) {
+        return false;
+    }
+    std::vector<std::pair<int64_t, Object*>> keyed;
+    keyed.reserve(items->size());
+    for (auto item : *items) {
+        auto number = As<Number>(item);
+        if (number == nullptr) {
+            return false;
+        }
+        keyed.emplace_back(number->GetValue(), item);
+    }
+
+    auto by_value = [ascending](const auto& lhs, const auto& rhs) {
+        return ascending ? lhs.first < rhs.first : lhs.first > rhs.first;
+    };
+    std::stable_sort(keyed.begin(), keyed.end(), by_value);
+    for (size_t i = 0; i < keyed.size(); ++i) {
+        (*items)[i] = keyed[i].second;
+    }
+    return true;
+}
+
+// Bottom-up merge sort. Unlike std::stable_sort it stays in bounds even if a user comparator
+// is not a strict weak ordering.
+void MergeSort(Object* less, std::vector<Object*>* items) {
+    std::vector<Object*> buffer(items->size());
+    std::vector<Object*> call_args(2);
+    auto is_less = [&](Object* lhs, Object* rhs) {
+        call_args[0] = lhs;
+        call_args[1] = rhs;
+        return IsTrue(less->Apply(call_args));
+    };
+
+    size_t size = items->size();
+    for (size_t width = 1; width < size; width *= 2) {
+        for (size_t lo = 0; lo < size; lo += 2 * width) {
+            size_t mid = std::min(lo + width, size);
+            size_t hi = std::min(lo + 2 * width, size);
+            size_t left = lo;
+            size_t right = mid;
+            for (size_t out = lo; out < hi; ++out) {
+                // Takes from the right half only if strictly less, which keeps equal keys stable.
+                if (left < mid && (right == hi || !is_less((*items)[right], (*items)[left]))) {
+                    buffer[out] = (*items)[left++];
+                } else {
+                    buffer[out] = (*items)[right++];
+                }
+            }
+        }
+        items->swap(buffer);
+    }
+}
+
+}  // namespace
+
+/////////////////////////////////HELPERS///////////////////////////////////////////////////
+
+std::vector<Object*> ListToVector(Object* list) {
+    std::vector<Object*> items;
+    while (Is<Cell>(list)) {
+        items.push_back(As<Cell>(list)->GetFirst());
+        list = As<Cell>(list)->GetSecond();
+    }
+    if (list != nullptr) {
+        throw RuntimeError("Invalid type of argument");
+    }
+    return items;
+}
+
+Object* VectorToList(const std::vector<Object*>& items, Object* tail) {
+    auto& heap = GetInstance<Heap>();
+    heap.Reserve(items.size());
+    for (auto it = items.rbegin(); it != items.rend(); ++it) {
+        tail = heap.Make<Cell>(*it, tail);
+    }
+    return tail;
+}
+
+////////////////////////////////FUNCTIONS//////////////////////////////////////////////////
+
+Object* MapFunction::operator()(Object* root) {
+    ThrowScope();
+    auto args = GetArgs(root);
+    RequireArgsRE(args, 2, std::numeric_limits<size_t>::max());
+    auto function = CheckFunction(args[0]);
+
+    std::vector<Object*> lists(args.begin() + 1, args.end());
+    std::vector<Object*> call_args;
+    std::vector<Object*> result;
+    while (NextArgs(&lists, &call_args)) {
+        result.push_back(function->Apply(call_args));
+    }
+    return VectorToList(result);
+}
+
+Object* MapFunction::DeepCopy() {
+    return GetInstance<Heap>().Make<MapFunction>();
+}
+
+Object* FilterFunction::operator()(Object* root) {
+    ThrowScope();
+    auto args = GetArgs(root);
+    RequireArgsRE(args, 2, 2);
+    auto predicate = CheckFunction(args[0]);
+
+    std::vector<Object*> result;
+    std::vector<Object*> call_args(1);
+    for (auto item : ListToVector(args[1])) {
+        call_args[0] = item;
+        if (IsTrue(predicate->Apply(call_args))) {
+            result.push_back(item);
+        }
+    }
+    return VectorToList(result);
+}
+
+Object* FilterFunction::DeepCopy() {
+    return GetInstance<Heap>().Make<FilterFunction>();
+}
+
+Object* FoldLeft::operator()(Object* root) {
+    ThrowScope();
+    auto args = GetArgs(root);
+    RequireArgsRE(args, 3, std::numeric_limits<size_t>::max());
+    auto function = CheckFunction(args[0]);
+
+    auto accumulator = args[1];
+    std::vector<Object*> lists(args.begin() + 2, args.end());
+    std::vector<Object*> items;
+    std::vector<Object*> call_args;
+    while (NextArgs(&lists, &items)) {
+        call_args.clear();
+        call_args.push_back(accumulator);
+        call_args.insert(call_args.end(), items.begin(), items.end());
+        accumulator = function->Apply(call_args);
+    }
+    return accumulator;
+}
+
+Object* FoldLeft::DeepCopy() {
+    return GetInstance<Heap>().Make<FoldLeft>();
+}
+
+Object* FoldRight::operator()(Object* root) {
+    ThrowScope();
+    auto args = GetArgs(root);
+    RequireArgsRE(args, 3, std::numeric_limits<size_t>::max());
+    auto function = CheckFunction(args[0]);
+
+    // The spines are walked forwards once, then the calls are made from the back.
+    std::vector<Object*> lists(args.begin() + 2, args.end());
+    std::vector<Object*> items;
+    std::vector<std::vector<Object*>> rows;
+    while (NextArgs(&lists, &items)) {
+        rows.push_back(items);
+    }
+
+    auto accumulator = args[1];
+    for (auto it = rows.rbegin(); it != rows.rend(); ++it) {
+        it->push_back(accumulator);
+        accumulator = function->Apply(*it);
+    }
+    return accumulator;
+}
+
+Object* FoldRight::DeepCopy() {
+    return GetInstance<Heap>().Make<FoldRight>();
+}
+
+Object* ForEach::operator()(Object* root) {
+    ThrowScope();
+    auto args = GetArgs(root);
+    RequireArgsRE(args, 2, std::numeric_limits<size_t>::max());
+    auto function = CheckFunction(args[0]);
+
+    std::vector<Object*> lists(args.begin() + 1, args.end());
+    std::vector<Object*> call_args;
+    while (NextArgs(&lists, &call_args)) {
+        function->Apply(call_args);
+    }
+    return nullptr;
+}
+
+Object* ForEach::DeepCopy() {
+    return GetInstance<Heap>().Make<ForEach>();
+}
+
+Object* Append::operator()(Object* root) {
+    ThrowScope();
+    auto args = GetArgs(root);
+    if (args.empty()) {
+        return nullptr;
+    }
+
+    // Every list but the last is copied, the last one becomes the shared tail.
+    std::vector<Object*> items;
+    for (size_t i = 0; i + 1 < args.size(); ++i) {
+        auto list = ListToVector(args[i]);
+        items.insert(items.end(), list.begin(), list.end());
+    }
+    return VectorToList(items, args.back());
+}
+
+Object* Append::DeepCopy() {
+    return GetInstance<Heap>().Make<Append>();
+}
+
+Object* Reverse::operator()(Object* root) {
+    ThrowScope();
+    auto args = GetArgs(root);
+    RequireArgsRE(args, 1, 1);
+
+    auto items = ListToVector(args[0]);
+    auto& heap = GetInstance<Heap>();
+    heap.Reserve(items.size());
+    Object* result = nullptr;
+    for (auto item : items) {
+        result = heap.Make<Cell>(item, result);
+    }
+    return result;
+}
+
+Object* Reverse::DeepCopy() {
+    return GetInstance<Heap>().Make<Reverse>();
+}
+
+Object* Length::operator()(Object* root) {
+    ThrowScope();
+    auto args = GetArgs(root);
+    RequireArgsRE(args, 1, 1);
+
+    int64_t length = 0;
+    auto list = args[0];
+    while (Is<Cell>(list)) {
+        ++length;
+        list = As<Cell>(list)->GetSecond();
+    }
+    if (list != nullptr) {
+        throw RuntimeError("Invalid type of argument");
+    }
+    return GetInstance<Heap>().Make<Number>(length);
+}
+
+Object* Length::DeepCopy() {
+    return GetInstance<Heap>().Make<Length>();
+}
+
+Object* ApplyFunction::operator()(Object* root) {
+    ThrowScope();
+    auto args = GetArgs(root);
+    RequireArgsRE(args, 2, std::numeric_limits<size_t>::max());
+    auto function = CheckFunction(args[0]);
+
+    std::vector<Object*> call_args(args.begin() + 1, args.end() - 1);
+    auto rest = ListToVector(args.back());
+    call_args.insert(call_args.end(), rest.begin(), rest.end());
+    return function->Apply(call_args);
+}
+
+Object* ApplyFunction::DeepCopy() {
+    return GetInstance<Heap>().Make<ApplyFunction>();
+}
+
+Object* Sort::operator()(Object* root) {
+    ThrowScope();
+    auto args = GetArgs(root);
+    RequireArgsRE(args, 2, 2);
+    auto less = CheckFunction(args[1]);
+
+    auto items = ListToVector(args[0]);
+    if (!SortFixnums(less, &items)) {
+        MergeSort(less, &items);
+    }
+    return VectorToList(items);
+}
+
+Object* Sort::DeepCopy() {
+    return GetInstance<Heap>().Make<Sort>();
+}
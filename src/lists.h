@@ -0,0 +1,139 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+#include "classes.h"
+#include "heap.h"
+#include "object.h"
+
+// List primitives implemented natively: they walk spines in a loop, call functions through
+// Object::Apply and allocate every result spine in one batch.
+
+// Elements of a proper list; throws RuntimeError for anything else.
+std::vector<Object*> ListToVector(Object* list);
+
+Object* VectorToList(const std::vector<Object*>& items, Object* tail = nullptr);
+
+////////////////////////////////FUNCTIONS//////////////////////////////////////////////////
+
+class MapFunction : public Object {
+public:
+    virtual Object* operator()(Object* root) override;
+
+    virtual Object* DeepCopy() override;
+
+private:
+    friend Heap;
+
+    MapFunction() = default;
+};
+
+class FilterFunction : public Object {
+public:
+    virtual Object* operator()(Object* root) override;
+
+    virtual Object* DeepCopy() override;
+
+private:
+    friend Heap;
+
+    FilterFunction() = default;
+};
+
+class FoldLeft : public Object {
+public:
+    virtual Object* operator()(Object* root) override;
+
+    virtual Object* DeepCopy() override;
+
+private:
+    friend Heap;
+
+    FoldLeft() = default;
+};
+
+class FoldRight : public Object {
+public:
+    virtual Object* operator()(Object* root) override;
+
+    virtual Object* DeepCopy() override;
+
+private:
+    friend Heap;
+
+    FoldRight() = default;
+};
+
+class ForEach : public Object {
+public:
+    virtual Object* operator()(Object* root) override;
+
+    virtual Object* DeepCopy() override;
+
+private:
+    friend Heap;
+
+    ForEach() = default;
+};
+
+class Append : public Object {
+public:
+    virtual Object* operator()(Object* root) override;
+
+    virtual Object* DeepCopy() override;
+
+private:
+    friend Heap;
+
+    Append() = default;
+};
+
+class Reverse : public Object {
+public:
+    virtual Object* operator()(Object* root) override;
+
+    virtual Object* DeepCopy() override;
+
+private:
+    friend Heap;
+
+    Reverse() = default;
+};
+
+class Length : public Object {
+public:
+    virtual Object* operator()(Object* root) override;
+
+    virtual Object* DeepCopy() override;
+
+private:
+    friend Heap;
+
+    Length() = default;
+};
+
+class ApplyFunction : public Object {
+public:
+    virtual Object* operator()(Object* root) override;
+
+    virtual Object* DeepCopy() override;
+
+private:
+    friend Heap;
+
+    ApplyFunction() = default;
+};
+
+// (sort list less?): stable merge sort. With < or > and a list of fixnums the comparisons are
+// done directly on int64_t instead of calling the comparator.
+class Sort : public Object {
+public:
+    virtual Object* operator()(Object* root) override;
+
+    virtual Object* DeepCopy() override;
+
+private:
+    friend Heap;
+
+    Sort() = default;
+};
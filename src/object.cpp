@@ -1,14 +1,24 @@
 #include "object.h"
+#include <charconv>
+#include <chrono>
+#include <cmath>
 #include <cstddef>
 #include <iostream>
 #include <limits>
 #include <memory>
+#include <sstream>
 #include <stdexcept>
 #include <string>
+#include <utility>
 #include <type_traits>
 #include <vector>
 #include "classes.h"
 #include "error.h"
+#include "feedback.h"
+#include "jit.h"
+#include "printer.h"
+#include "profiler.h"
+#include "tracer.h"
 
 std::string Object::ToString() {
     throw RuntimeError("Not Implemented");
@@ -26,6 +36,16 @@ Object* Object::operator()([[maybe_unused]] Object* root) {
     throw RuntimeError("Not Implemented");
 }
 
+Object* Object::Apply(const std::vector<Object*>& args) {
+    auto& heap = GetInstance<Heap>();
+    heap.Reserve(2 * args.size());
+    Object* root = nullptr;
+    for (auto it = args.rbegin(); it != args.rend(); ++it) {
+        root = heap.Make<Cell>(heap.Make<Quoted>(*it), root);
+    }
+    return (*this)(root);
+}
+
 void Object::AddScope(Object* scope) {
     scope_ = scope;
 }
@@ -56,10 +76,16 @@ void Object::RemoveDependency(Object* other) {
 }
 
 void Object::Mark() {
+    std::vector<Object*> stack = {this};
     is_achivable_ = true;
-    for (auto v : neighbours_) {
-        if (v != nullptr && !v->is_achivable_) {
-            v->Mark();
+    while (!stack.empty()) {
+        auto obj = stack.back();
+        stack.pop_back();
+        for (auto v : obj->neighbours_) {
+            if (v != nullptr && !v->is_achivable_) {
+                v->is_achivable_ = true;
+                stack.push_back(v);
+            }
         }
     }
 }
@@ -87,6 +113,61 @@ Object* Number::Calculate() {
 
 ///////////////////////////////////////////////////////////////////////////////////////////
 
+BigNumber::BigNumber(BigInt value) : value_(std::move(value)) {
+}
+
+const BigInt& BigNumber::GetValue() const {
+    return value_;
+}
+
+std::string BigNumber::ToString() {
+    return value_.ToString();
+}
+
+Object* BigNumber::DeepCopy() {
+    return this;  // immutable, the digits are not worth copying
+}
+
+Object* BigNumber::Calculate() {
+    return this;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+
+Float::Float(double value) : value_(value) {
+}
+
+double Float::GetValue() const {
+    return value_;
+}
+
+std::string Float::ToString() {
+    if (std::isnan(value_)) {
+        return "+nan.0";
+    }
+    if (std::isinf(value_)) {
+        return value_ > 0 ? "+inf.0" : "-inf.0";
+    }
+    char buffer[32];
+    auto [end, ec] = std::to_chars(buffer, buffer + sizeof(buffer), value_);
+    std::string result(buffer, end);
+    // Shortest round-trip form, with a fraction so it doesn't read back as an integer.
+    if (result.find_first_of(".e") == std::string::npos) {
+        result += ".0";
+    }
+    return result;
+}
+
+Object* Float::DeepCopy() {
+    return this;
+}
+
+Object* Float::Calculate() {
+    return this;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+
 Symbol::Symbol(std::string str) : str_(str) {
 }
 
@@ -104,12 +185,29 @@ std::string Symbol::ToString() {
     return str_;
 }
 
+Symbol::Symbol(std::string str, std::shared_ptr<LookupCache> cache)
+    : str_(std::move(str)), cache_(std::move(cache)) {
+}
+
 Object* Symbol::DeepCopy() {
-    return GetInstance<Heap>().Make<Symbol>(str_);
+    if (cache_ == nullptr) {
+        cache_ = std::make_shared<LookupCache>();
+    }
+    return GetInstance<Heap>().Make<Symbol>(str_, cache_);
 }
 
 Object* Symbol::Calculate() {
-    return As<Scope>(scope_)->Get(str_);
+    auto epoch = Scope::GetShadowEpoch();
+    if (cache_ != nullptr && cache_->binding != nullptr && cache_->epoch == epoch) [[likely]] {
+        return cache_->binding->value;
+    }
+    bool is_global;
+    auto binding = As<Scope>(scope_)->Lookup(str_, &is_global);
+    if (cache_ != nullptr && is_global) {
+        cache_->binding = binding;
+        cache_->epoch = epoch;
+    }
+    return binding->value;
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////
@@ -128,31 +226,43 @@ Object* Cell::GetSecond() const {
 }
 
 std::string Cell::ToString() {
-    std::string ans = "(";
-    Object* root = this;
-    while (root != nullptr) {
-        if (!Is<Cell>(root)) {
-            ans += ". ";
-            ans += root->ToString();
-            break;
+    std::ostringstream out;
+    Printer(&out).Print(this);
+    return out.str();
+}
+
+Object* Cell::DeepCopy() {
+    // Post-order walk with an explicit stack, so deeply nested data doesn't recurse.
+    struct Frame {
+        Cell* cell;
+        Object* first;
+        int stage;
+    };
+    std::vector<Frame> stack = {{this, nullptr, 0}};
+    Object* last = nullptr;
+
+    while (!stack.empty()) {
+        auto& frame = stack.back();
+        if (frame.stage == 2) {
+            last = GetInstance<Heap>().Make<Cell>(frame.first, last);
+#ifdef SCHEME_TRACK_ALLOC_SITES
+            static_cast<Cell*>(last)->site_ = frame.cell->site_;
+#endif
+            stack.pop_back();
+            continue;
         }
-        auto fisrt = As<Cell>(root)->first_;
-        if (fisrt == nullptr) {
-            ans += "()";
-        } else {
-            ans += As<Cell>(root)->first_->ToString();
+        if (frame.stage == 1) {
+            frame.first = last;
         }
-        if (As<Cell>(root)->second_ != nullptr) {
-            ans += " ";
+        auto child = frame.stage == 0 ? frame.cell->first_ : frame.cell->second_;
+        ++frame.stage;
+        if (auto cell = As<Cell>(child)) {
+            stack.push_back({cell, nullptr, 0});
+        } else {
+            last = child ? child->DeepCopy() : nullptr;
         }
-        root = As<Cell>(root)->second_;
     }
-    return ans + ")";
-}
-
-Object* Cell::DeepCopy() {
-    return GetInstance<Heap>().Make<Cell>(first_ ? first_->DeepCopy() : nullptr,
-                                          second_ ? second_->DeepCopy() : nullptr);
+    return last;
 }
 
 Object* Cell::Calculate() {
@@ -160,6 +270,9 @@ Object* Cell::Calculate() {
         throw RuntimeError("List can't be self calculated");
     }
 
+#ifdef SCHEME_TRACK_ALLOC_SITES
+    AllocationSite site(site_);
+#endif
     ThrowScope();
     auto func = first_->Calculate();  // maybe here problem TODO
 
@@ -169,18 +282,96 @@ Object* Cell::Calculate() {
 
     func->AddScope(scope_);
 
+    // Lambdas enter their profiler frame in Apply, which native callers use too. Builtins enter
+    // theirs once the arguments are evaluated, so the calls made there aren't counted as theirs.
+    // set-car! and set-cdr! answer with the unevaluated pair expression and keep the plain call.
+    if (Profiler::IsActive() && !Is<Lambda>(func) &&
+        GetInstance<Profiler>().IsTracked(func)) [[unlikely]] {
+        if (Is<SetCar>(func) || Is<SetCdr>(func)) {
+            ProfiledCall call(func);
+            return (*func)(second_);
+        }
+        auto args = GetArgs(second_);
+        ProfiledCall call(func);
+        return func->Apply(args);
+    }
     return (*func)(second_);
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////
 
+Quoted::Quoted(Object* value) : value_(value) {
+    AddDependency(value_);
+}
+
+Object* Quoted::GetValue() const {
+    return value_;
+}
+
+Object* Quoted::Calculate() {
+    return value_;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+
+Guarded::Guarded(Object* fast, Object* original, std::vector<Guard> guards)
+    : fast_(fast), original_(original), guards_(std::move(guards)) {
+    AddDependency(fast_);
+    AddDependency(original_);
+}
+
+Object* Guarded::GetFast() const {
+    return fast_;
+}
+
+Object* Guarded::GetOriginal() const {
+    return original_;
+}
+
+const std::vector<Guarded::Guard>& Guarded::GetGuards() const {
+    return guards_;
+}
+
+std::string Guarded::ToString() {
+    return original_ != nullptr ? original_->ToString() : "()";
+}
+
+Object* Guarded::DeepCopy() {
+    auto fast = fast_ != nullptr ? fast_->DeepCopy() : nullptr;
+    if (fast == fast_) {
+        return this;  // nothing in the fast path is evaluated in place
+    }
+    return GetInstance<Heap>().Make<Guarded>(fast, original_, guards_);
+}
+
+Object* Guarded::Calculate() {
+    for (const auto& guard : guards_) {
+        if (guard.binding->version != guard.version) [[unlikely]] {
+            // original_ itself is never evaluated, so copies of this node can share it.
+            auto original = original_->DeepCopy();
+            original->AddScope(scope_);
+            return original->Calculate();
+        }
+    }
+    if (fast_ == nullptr) {
+        return nullptr;
+    }
+    fast_->AddScope(scope_);
+    return fast_->Calculate();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+
 Scope::Scope(Object* parent) : parent_(parent) {
+    AddDependency(parent_);
 }
 
 void Scope::Add(std::string name, Object* value) {
-    RemoveDependency(scope_names_[name]);
-    scope_names_[name] = value;
-    AddDependency(scope_names_[name]);
+    auto& binding = scope_names_[std::move(name)];
+    RemoveDependency(binding.value);
+    binding.value = value;
+    ++binding.version;
+    AddDependency(binding.value);
 }
 
 void Scope::Set(std::string name, Object* new_value) {
@@ -195,19 +386,88 @@ void Scope::Set(std::string name, Object* new_value) {
 }
 
 Object* Scope::Get(std::string name) {
-    if (scope_names_.contains(name)) {
-        return scope_names_[name];
+    bool is_global;
+    return Lookup(name, &is_global)->value;
+}
+
+void Scope::Define(std::string name, Object* value) {
+    if (parent_ != nullptr && !scope_names_.contains(name)) {
+        ++shadow_epoch_;
     }
-    if (parent_ == nullptr) {
-        throw NameError("Unknown name");
+    Add(std::move(name), value);
+}
+
+Binding* Scope::Lookup(const std::string& name, bool* is_global) {
+    for (auto scope = this; scope != nullptr; scope = As<Scope>(scope->parent_)) {
+        if (auto binding = scope->Find(name)) {
+            *is_global = scope->parent_ == nullptr;
+            return binding;
+        }
     }
-    return As<Scope>(parent_)->Get(name);
+    throw NameError("Unknown name");
+}
+
+bool Scope::IsGlobal() const {
+    return parent_ == nullptr;
+}
+
+Object* Scope::GetParent() const {
+    return parent_;
+}
+
+const std::unordered_map<std::string, Binding>& Scope::GetBindings() const {
+    return scope_names_;
+}
+
+Binding* Scope::Find(const std::string& name) {
+    auto it = scope_names_.find(name);
+    return it != scope_names_.end() ? &it->second : nullptr;
+}
+
+uint64_t Scope::GetShadowEpoch() {
+    return shadow_epoch_;
 }
 
 Object* Scope::DeepCopy() {  /// maybe problem here TODO
     return this;
 }
 
+void Scope::Reset(Object* parent) {
+    parent_ = parent;
+    scope_names_.clear();
+    neighbours_.clear();
+    AddDependency(parent_);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+
+// Frames are released in reverse order of acquisition, so the pool is a stack: frames_[0,
+// used_) are in use and the rest are free.
+Scope* FramePool::Acquire(Object* parent) {
+    if (used_ == frames_.size()) {
+        frames_.emplace_back(new Scope(parent));
+    } else {
+        frames_[used_]->Reset(parent);
+    }
+    return frames_[used_++].get();
+}
+
+void FramePool::Release(Scope* frame) {
+    --used_;
+    frame->Reset(nullptr);
+}
+
+PooledFrame::PooledFrame(Object* parent) : frame_(GetInstance<FramePool>().Acquire(parent)) {
+}
+
+PooledFrame::~PooledFrame() {
+    GetInstance<FramePool>().Release(frame_);
+}
+
+Scope* PooledFrame::Get() const {
+    return frame_;
+}
+
 /////////////////////////////////HELPERS///////////////////////////////////////////////////
 
 std::vector<Object*> GetArgs(Object* root) {
@@ -256,6 +516,216 @@ void RequireArgsSE(const std::vector<Object*>& args, size_t min_cnt, size_t max_
     }
 }
 
+bool IsTrue(Object* value) {
+    return !(Is<Symbol>(value) && As<Symbol>(value)->GetName() == "#f");
+}
+
+bool IsInteger(Object* obj) {
+    return Is<Number>(obj) || Is<BigNumber>(obj);
+}
+
+bool IsNumber(Object* obj) {
+    return IsInteger(obj) || Is<Float>(obj);
+}
+
+void CheckNumbers(const std::vector<Object*>& args) {
+    for (auto arg : args) {
+        if (!IsNumber(arg)) {
+            throw RuntimeError("Invalid type of argument");
+        }
+    }
+}
+
+BigInt ToBigInt(Object* obj) {
+    if (auto number = As<Number>(obj)) {
+        return BigInt(number->GetValue());
+    }
+    return As<BigNumber>(obj)->GetValue();
+}
+
+double ToDouble(Object* obj) {
+    if (auto flonum = As<Float>(obj)) {
+        return flonum->GetValue();
+    }
+    if (auto number = As<Number>(obj)) {
+        return static_cast<double>(number->GetValue());
+    }
+    return As<BigNumber>(obj)->GetValue().ToDouble();
+}
+
+Object* MakeInteger(BigInt value) {
+    if (value.FitsInt64()) {
+        return GetInstance<Heap>().Make<Number>(value.ToInt64());
+    }
+    return GetInstance<Heap>().Make<BigNumber>(std::move(value));
+}
+
+namespace {
+
+// An exact integer against a flonum, without rounding the integer to a double first.
+std::partial_ordering CompareExact(Object* integer, double flonum) {
+    if (std::isnan(flonum)) {
+        return std::partial_ordering::unordered;
+    }
+    if (std::isinf(flonum)) {
+        return flonum > 0 ? std::partial_ordering::less : std::partial_ordering::greater;
+    }
+    auto whole = std::trunc(flonum);
+    if (auto order = Compare(ToBigInt(integer), BigInt::FromDouble(whole)); order != 0) {
+        return order <=> 0;
+    }
+    return whole <=> flonum;
+}
+
+}  // namespace
+
+std::partial_ordering CompareNumbers(Object* lhs, Object* rhs) {
+    auto lhs_flonum = As<Float>(lhs);
+    auto rhs_flonum = As<Float>(rhs);
+    if (lhs_flonum && rhs_flonum) {
+        return lhs_flonum->GetValue() <=> rhs_flonum->GetValue();
+    }
+    if (rhs_flonum) {
+        return CompareExact(lhs, rhs_flonum->GetValue());
+    }
+    if (lhs_flonum) {
+        return 0 <=> CompareExact(rhs, lhs_flonum->GetValue());
+    }
+    return Compare(ToBigInt(lhs), ToBigInt(rhs)) <=> 0;
+}
+
+NumberAccumulator::NumberAccumulator(Object* value) {
+    if (auto number = As<Number>(value)) {
+        fixnum_ = number->GetValue();
+    } else if (auto flonum = As<Float>(value)) {
+        flonum_ = flonum->GetValue();
+        kind_ = Kind::FLONUM;
+    } else {
+        bignum_ = ToBigInt(value);
+        kind_ = Kind::BIGNUM;
+    }
+}
+
+double NumberAccumulator::GetDouble() const {
+    if (kind_ == Kind::FIXNUM) {
+        return static_cast<double>(fixnum_);
+    }
+    return bignum_.ToDouble();
+}
+
+Object* NumberAccumulator::MakeObject() {
+    switch (kind_) {
+        case Kind::FIXNUM:
+            return GetInstance<Heap>().Make<Number>(fixnum_);
+        case Kind::BIGNUM:
+            return MakeInteger(std::move(bignum_));
+        case Kind::FLONUM:
+            return GetInstance<Heap>().Make<Float>(flonum_);
+    }
+    return nullptr;
+}
+
+bool IsHead(Object* expr, const char* name) {
+    auto cell = As<Cell>(expr);
+    return cell != nullptr && Is<Symbol>(cell->GetFirst()) &&
+           As<Symbol>(cell->GetFirst())->GetName() == name;
+}
+
+bool MayCapture(Object* expr) {
+    std::vector<Object*> stack = {expr};
+    while (!stack.empty()) {
+        auto node = stack.back();
+        stack.pop_back();
+        if (auto symbol = As<Symbol>(node)) {
+            if (symbol->GetName() == "lambda" || symbol->GetName() == "define") {
+                return true;
+            }
+            continue;
+        }
+        if (auto guarded = As<Guarded>(node)) {
+            stack.push_back(guarded->GetFast());
+            stack.push_back(guarded->GetOriginal());
+            continue;
+        }
+        if (auto site = As<ArithmeticSite>(node)) {
+            stack.push_back(site->GetCall());
+            continue;
+        }
+        if (!Is<Cell>(node) || IsHead(node, "quote")) {
+            continue;
+        }
+        if (IsHead(node, "let") && Is<Cell>(As<Cell>(node)->GetSecond()) &&
+            Is<Symbol>(As<Cell>(As<Cell>(node)->GetSecond())->GetFirst())) {
+            return true;
+        }
+        for (; Is<Cell>(node); node = As<Cell>(node)->GetSecond()) {
+            stack.push_back(As<Cell>(node)->GetFirst());
+        }
+        stack.push_back(node);
+    }
+    return false;
+}
+
+#ifdef SCHEME_TRACK_ALLOC_SITES
+namespace {
+
+// Calls visit(call, site of the enclosing call) for every call of form outside of quoted data,
+// outer calls first; visit returns the site of the call.
+template <class Visit>
+void ForEachCall(Object* form, uint32_t site, Visit visit) {
+    std::vector<std::pair<Object*, uint32_t>> stack = {{form, site}};
+    while (!stack.empty()) {
+        auto [node, outer] = stack.back();
+        stack.pop_back();
+        if (auto guarded = As<Guarded>(node)) {
+            stack.emplace_back(guarded->GetFast(), outer);
+            stack.emplace_back(guarded->GetOriginal(), outer);
+            continue;
+        }
+        if (auto site = As<ArithmeticSite>(node)) {
+            stack.emplace_back(site->GetCall(), outer);
+            continue;
+        }
+        auto cell = As<Cell>(node);
+        if (cell == nullptr || IsHead(node, "quote")) {
+            continue;
+        }
+        auto inner = visit(cell, outer);
+        for (; Is<Cell>(node); node = As<Cell>(node)->GetSecond()) {
+            stack.emplace_back(As<Cell>(node)->GetFirst(), inner);
+        }
+    }
+}
+
+}  // namespace
+
+uint32_t TagAllocationSites(Object* form) {
+    constexpr size_t kSiteWidth = 60;
+    ForEachCall(form, 0, [](Cell* cell, [[maybe_unused]] uint32_t outer) {
+        if (cell->site_ == 0) {
+            auto text = cell->ToString();
+            if (text.size() > kSiteWidth) {
+                text.resize(kSiteWidth - 3);
+                text += "...";
+            }
+            cell->site_ = Heap::InternSite(text);
+        }
+        return cell->site_;
+    });
+    auto cell = As<Cell>(form);
+    return cell != nullptr ? cell->site_ : 0;
+}
+
+void InheritAllocationSites(Object* form, uint32_t site) {
+    ForEachCall(form, site, [](Cell* cell, uint32_t outer) {
+        if (cell->site_ == 0) {
+            cell->site_ = outer;
+        }
+        return cell->site_;
+    });
+}
+#endif
+
 void DfsList(Object* root, size_t& depth, bool& is_end_null) {
     depth = 0;
     is_end_null = true;
@@ -272,16 +742,38 @@ void DfsList(Object* root, size_t& depth, bool& is_end_null) {
 
 ////////////////////////////////FUNCTIONS//////////////////////////////////////////////////
 
-int64_t SpecialMin::operator()(int64_t lhs, int64_t rhs) {
-    return std::min(lhs, rhs);
+Object* ExactToInexact::operator()(Object* root) {
+    ThrowScope();
+    auto args = GetArgs(root);
+    CheckNumbers(args);
+    RequireArgsRE(args, 1, 1);
+    if (Is<Float>(args[0])) {
+        return args[0];
+    }
+    return GetInstance<Heap>().Make<Float>(ToDouble(args[0]));
+}
+
+Object* ExactToInexact::DeepCopy() {
+    return GetInstance<Heap>().Make<ExactToInexact>();
 }
 
-int64_t SpecialMax::operator()(int64_t lhs, int64_t rhs) {
-    return std::max(lhs, rhs);
+Object* Abs::operator()(Object* root) {
+    ThrowScope();
+    auto args = GetArgs(root);
+    CheckNumbers(args);
+    RequireArgsRE(args, 1, 1);
+    if (auto flonum = As<Float>(args[0])) {
+        return GetInstance<Heap>().Make<Float>(std::fabs(flonum->GetValue()));
+    }
+    auto number = As<Number>(args[0]);
+    if (number != nullptr && number->GetValue() != std::numeric_limits<int64_t>::min()) {
+        return GetInstance<Heap>().Make<Number>(std::abs(number->GetValue()));
+    }
+    return MakeInteger(ToBigInt(args[0]).Abs());
 }
 
-int64_t SpecialAbs::operator()([[maybe_unused]] int64_t lhs, int64_t rhs) {
-    return std::abs(rhs);
+Object* Abs::DeepCopy() {
+    return GetInstance<Heap>().Make<Abs>();
 }
 
 Object* BooleanPredicate::operator()(Object* root) {
@@ -377,7 +869,7 @@ Object* IntegerPredicate::operator()(Object* root) {
     ThrowScope();
     auto args = GetArgs(root);
     RequireArgsRE(args, 1, 1);
-    return GetInstance<Heap>().Make<Symbol>(IsExpectedType<Number>(args));
+    return GetInstance<Heap>().Make<Symbol>(IsNumber(args[0]));
 }
 
 Object* IntegerPredicate::DeepCopy() {
@@ -430,7 +922,9 @@ Object* Cons::operator()(Object* root) {
     ThrowScope();
     auto args = GetArgs(root);
     RequireArgsRE(args, 2, 2);
-    return GetInstance<Heap>().Make<Cell>(args[0]->DeepCopy(), args[1]->DeepCopy());
+    auto first = args[0] != nullptr ? args[0]->DeepCopy() : nullptr;
+    auto second = args[1] != nullptr ? args[1]->DeepCopy() : nullptr;
+    return GetInstance<Heap>().Make<Cell>(first, second);
 }
 
 Object* Cons::DeepCopy() {
@@ -466,7 +960,7 @@ Object* ListFunction::operator()(Object* root) {
     auto args = GetArgs(root);
     Object* ptr = nullptr;
     for (auto it = args.rbegin(); it != args.rend(); ++it) {
-        ptr = GetInstance<Heap>().Make<Cell>((*it)->DeepCopy(), ptr);
+        ptr = GetInstance<Heap>().Make<Cell>(*it != nullptr ? (*it)->DeepCopy() : nullptr, ptr);
     }
     return ptr;
 }
@@ -551,7 +1045,12 @@ Object* Define::operator()(Object* root) {
     RequireArgsSE(args, 2, 2);
     CheckExpectedType<Symbol>({args[0]});
 
-    As<Scope>(root->GetScope())->Add(args[0]->ToString(), args[1]->Calculate()->DeepCopy());
+    auto value = args[1]->Calculate()->DeepCopy();
+    auto lambda = As<Lambda>(value);
+    if (lambda != nullptr && lambda->GetName() == Lambda::kAnonymous) {
+        lambda->SetName(GetInstance<Profiler>().Intern(args[0]->ToString()));
+    }
+    As<Scope>(root->GetScope())->Define(args[0]->ToString(), value);
 
     return args[0];
 }
@@ -575,6 +1074,11 @@ Object* SetVariable::DeepCopy() {
 
 Object* IfFunc::operator()(Object* root) {
     ThrowScope();
+    auto branch = SelectBranch(root);
+    return branch != nullptr ? branch->Calculate() : nullptr;
+}
+
+Object* IfFunc::SelectBranch(Object* root) {
     auto args = GetArgsWithoutCalculating(root);
     RequireArgsSE(args, 2, 3);
     auto predicate = args[0]->Calculate();
@@ -583,8 +1087,7 @@ Object* IfFunc::operator()(Object* root) {
     if (!f) {
         throw RuntimeError("if should have boolean");
     }
-    return predicate->ToString() == "#t" ? args[1]->Calculate()
-                                         : (args.size() == 2 ? nullptr : args[2]->Calculate());
+    return predicate->ToString() == "#t" ? args[1] : (args.size() == 2 ? nullptr : args[2]);
 }
 
 Object* IfFunc::DeepCopy() {
@@ -608,8 +1111,9 @@ Object* Define::DefineLambda(Object* root) {
         throw SyntaxError("Lambda should return something");
     }
     auto lambda = GetInstance<Heap>().Make<Lambda>(variables, As<Cell>(root)->GetSecond(), scope_);
+    As<Lambda>(lambda)->SetName(GetInstance<Profiler>().Intern(name->ToString()));
 
-    As<Scope>(scope_)->Add(name->ToString(), lambda);
+    As<Scope>(scope_)->Define(name->ToString(), lambda);
 
     return name;
 }
@@ -634,13 +1138,46 @@ Object* LambdaDefinition::DeepCopy() {
 }
 
 Object* Lambda::operator()(Object* root) {
-    auto local_scope = GetInstance<Heap>().Make<Scope>(scope_);
-    auto new_body = body_->DeepCopy();
+    return Apply(GetArgs(root));
+}
 
-    auto args = GetArgs(root);
+Object* Lambda::Apply(const std::vector<Object*>& args) {
+    if (Tracer::IsActive()) [[unlikely]] {
+        TracedCall traced(name_);
+        if (Profiler::IsActive()) {
+            ProfiledCall call(this);
+            return Run(args);
+        }
+        return Run(args);
+    }
+    if (Profiler::IsActive()) [[unlikely]] {
+        ProfiledCall call(this);
+        return Run(args);
+    }
+    return Run(args);
+}
+
+Object* Lambda::Run(const std::vector<Object*>& args) {
     RequireArgsRE(args, local_variables_.size(), local_variables_.size());
+    if (IsJitEnabled()) {
+        if (jit_ == nullptr) {
+            jit_ = std::make_shared<JitState>();
+        }
+        if (auto result = jit_->Run(this, args)) {
+            return result;
+        }
+    }
+    if (may_capture_) {
+        return Call(As<Scope>(GetInstance<Heap>().Make<Scope>(scope_)), args);
+    }
+    PooledFrame frame(scope_);
+    return Call(frame.Get(), args);
+}
+
+Object* Lambda::Call(Scope* local_scope, const std::vector<Object*>& args) {
+    auto new_body = body_->DeepCopy();
     for (size_t i = 0; i < args.size(); ++i) {
-        As<Scope>(local_scope)->Add(local_variables_[i]->ToString(), args[i]);
+        local_scope->Add(local_variables_[i]->ToString(), args[i]);
     }
 
     new_body->AddScope(local_scope);
@@ -650,8 +1187,31 @@ Object* Lambda::operator()(Object* root) {
     return return_values.back();
 }
 
+const std::vector<Object*>& Lambda::GetParams() const {
+    return local_variables_;
+}
+
+Object* Lambda::GetBody() const {
+    return body_;
+}
+
+bool Lambda::MayCaptureFrame() const {
+    return may_capture_;
+}
+
+uint32_t Lambda::GetName() const {
+    return name_;
+}
+
+void Lambda::SetName(uint32_t name) {
+    name_ = name;
+}
+
 Object* Lambda::DeepCopy() {
-    return GetInstance<Heap>().Make<Lambda>(local_variables_, body_, scope_);
+    auto copy = GetInstance<Heap>().Make<Lambda>(local_variables_, body_, scope_, may_capture_);
+    As<Lambda>(copy)->jit_ = jit_;
+    As<Lambda>(copy)->name_ = name_;
+    return copy;
 }
 
 void Lambda::AddScope([[maybe_unused]] Object* scope) {
@@ -692,3 +1252,35 @@ Object* SetCdr::operator()(Object* root) {
 Object* SetCdr::DeepCopy() {
     return GetInstance<Heap>().Make<SetCdr>();
 }
+
+Object* GcStats::operator()(Object* root) {
+    ThrowScope();
+    auto args = GetArgs(root);
+    RequireArgsRE(args, 0, 0);
+
+    auto stats = GetInstance<Heap>().GetStats();
+    auto microseconds = [](std::chrono::nanoseconds time) {
+        return std::chrono::duration_cast<std::chrono::microseconds>(time).count();
+    };
+    std::vector<std::pair<const char*, int64_t>> counters = {
+        {"allocations", stats.allocations},
+        {"bytes", stats.bytes},
+        {"collections", stats.collections},
+        {"freed", stats.freed},
+        {"live", stats.live},
+        {"live-after-gc", stats.live_after_gc},
+        {"pause-total-us", microseconds(stats.total_pause)},
+        {"pause-max-us", microseconds(stats.max_pause)},
+    };
+    auto& heap = GetInstance<Heap>();
+    Object* result = nullptr;
+    for (auto it = counters.rbegin(); it != counters.rend(); ++it) {
+        auto pair = heap.Make<Cell>(heap.Make<Symbol>(it->first), heap.Make<Number>(it->second));
+        result = heap.Make<Cell>(pair, result);
+    }
+    return result;
+}
+
+Object* GcStats::DeepCopy() {
+    return GetInstance<Heap>().Make<GcStats>();
+}
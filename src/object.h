@@ -1,6 +1,7 @@
 #pragma once
 
 #include <algorithm>
+#include <compare>
 #include <cstddef>
 #include <cstdint>
 #include <functional>
@@ -13,6 +14,7 @@
 #include <unordered_set>
 #include <utility>
 #include <vector>
+#include "bigint.h"
 #include "error.h"
 #include "classes.h"
 #include "heap.h"
@@ -30,6 +32,10 @@ public:
 
     virtual Object* operator()(Object* root);
 
+    // Calls the object with already evaluated arguments, e.g. from a native higher-order
+    // function. By default the values are passed to operator() wrapped into Quoted nodes.
+    virtual Object* Apply(const std::vector<Object*>& args);
+
     virtual void AddScope(Object* scope);
 
     void ThrowScope();
@@ -40,6 +46,9 @@ protected:
     Object* scope_;
     std::set<Object*> neighbours_;
     bool is_achivable_ = true;
+#ifdef SCHEME_TRACK_ALLOC_SITES
+    uint32_t alloc_site_ = 0;
+#endif
 
     void AddDependency(Object* other);
 
@@ -70,21 +79,75 @@ protected:
     friend Heap;
 };
 
+class BigNumber : public Object {
+public:
+    const BigInt& GetValue() const;
+
+    virtual std::string ToString() override;
+
+    virtual Object* DeepCopy() override;
+
+    virtual Object* Calculate() override;
+
+protected:
+    BigInt value_;
+
+    explicit BigNumber(BigInt value);
+
+    friend Heap;
+};
+
+class Float : public Object {
+public:
+    double GetValue() const;
+
+    virtual std::string ToString() override;
+
+    virtual Object* DeepCopy() override;
+
+    virtual Object* Calculate() override;
+
+protected:
+    double value_;
+
+    explicit Float(double value);
+
+    friend Heap;
+};
+
+struct Binding {
+    Object* value = nullptr;
+    // Bumped on every rebinding, for anyone caching the value itself.
+    uint64_t version = 0;
+};
+
+// Inline cache of a variable reference: the global binding it resolved to, valid while no
+// local scope has gained a name through define since (see Scope::GetShadowEpoch).
+struct LookupCache {
+    Binding* binding = nullptr;
+    uint64_t epoch = 0;
+};
+
 class Symbol : public Object {
 public:
     const std::string& GetName() const;
 
     virtual std::string ToString() override;
 
+    // Copies of a reference share its lookup cache, so the cache survives the body copy
+    // made by every lambda call.
     virtual Object* DeepCopy() override;
 
     virtual Object* Calculate() override;
 
 protected:
     std::string str_;
+    std::shared_ptr<LookupCache> cache_;
 
     explicit Symbol(std::string str);
 
+    Symbol(std::string str, std::shared_ptr<LookupCache> cache);
+
     explicit Symbol(const char* str);
 
     explicit Symbol(bool boolean);
@@ -107,12 +170,22 @@ private:
     Object* first_;
     Object* second_;
 
-    friend class SetCar;
-    friend class SetCdr;
+    // Scratch state of the printer's cycle detection, valid while print_epoch_ is current.
+    uint64_t print_epoch_ = 0;
+    int64_t print_label_ = 0;
+    bool print_on_stack_ = false;
+    bool print_referenced_ = false;
+#ifdef SCHEME_TRACK_ALLOC_SITES
+    // Allocation site of the call, kept by copies of the cell.
+    uint32_t site_ = 0;
 
-    friend Object* Read(Tokenizer* tokenizer);
+    friend uint32_t TagAllocationSites(Object* form);
+    friend void InheritAllocationSites(Object* form, uint32_t site);
+#endif
 
-    friend Object* ReadList(Tokenizer* tokenizer);
+    friend class SetCar;
+    friend class SetCdr;
+    friend class Printer;
 
     Cell() = default;
 
@@ -121,6 +194,52 @@ private:
     friend Heap;
 };
 
+// Expression node that evaluates to a fixed value without looking at it.
+class Quoted : public Object {
+public:
+    Object* GetValue() const;
+
+    virtual Object* Calculate() override;
+
+private:
+    Object* value_;
+
+    explicit Quoted(Object* value);
+
+    friend Heap;
+};
+
+// Result of a speculative rewrite: evaluates fast_ while every global binding it relies on
+// still has the version the optimizer saw, and a fresh copy of original_ otherwise.
+class Guarded : public Object {
+public:
+    struct Guard {
+        Binding* binding;
+        uint64_t version;
+    };
+
+    Object* GetFast() const;
+
+    Object* GetOriginal() const;
+
+    const std::vector<Guard>& GetGuards() const;
+
+    virtual std::string ToString() override;
+
+    virtual Object* DeepCopy() override;
+
+    virtual Object* Calculate() override;
+
+private:
+    Object* fast_;
+    Object* original_;
+    std::vector<Guard> guards_;
+
+    Guarded(Object* fast, Object* original, std::vector<Guard> guards);
+
+    friend Heap;
+};
+
 class Scope : public Object {
 public:
     void Add(std::string name, Object* value);
@@ -129,17 +248,74 @@ public:
 
     Object* Get(std::string name);
 
+    // Adds a name through define. Parameters and let bindings follow the program text, but
+    // such names don't, so adding one to a local scope invalidates cached global lookups.
+    void Define(std::string name, Object* value);
+
+    // Binding of the name and whether it is in the global scope; throws NameError if unbound.
+    Binding* Lookup(const std::string& name, bool* is_global);
+
+    // Binding of the name in this very scope, nullptr if there is none.
+    Binding* Find(const std::string& name);
+
+    bool IsGlobal() const;
+
+    Object* GetParent() const;
+
+    // The names bound in this very scope.
+    const std::unordered_map<std::string, Binding>& GetBindings() const;
+
+    static uint64_t GetShadowEpoch();
+
     virtual Object* DeepCopy() override;
 
 private:
     Object* parent_;
-    std::unordered_map<std::string, Object*> scope_names_;
+    // Nodes of unordered_map never move, so cached Binding pointers stay valid.
+    std::unordered_map<std::string, Binding> scope_names_;
+
+    static inline uint64_t shadow_epoch_ = 1;
 
     Scope() = delete;
 
     Scope(Object* parent);
 
+    // Forgets every binding, keeping the allocated buckets for the next user.
+    void Reset(Object* parent);
+
     friend Heap;
+    friend class FramePool;
+};
+
+// Scopes that live outside the Heap and are reused. Only frames that no closure can capture
+// may come from here: a frame is wiped as soon as its owner releases it. The garbage collector
+// never sees them, which is fine because it only runs between top-level forms.
+class FramePool {
+public:
+    Scope* Acquire(Object* parent);
+
+    void Release(Scope* frame);
+
+private:
+    std::vector<std::unique_ptr<Scope>> frames_;
+    size_t used_ = 0;
+};
+
+// Takes a frame from the pool for the lifetime of the guard.
+class PooledFrame {
+public:
+    explicit PooledFrame(Object* parent);
+
+    PooledFrame(const PooledFrame& other) = delete;
+
+    PooledFrame& operator=(const PooledFrame& other) = delete;
+
+    ~PooledFrame();
+
+    Scope* Get() const;
+
+private:
+    Scope* frame_;
 };
 
 /////////////////////////////////HELPERS///////////////////////////////////////////////////
@@ -157,6 +333,24 @@ void RequireArgsSE(const std::vector<Object*>& args, size_t min_cnt, size_t max_
 
 void DfsList(Object* root, size_t& depth, bool& is_end_null);
 
+// Whether expr is a list starting with the symbol name.
+bool IsHead(Object* expr, const char* name);
+
+// Whether evaluating expr might create a closure over the current frame. Purely syntactic
+// and conservative: any lambda, define or named let counts, quoted data doesn't.
+bool MayCapture(Object* expr);
+
+#ifdef SCHEME_TRACK_ALLOC_SITES
+// Makes every call of a parsed form, outside of quoted data, the allocation site of what its
+// evaluation allocates, named after the (truncated) source text of the call. Returns the site
+// of the form itself.
+uint32_t TagAllocationSites(Object* form);
+
+// Charges the calls of form without a site, e.g. built by the optimizer, to the nearest
+// enclosing call that has one, or to site for the outermost ones.
+void InheritAllocationSites(Object* form, uint32_t site);
+#endif
+
 template <class T>
 bool IsExpectedType(const std::vector<Object*>& args) {
     for (const auto& i : args) {
@@ -174,59 +368,204 @@ void CheckExpectedType(const std::vector<Object*>& args) {
     }
 }
 
-template <class T, int64_t StartingValue, size_t MaxArgs, size_t MinArgs>
-class FoldingInt : public Object {
-public:
-    virtual Object* operator()(Object* root) override {
-        ThrowScope();
-        auto args = GetArgs(root);
-        CheckExpectedType<Number>(args);
-        RequireArgsRE(args, MinArgs, MaxArgs);
+// Everything but #f counts as true.
+bool IsTrue(Object* value);
+
+bool IsInteger(Object* obj);
+
+bool IsNumber(Object* obj);
+
+void CheckNumbers(const std::vector<Object*>& args);
+
+BigInt ToBigInt(Object* obj);
+
+double ToDouble(Object* obj);
+
+// Fixnum if the value fits into int64_t, bignum otherwise, so every integer has exactly one
+// representation.
+Object* MakeInteger(BigInt value);
 
-        int64_t result = StartingValue;
-        for (const auto& i : args) {
-            result = func_(result, As<Number>(i)->GetValue());
+// Exact comparison, also between an integer and a flonum; unordered if a NaN is involved.
+std::partial_ordering CompareNumbers(Object* lhs, Object* rhs);
+
+// Numeric operations have a fixnum form that reports overflow instead of wrapping, a bignum
+// form used once the fixnum one gave up and a flonum form used as soon as an inexact number
+// takes part.
+
+struct PlusOperation {
+    static constexpr int64_t kIdentity = 0;
+
+    static bool Apply(int64_t lhs, int64_t rhs, int64_t* result) {
+        return !__builtin_add_overflow(lhs, rhs, result);
+    }
+
+    static BigInt Apply(const BigInt& lhs, const BigInt& rhs) {
+        return lhs + rhs;
+    }
+
+    static double Apply(double lhs, double rhs) {
+        return lhs + rhs;
+    }
+};
+
+struct MinusOperation {
+    static bool Apply(int64_t lhs, int64_t rhs, int64_t* result) {
+        return !__builtin_sub_overflow(lhs, rhs, result);
+    }
+
+    static BigInt Apply(const BigInt& lhs, const BigInt& rhs) {
+        return lhs - rhs;
+    }
+
+    static double Apply(double lhs, double rhs) {
+        return lhs - rhs;
+    }
+};
+
+struct MulOperation {
+    static constexpr int64_t kIdentity = 1;
+
+    static bool Apply(int64_t lhs, int64_t rhs, int64_t* result) {
+        return !__builtin_mul_overflow(lhs, rhs, result);
+    }
+
+    static BigInt Apply(const BigInt& lhs, const BigInt& rhs) {
+        return lhs * rhs;
+    }
+
+    static double Apply(double lhs, double rhs) {
+        return lhs * rhs;
+    }
+};
+
+struct DivOperation {
+    static bool Apply(int64_t lhs, int64_t rhs, int64_t* result) {
+        if (rhs == 0) {
+            throw RuntimeError("Division by zero");
         }
+        if (lhs == std::numeric_limits<int64_t>::min() && rhs == -1) [[unlikely]] {
+            return false;
+        }
+        *result = lhs / rhs;
+        return true;
+    }
 
-        return GetInstance<Heap>().Make<Number>(result);
+    static BigInt Apply(const BigInt& lhs, const BigInt& rhs) {
+        return lhs / rhs;
     }
 
-    virtual Object* DeepCopy() override {
-        return GetInstance<Heap>().Make<FoldingInt<T, StartingValue, MaxArgs, MinArgs>>();
+    static double Apply(double lhs, double rhs) {
+        return lhs / rhs;
+    }
+};
+
+struct MinOperation {
+    static bool Apply(int64_t lhs, int64_t rhs, int64_t* result) {
+        *result = std::min(lhs, rhs);
+        return true;
+    }
+
+    static BigInt Apply(const BigInt& lhs, const BigInt& rhs) {
+        return Compare(lhs, rhs) <= 0 ? lhs : rhs;
+    }
+
+    static double Apply(double lhs, double rhs) {
+        return std::min(lhs, rhs);
+    }
+};
+
+struct MaxOperation {
+    static bool Apply(int64_t lhs, int64_t rhs, int64_t* result) {
+        *result = std::max(lhs, rhs);
+        return true;
     }
 
+    static BigInt Apply(const BigInt& lhs, const BigInt& rhs) {
+        return Compare(lhs, rhs) >= 0 ? lhs : rhs;
+    }
+
+    static double Apply(double lhs, double rhs) {
+        return std::max(lhs, rhs);
+    }
+};
+
+// Left fold over numbers that keeps the intermediate result unboxed. It stays on int64_t while
+// the operation doesn't overflow, switches to BigInt the first time it does (or a bignum shows
+// up) and to double once a flonum takes part; only the final result is allocated.
+class NumberAccumulator {
+public:
+    explicit NumberAccumulator(Object* value);
+
+    template <class Operation>
+    void Apply(Object* value) {
+        if (kind_ == Kind::FIXNUM) [[likely]] {
+            auto number = As<Number>(value);
+            int64_t result;
+            if (number != nullptr && Operation::Apply(fixnum_, number->GetValue(), &result))
+                [[likely]] {
+                fixnum_ = result;
+                return;
+            }
+        } else if (kind_ == Kind::FLONUM) {
+            flonum_ = Operation::Apply(flonum_, ToDouble(value));
+            return;
+        }
+
+        if (Is<Float>(value)) {
+            flonum_ = Operation::Apply(GetDouble(), As<Float>(value)->GetValue());
+            kind_ = Kind::FLONUM;
+            return;
+        }
+        if (kind_ == Kind::FIXNUM) {
+            bignum_ = BigInt(fixnum_);
+            kind_ = Kind::BIGNUM;
+        }
+        bignum_ = Operation::Apply(bignum_, ToBigInt(value));
+    }
+
+    Object* MakeObject();
+
 private:
-    T func_;
+    enum class Kind { FIXNUM, BIGNUM, FLONUM };
 
-    FoldingInt() = default;
+    Kind kind_ = Kind::FIXNUM;
+    int64_t fixnum_ = 0;
+    BigInt bignum_;
+    double flonum_ = 0;
 
-    friend Heap;
+    double GetDouble() const;
 };
 
-template <class T, int64_t StartingValue, size_t MaxArgs>
-class FoldingInt<T, StartingValue, MaxArgs, 2> : public Object {
+template <class Operation, size_t MinArgs>
+class FoldingInt : public Object {
 public:
     virtual Object* operator()(Object* root) override {
         ThrowScope();
-        auto args = GetArgs(root);
-        CheckExpectedType<Number>(args);
-        RequireArgsRE(args, 2, std::numeric_limits<size_t>::max());
+        return Apply(GetArgs(root));
+    }
+
+    virtual Object* Apply(const std::vector<Object*>& args) override {
+        CheckNumbers(args);
+        RequireArgsRE(args, MinArgs, std::numeric_limits<size_t>::max());
 
-        int64_t result = func_(As<Number>(args[0])->GetValue(), As<Number>(args[1])->GetValue());
-        for (size_t i = 2; i < args.size(); ++i) {
-            result = func_(result, As<Number>(args[i])->GetValue());
+        if constexpr (MinArgs == 0) {
+            if (args.empty()) {
+                return GetInstance<Heap>().Make<Number>(Operation::kIdentity);
+            }
+        }
+        NumberAccumulator result(args[0]);
+        for (size_t i = 1; i < args.size(); ++i) {
+            result.Apply<Operation>(args[i]);
         }
 
-        return GetInstance<Heap>().Make<Number>(result);
+        return result.MakeObject();
     }
 
     virtual Object* DeepCopy() override {
-        return GetInstance<Heap>().Make<FoldingInt<T, StartingValue, MaxArgs, 2>>();
+        return GetInstance<Heap>().Make<FoldingInt<Operation, MinArgs>>();
     }
 
 private:
-    T func_;
-
     FoldingInt() = default;
 
     friend Heap;
@@ -237,12 +576,26 @@ class FoldingBoolean : public Object {
 public:
     virtual Object* operator()(Object* root) override {
         ThrowScope();
-        auto args = GetArgs(root);
-        CheckExpectedType<Number>(args);
+        return Apply(GetArgs(root));
+    }
+
+    virtual Object* Apply(const std::vector<Object*>& args) override {
+        CheckNumbers(args);
 
         bool result = true;
         for (size_t i = 1; i < args.size(); ++i) {
-            result &= func_(As<Number>(args[i - 1])->GetValue(), As<Number>(args[i])->GetValue());
+            auto lhs = As<Number>(args[i - 1]);
+            auto rhs = As<Number>(args[i]);
+            if (lhs != nullptr && rhs != nullptr) [[likely]] {
+                result &= func_(lhs->GetValue(), rhs->GetValue());
+                continue;
+            }
+            auto order = CompareNumbers(args[i - 1], args[i]);
+            if (order == std::partial_ordering::unordered) {
+                result = false;
+            } else {
+                result &= func_(order < 0 ? -1 : (order > 0 ? 1 : 0), 0);
+            }
         }
 
         return GetInstance<Heap>().Make<Symbol>(result);
@@ -340,31 +693,36 @@ using Equal = FoldingBoolean<std::equal_to<int64_t>>;
 using LessOrEqual = FoldingBoolean<std::less_equal<int64_t>>;
 using Less = FoldingBoolean<std::less<int64_t>>;
 
-using Plus = FoldingInt<std::plus<int64_t>, 0, std::numeric_limits<size_t>::max(), 0>;
-using Minus = FoldingInt<std::minus<int64_t>, 0, std::numeric_limits<size_t>::max(), 2>;
-using Mul = FoldingInt<std::multiplies<int64_t>, 1, std::numeric_limits<size_t>::max(), 0>;
-using Div = FoldingInt<std::divides<int64_t>, 0, std::numeric_limits<size_t>::max(), 2>;
+using Plus = FoldingInt<PlusOperation, 0>;
+using Minus = FoldingInt<MinusOperation, 2>;
+using Mul = FoldingInt<MulOperation, 0>;
+using Div = FoldingInt<DivOperation, 2>;
+using Min = FoldingInt<MinOperation, 1>;
+using Max = FoldingInt<MaxOperation, 1>;
 
-class SpecialMin {
+class ExactToInexact : public Object {
 public:
-    int64_t operator()(int64_t lhs, int64_t rhs);
-};
+    virtual Object* operator()(Object* root) override;
 
-class SpecialMax {
-public:
-    int64_t operator()(int64_t lhs, int64_t rhs);
+    virtual Object* DeepCopy() override;
+
+private:
+    friend Heap;
+
+    ExactToInexact() = default;
 };
 
-class SpecialAbs {
+class Abs : public Object {
 public:
-    int64_t operator()(int64_t lhs, int64_t rhs);
-};
+    virtual Object* operator()(Object* root) override;
+
+    virtual Object* DeepCopy() override;
 
-using Min = FoldingInt<SpecialMin, std::numeric_limits<int64_t>::max(),
-                       std::numeric_limits<size_t>::max(), 1>;
-using Max = FoldingInt<SpecialMax, std::numeric_limits<int64_t>::min(),
-                       std::numeric_limits<size_t>::max(), 1>;
-using Abs = FoldingInt<SpecialAbs, 0, 1, 1>;
+private:
+    friend Heap;
+
+    Abs() = default;
+};
 
 class PairPredicate : public Object {
 public:
@@ -517,6 +875,9 @@ class IfFunc : public Object {
 public:
     virtual Object* operator()(Object* root) override;
 
+    // Evaluates the condition and returns the branch to take, without evaluating it.
+    Object* SelectBranch(Object* root);
+
     virtual Object* DeepCopy() override;
 
 private:
@@ -537,22 +898,50 @@ private:
     LambdaDefinition() = default;
 };
 
+class JitState;
+
 class Lambda : public Object {
 public:
     virtual void AddScope(Object* scope) override;
 
     virtual Object* operator()(Object* root) override;
 
+    virtual Object* Apply(const std::vector<Object*>& args) override;
+
     virtual Object* DeepCopy() override;
 
+    const std::vector<Object*>& GetParams() const;
+
+    // The list of body forms, never evaluated in place.
+    Object* GetBody() const;
+
+    bool MayCaptureFrame() const;
+
+    // Profiler name id of the define that bound the lambda, kAnonymous before that.
+    uint32_t GetName() const;
+
+    void SetName(uint32_t name);
+
+    static constexpr uint32_t kAnonymous = 0;
+
 private:
     std::vector<Object*> local_variables_;
     Object* body_;
+    // Escape analysis result: if false, no closure can outlive a call, so calls take their
+    // frame from the FramePool instead of the heap.
+    bool may_capture_;
+    // Machine code of the body, shared by the copies of the lambda; see jit.h.
+    std::shared_ptr<JitState> jit_;
+    uint32_t name_ = kAnonymous;
 
     friend Heap;
 
     Lambda(std::vector<Object*> local_variables, Object* body, Object* scope)
-        : local_variables_(local_variables), body_(body) {
+        : Lambda(std::move(local_variables), body, scope, MayCapture(body)) {
+    }
+
+    Lambda(std::vector<Object*> local_variables, Object* body, Object* scope, bool may_capture)
+        : local_variables_(std::move(local_variables)), body_(body), may_capture_(may_capture) {
         scope_ = scope;
         AddDependency(scope_);
         AddDependency(body_);
@@ -560,6 +949,10 @@ private:
             AddDependency(i);
         }
     }
+
+    Object* Run(const std::vector<Object*>& args);
+
+    Object* Call(Scope* local_scope, const std::vector<Object*>& args);
 };
 
 class SetCar : public Object {
@@ -586,4 +979,17 @@ private:
     SetCdr() = default;
 };
 
+// (gc-stats): the counters of the heap as an association list, e.g. ((allocations . 1234) ...).
+class GcStats : public Object {
+public:
+    virtual Object* operator()(Object* root) override;
+
+    virtual Object* DeepCopy() override;
+
+private:
+    friend Heap;
+
+    GcStats() = default;
+};
+
 ///////////////////////////////////////////////////////////////////////////////
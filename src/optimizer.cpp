@@ -0,0 +1,465 @@
+#include "optimizer.h"
+#include <cstddef>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "classes.h"
+#include "feedback.h"
+#include "heap.h"
+#include "let.h"
+#include "object.h"
+
+namespace {
+
+bool IsPure(Object* function) {
+    return Is<Plus>(function) || Is<Minus>(function) || Is<Mul>(function) || Is<Div>(function) ||
+           Is<Min>(function) || Is<Max>(function) || Is<Abs>(function) ||
+           Is<ExactToInexact>(function) || Is<Less>(function) || Is<Greate>(function) ||
+           Is<Equal>(function) || Is<LessOrEqual>(function) || Is<GreateOrEqual>(function) ||
+           Is<NotFunction>(function) || Is<IntegerPredicate>(function) ||
+           Is<BooleanPredicate>(function);
+}
+
+// Immutable results, which can be shared by every evaluation of the folded call.
+bool IsAtom(Object* value) {
+    return Is<Number>(value) || Is<BigNumber>(value) || Is<Float>(value) || Is<Symbol>(value);
+}
+
+bool IsFalse(Object* value) {
+    return Is<Symbol>(value) && As<Symbol>(value)->GetName() == "#f";
+}
+
+bool ToVector(Object* list, std::vector<Object*>* items) {
+    items->clear();
+    for (; Is<Cell>(list); list = As<Cell>(list)->GetSecond()) {
+        items->push_back(As<Cell>(list)->GetFirst());
+    }
+    return list == nullptr;
+}
+
+// The list with the given items, reusing original if none of them changed.
+Object* FromVector(Object* original, const std::vector<Object*>& items) {
+    auto node = original;
+    bool is_same = true;
+    for (auto item : items) {
+        if (!Is<Cell>(node) || As<Cell>(node)->GetFirst() != item) {
+            is_same = false;
+            break;
+        }
+        node = As<Cell>(node)->GetSecond();
+    }
+    if (is_same && node == nullptr) {
+        return original;
+    }
+    auto& heap = GetInstance<Heap>();
+    Object* list = nullptr;
+    for (auto it = items.rbegin(); it != items.rend(); ++it) {
+        list = heap.Make<Cell>(*it, list);
+    }
+    return list;
+}
+
+// Nodes of expr, counted up to just past limit.
+size_t CountNodes(Object* expr, size_t limit) {
+    std::vector<Object*> stack = {expr};
+    size_t count = 0;
+    while (!stack.empty() && count <= limit) {
+        auto node = stack.back();
+        stack.pop_back();
+        if (node == nullptr) {
+            continue;
+        }
+        ++count;
+        if (auto cell = As<Cell>(node)) {
+            stack.push_back(cell->GetFirst());
+            stack.push_back(cell->GetSecond());
+        } else if (auto guarded = As<Guarded>(node)) {
+            stack.push_back(guarded->GetFast());
+            stack.push_back(guarded->GetOriginal());
+        } else if (auto site = As<ArithmeticSite>(node)) {
+            stack.push_back(site->GetCall());
+        }
+    }
+    return count;
+}
+
+// Names of the symbols in expr, quoted data aside.
+void CollectSymbols(Object* expr, std::vector<std::string>* names) {
+    std::vector<Object*> stack = {expr};
+    while (!stack.empty()) {
+        auto node = stack.back();
+        stack.pop_back();
+        if (auto symbol = As<Symbol>(node)) {
+            names->push_back(symbol->GetName());
+        } else if (auto guarded = As<Guarded>(node)) {
+            stack.push_back(guarded->GetFast());
+            stack.push_back(guarded->GetOriginal());
+        } else if (auto site = As<ArithmeticSite>(node)) {
+            stack.push_back(site->GetCall());
+        } else if (Is<Cell>(node) && !IsHead(node, "quote")) {
+            stack.push_back(As<Cell>(node)->GetFirst());
+            stack.push_back(As<Cell>(node)->GetSecond());
+        }
+    }
+}
+
+// Fresh copy of expr with the given symbols renamed.
+Object* Rename(Object* expr, const std::unordered_map<std::string, std::string>& names) {
+    auto& heap = GetInstance<Heap>();
+    if (auto symbol = As<Symbol>(expr)) {
+        auto it = names.find(symbol->GetName());
+        return it != names.end() ? heap.Make<Symbol>(it->second) : symbol->DeepCopy();
+    }
+    if (auto guarded = As<Guarded>(expr)) {
+        return heap.Make<Guarded>(Rename(guarded->GetFast(), names),
+                                  Rename(guarded->GetOriginal(), names), guarded->GetGuards());
+    }
+    if (auto site = As<ArithmeticSite>(expr)) {
+        return site->WithCall(Rename(site->GetCall(), names));
+    }
+    if (!Is<Cell>(expr) || IsHead(expr, "quote")) {
+        return expr != nullptr ? expr->DeepCopy() : nullptr;
+    }
+    std::vector<Object*> items;
+    auto node = expr;
+    for (; Is<Cell>(node); node = As<Cell>(node)->GetSecond()) {
+        items.push_back(Rename(As<Cell>(node)->GetFirst(), names));
+    }
+    auto list = Rename(node, names);
+    for (auto it = items.rbegin(); it != items.rend(); ++it) {
+        list = heap.Make<Cell>(*it, list);
+    }
+    return list;
+}
+
+void AddGuards(std::vector<Guarded::Guard>* guards, const std::vector<Guarded::Guard>& other) {
+    guards->insert(guards->end(), other.begin(), other.end());
+}
+
+}  // namespace
+
+Optimizer::Optimizer(Scope* global) : global_(global) {
+}
+
+Object* Optimizer::Optimize(Object* ast, OptimizeStats* stats) {
+    *stats = OptimizeStats();
+    stats_ = stats;
+    locals_.clear();
+    Value value;
+    return Walk(ast, &value);
+}
+
+Binding* Optimizer::FindGlobal(Object* expr) {
+    auto symbol = As<Symbol>(expr);
+    if (symbol == nullptr) {
+        return nullptr;
+    }
+    for (const auto& name : locals_) {
+        if (name == symbol->GetName()) {
+            return nullptr;
+        }
+    }
+    return global_->Find(symbol->GetName());
+}
+
+void Optimizer::PushNames(Object* list) {
+    for (; Is<Cell>(list); list = As<Cell>(list)->GetSecond()) {
+        if (auto symbol = As<Symbol>(As<Cell>(list)->GetFirst())) {
+            locals_.push_back(symbol->GetName());
+        }
+    }
+    if (auto symbol = As<Symbol>(list)) {
+        locals_.push_back(symbol->GetName());
+    }
+}
+
+Object* Optimizer::Walk(Object* expr, Value* value) {
+    *value = Value();
+    if (Is<Number>(expr) || Is<BigNumber>(expr) || Is<Float>(expr)) {
+        value->is_constant = true;
+        value->constant = expr;
+        return expr;
+    }
+    if (Is<Symbol>(expr)) {
+        auto binding = FindGlobal(expr);
+        if (binding != nullptr && Is<Symbol>(binding->value)) {
+            auto name = As<Symbol>(binding->value)->GetName();
+            if (name == "#t" || name == "#f") {
+                value->is_constant = true;
+                value->constant = binding->value;
+                value->guards.push_back({binding, binding->version});
+            }
+        }
+        return expr;
+    }
+
+    std::vector<Object*> items;
+    if (!Is<Cell>(expr) || !ToVector(expr, &items)) {
+        return expr;
+    }
+    auto binding = FindGlobal(items[0]);
+    auto function = binding != nullptr ? binding->value : nullptr;
+    if (Is<QuoteFunction>(function) || items.size() < 2) {
+        return expr;
+    }
+
+    auto mark = locals_.size();
+    if (Is<LambdaDefinition>(function) || (Is<Define>(function) && Is<Cell>(items[1]))) {
+        // (lambda (params...) body...) or (define (name params...) body...)
+        PushNames(Is<Define>(function) ? As<Cell>(items[1])->GetSecond() : items[1]);
+        WalkBody(&items, 2);
+        locals_.resize(mark);
+        return FromVector(expr, items);
+    }
+    if (Is<Let>(function) || Is<LetStar>(function) || Is<Letrec>(function) ||
+        Is<DoLoop>(function)) {
+        WalkLet(&items, function);
+        locals_.resize(mark);
+        return FromVector(expr, items);
+    }
+
+    // The name of define and set! is not an expression.
+    size_t first = Is<Define>(function) || Is<SetVariable>(function) ? 2 : 0;
+    std::vector<Value> values(items.size());
+    for (size_t i = first; i < items.size(); ++i) {
+        items[i] = Walk(items[i], &values[i]);
+    }
+
+    auto lambda = As<Lambda>(function);
+    if (lambda != nullptr && CanInline(items, lambda)) {
+        return Inline(expr, items, binding, lambda);
+    }
+    if (Is<IfFunc>(function)) {
+        return PruneIf(expr, items, values, binding, value);
+    }
+    if (Is<AndFunction>(function) || Is<OrFunction>(function)) {
+        return PruneAndOr(expr, items, values, binding, Is<AndFunction>(function));
+    }
+    if (IsPure(function)) {
+        auto result = Fold(expr, items, values, binding, value);
+        if (!value->is_constant && ArithmeticSite::GetOperation(function) &&
+            items.size() >= 3 && items.size() <= ArithmeticSite::kMaxArgs + 1) {
+            ++stats_->sites;
+            return GetInstance<Heap>().Make<ArithmeticSite>(result, function);
+        }
+        return result;
+    }
+    return FromVector(expr, items);
+}
+
+void Optimizer::WalkBody(std::vector<Object*>* forms, size_t start) {
+    // Internal defines bind their name in the whole body.
+    for (size_t i = start; i < forms->size(); ++i) {
+        auto form = As<Cell>((*forms)[i]);
+        auto binding = form != nullptr ? FindGlobal(form->GetFirst()) : nullptr;
+        if (binding == nullptr || !Is<Define>(binding->value)) {
+            continue;
+        }
+        auto target = Is<Cell>(form->GetSecond()) ? As<Cell>(form->GetSecond())->GetFirst()
+                                                   : nullptr;
+        if (Is<Cell>(target)) {
+            target = As<Cell>(target)->GetFirst();
+        }
+        if (auto symbol = As<Symbol>(target)) {
+            locals_.push_back(symbol->GetName());
+        }
+    }
+    Value value;
+    for (size_t i = start; i < forms->size(); ++i) {
+        (*forms)[i] = Walk((*forms)[i], &value);
+    }
+}
+
+void Optimizer::WalkLet(std::vector<Object*>* items, Object* function) {
+    // The bound names are treated as local in the inits too, which is only conservative.
+    size_t index = 1;
+    if (Is<Let>(function) && Is<Symbol>((*items)[1])) {
+        locals_.push_back(As<Symbol>((*items)[1])->GetName());
+        index = 2;
+    }
+    std::vector<Object*> bindings;
+    if (items->size() <= index || !ToVector((*items)[index], &bindings)) {
+        return;
+    }
+    for (auto binding : bindings) {
+        if (Is<Cell>(binding) && Is<Symbol>(As<Cell>(binding)->GetFirst())) {
+            locals_.push_back(As<Symbol>(As<Cell>(binding)->GetFirst())->GetName());
+        }
+    }
+
+    Value value;
+    std::vector<Object*> parts;
+    for (auto& binding : bindings) {
+        if (!ToVector(binding, &parts)) {
+            continue;
+        }
+        for (size_t i = 1; i < parts.size(); ++i) {
+            parts[i] = Walk(parts[i], &value);
+        }
+        binding = FromVector(binding, parts);
+    }
+    (*items)[index] = FromVector((*items)[index], bindings);
+
+    size_t body = index + 1;
+    if (Is<DoLoop>(function) && items->size() > body) {
+        // (test result...) is not a call.
+        if (ToVector((*items)[body], &parts)) {
+            for (auto& part : parts) {
+                part = Walk(part, &value);
+            }
+            (*items)[body] = FromVector((*items)[body], parts);
+        }
+        ++body;
+    }
+    WalkBody(items, body);
+}
+
+Object* Optimizer::PruneIf(Object* expr, const std::vector<Object*>& items,
+                           const std::vector<Value>& values, Binding* binding, Value* value) {
+    auto rebuilt = FromVector(expr, items);
+    const auto& condition = values[1];
+    if (items.size() < 3 || items.size() > 4 || !condition.is_constant ||
+        !Is<Symbol>(condition.constant)) {
+        return rebuilt;
+    }
+    size_t taken = As<Symbol>(condition.constant)->GetName() == "#t" ? 2 : 3;
+    auto branch = taken < items.size() ? items[taken] : nullptr;
+
+    std::vector<Guarded::Guard> guards = {{binding, binding->version}};
+    AddGuards(&guards, condition.guards);
+    if (taken < items.size() && values[taken].is_constant) {
+        value->is_constant = true;
+        value->constant = values[taken].constant;
+        value->guards = guards;
+        AddGuards(&value->guards, values[taken].guards);
+    }
+    ++stats_->pruned;
+    return GetInstance<Heap>().Make<Guarded>(branch, rebuilt, std::move(guards));
+}
+
+Object* Optimizer::PruneAndOr(Object* expr, const std::vector<Object*>& items,
+                              const std::vector<Value>& values, Binding* binding,
+                              bool is_and) {
+    // and stops at the first #f and or at the first anything else; constants that don't stop
+    // the evaluation can be dropped unless they are the last argument, which gives the result.
+    std::vector<Object*> kept = {items[0]};
+    std::vector<Guarded::Guard> guards = {{binding, binding->version}};
+    bool is_changed = false;
+    for (size_t i = 1; i < items.size(); ++i) {
+        bool is_last = i + 1 == items.size();
+        if (values[i].is_constant) {
+            bool stops = IsFalse(values[i].constant) == is_and;
+            if (stops || !is_last) {
+                AddGuards(&guards, values[i].guards);
+            }
+            if (stops) {
+                kept.push_back(items[i]);
+                is_changed |= !is_last;
+                break;
+            }
+            if (!is_last) {
+                is_changed = true;
+                continue;
+            }
+        }
+        kept.push_back(items[i]);
+    }
+
+    auto rebuilt = FromVector(expr, items);
+    if (!is_changed) {
+        return rebuilt;
+    }
+    ++stats_->pruned;
+    // (and x) and (or x) are just x.
+    auto fast = kept.size() == 2 ? kept[1] : FromVector(nullptr, kept);
+    return GetInstance<Heap>().Make<Guarded>(fast, rebuilt, std::move(guards));
+}
+
+Object* Optimizer::Fold(Object* expr, const std::vector<Object*>& items,
+                        const std::vector<Value>& values, Binding* binding, Value* value) {
+    auto rebuilt = FromVector(expr, items);
+    std::vector<Object*> args;
+    std::vector<Guarded::Guard> guards = {{binding, binding->version}};
+    for (size_t i = 1; i < items.size(); ++i) {
+        if (!values[i].is_constant) {
+            return rebuilt;
+        }
+        args.push_back(values[i].constant);
+        AddGuards(&guards, values[i].guards);
+    }
+
+    Object* result;
+    try {
+        result = binding->value->Apply(args);
+    } catch (const std::runtime_error&) {
+        return rebuilt;  // the error belongs to the evaluation, if it ever happens
+    }
+    if (!IsAtom(result)) {
+        return rebuilt;
+    }
+
+    value->is_constant = true;
+    value->constant = result;
+    value->guards = guards;
+    ++stats_->folded;
+    auto& heap = GetInstance<Heap>();
+    return heap.Make<Guarded>(heap.Make<Quoted>(result), rebuilt, std::move(guards));
+}
+
+bool Optimizer::CanInline(const std::vector<Object*>& items, Lambda* lambda) {
+    // Free names of the body must mean the same at the call site as where the lambda was
+    // defined, so only lambdas closed over the global scope qualify, and only where none of
+    // their free names is shadowed. A body that can create closures is left alone too.
+    const auto& params = lambda->GetParams();
+    if (lambda->GetScope() != global_ || lambda->MayCaptureFrame() ||
+        params.size() + 1 != items.size() ||
+        CountNodes(lambda->GetBody(), kInlineBudget) > kInlineBudget) {
+        return false;
+    }
+
+    std::vector<std::string> names;
+    CollectSymbols(lambda->GetBody(), &names);
+    auto callee = As<Symbol>(items[0])->GetName();
+    for (const auto& name : names) {
+        if (name == callee) {
+            return false;  // recursive
+        }
+        bool is_param = false;
+        for (auto param : params) {
+            is_param |= param->ToString() == name;
+        }
+        if (!is_param) {
+            for (const auto& local : locals_) {
+                if (local == name) {
+                    return false;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+Object* Optimizer::Inline(Object* expr, const std::vector<Object*>& items, Binding* binding,
+                          Lambda* lambda) {
+    auto& heap = GetInstance<Heap>();
+    std::unordered_map<std::string, std::string> names;
+    std::vector<Object*> bindings;
+    const auto& params = lambda->GetParams();
+    for (size_t i = 0; i < params.size(); ++i) {
+        // % can't appear in a symbol read from the source, so the new names are fresh.
+        auto name = params[i]->ToString() + "%" + std::to_string(++renamed_);
+        names[params[i]->ToString()] = name;
+        bindings.push_back(heap.Make<Cell>(heap.Make<Symbol>(name),
+                                           heap.Make<Cell>(items[i + 1], nullptr)));
+    }
+
+    // The let builtin itself is the operator, so the expansion doesn't depend on the name.
+    auto body = Rename(lambda->GetBody(), names);
+    auto let = heap.Make<Quoted>(heap.Make<Let>());
+    auto fast = heap.Make<Cell>(let, heap.Make<Cell>(FromVector(nullptr, bindings), body));
+
+    ++stats_->inlined;
+    return heap.Make<Guarded>(fast, FromVector(expr, items),
+                              std::vector<Guarded::Guard>{{binding, binding->version}});
+}
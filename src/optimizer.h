@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+#include "classes.h"
+#include "heap.h"
+#include "object.h"
+
+struct OptimizeStats {
+    // Calls of pure builtins replaced by their constant result.
+    size_t folded = 0;
+    // if/and/or forms simplified because of constant conditions.
+    size_t pruned = 0;
+    // Calls of small global lambdas replaced by their body.
+    size_t inlined = 0;
+    // Arithmetic and comparison calls turned into self-specializing ArithmeticSite nodes.
+    size_t sites = 0;
+};
+
+// Rewrites a freshly read top-level form before it is evaluated. Calls of pure builtins with
+// constant arguments are folded and if/and/or with constant conditions are pruned. Every
+// rewrite is wrapped into a Guarded node on the global bindings it assumed (the builtin, if,
+// #t...), so rebinding any of them later falls back to the original expression. Names bound
+// by lambda, define, the let forms and do are tracked, and a locally bound name is never
+// treated as the global one.
+//
+// Calls of small global lambdas are inlined as (let ((param' arg) ...) body') with the
+// parameters renamed, guarded on the binding of the lambda. Remaining calls of arithmetic and
+// comparison builtins become ArithmeticSite nodes that specialize on the argument types.
+class Optimizer {
+public:
+    // Largest body, in nodes, that gets inlined.
+    static constexpr size_t kInlineBudget = 32;
+
+    explicit Optimizer(Scope* global);
+
+    Object* Optimize(Object* ast, OptimizeStats* stats);
+
+private:
+    // What is known about an optimized expression.
+    struct Value {
+        bool is_constant = false;
+        Object* constant = nullptr;
+        std::vector<Guarded::Guard> guards;
+    };
+
+    Scope* global_;
+    std::vector<std::string> locals_;
+    OptimizeStats* stats_ = nullptr;
+    size_t renamed_ = 0;
+
+    Object* Walk(Object* expr, Value* value);
+
+    void WalkBody(std::vector<Object*>* forms, size_t start);
+
+    void WalkLet(std::vector<Object*>* items, Object* function);
+
+    Object* PruneIf(Object* expr, const std::vector<Object*>& items,
+                    const std::vector<Value>& values, Binding* binding, Value* value);
+
+    Object* PruneAndOr(Object* expr, const std::vector<Object*>& items,
+                       const std::vector<Value>& values, Binding* binding, bool is_and);
+
+    Object* Fold(Object* expr, const std::vector<Object*>& items, const std::vector<Value>& values,
+                 Binding* binding, Value* value);
+
+    Object* Inline(Object* expr, const std::vector<Object*>& items, Binding* binding,
+                   Lambda* lambda);
+
+    bool CanInline(const std::vector<Object*>& items, Lambda* lambda);
+
+    // Global binding of a symbol that no local binding shadows here, nullptr otherwise.
+    Binding* FindGlobal(Object* expr);
+
+    // Marks the symbols of a parameter list as local.
+    void PushNames(Object* list);
+};
@@ -1,81 +1,220 @@
 #include "parser.h"
 #include "tokenizer.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
 #include <variant>
+#include <vector>
 #include "classes.h"
 #include "error.h"
 #include "heap.h"
 #include "object.h"
 
-Object* Read(Tokenizer* tokenizer) {
-    auto token = tokenizer->GetToken();
-    CheckEnd(tokenizer);
-    tokenizer->Next();
-    if (BracketToken* bracket = std::get_if<BracketToken>(&token)) {
-        if (*bracket == BracketToken::CLOSE) {
-            throw SyntaxError("Closed bracket before open");
+namespace {
+
+// The reader runs in two phases. Parsing records the datum as a post-order tape without
+// touching the heap; once the datum is complete the tape is replayed bottom-up, so every
+// object of the datum is allocated in one batch and a syntax error allocates nothing.
+
+enum class OpKind { NUMBER, BIG_NUMBER, FLOAT, SYMBOL, QUOTE, LIST, DOTTED_LIST };
+
+struct Op {
+    OpKind kind;
+    int64_t number = 0;
+    std::string_view name = {};
+    size_t count = 0;
+    double flonum = 0;
+};
+
+enum class FrameKind { LIST, QUOTE };
+
+enum class ListState { ITEMS, AFTER_DOT, AFTER_TAIL };
+
+struct Frame {
+    FrameKind kind;
+    ListState state = ListState::ITEMS;
+    size_t count = 0;
+};
+
+struct ReaderState {
+    std::vector<Op> tape;
+    std::vector<Frame> frames;
+    std::vector<Object*> values;
+};
+
+ReaderState& GetReaderState() {
+    thread_local ReaderState state;
+    return state;
+}
+
+void PushList(ReaderState* state, ReadStats* stats, size_t* depth) {
+    state->frames.push_back({.kind = FrameKind::LIST});
+    ++*depth;
+    stats->max_depth = std::max(stats->max_depth, *depth);
+}
+
+// Hands a finished value to the innermost open frame; returns true when the datum is done.
+bool Complete(ReaderState* state, ReadStats* stats) {
+    while (!state->frames.empty()) {
+        auto& frame = state->frames.back();
+        if (frame.kind == FrameKind::QUOTE) {
+            state->tape.push_back({.kind = OpKind::QUOTE});
+            stats->cells += 2;
+            ++stats->atoms;
+            state->frames.pop_back();
+            continue;
         }
-        return ReadList(tokenizer);
+        if (frame.state == ListState::AFTER_DOT) {
+            frame.state = ListState::AFTER_TAIL;
+        } else {
+            ++frame.count;
+        }
+        return false;
     }
-    if (ConstantToken* number = std::get_if<ConstantToken>(&token)) {
-        return GetInstance<Heap>().Make<Number>(number->value);
-    } else if (SymbolToken* symbol = std::get_if<SymbolToken>(&token)) {
-        return GetInstance<Heap>().Make<Symbol>(symbol->name);
-    } else if ([[maybe_unused]] QuoteToken* quote = std::get_if<QuoteToken>(&token)) {
-        auto argument = Read(tokenizer);
-        auto second_cell = GetInstance<Heap>().Make<Cell>(argument, nullptr);
-        return GetInstance<Heap>().Make<Cell>(GetInstance<Heap>().Make<Symbol>("quote"),
-                                              second_cell);
+    return true;
+}
+
+Object* Materialize(ReaderState* state, const ReadStats& stats, Heap* heap) {
+    auto& values = state->values;
+    heap->Reserve(stats.cells + stats.atoms);
+    values.clear();
+
+    for (const auto& op : state->tape) {
+        switch (op.kind) {
+            case OpKind::NUMBER:
+                values.push_back(heap->Make<Number>(op.number));
+                break;
+            case OpKind::BIG_NUMBER:
+                values.push_back(heap->Make<BigNumber>(BigInt::FromString(op.name)));
+                break;
+            case OpKind::FLOAT:
+                values.push_back(heap->Make<Float>(op.flonum));
+                break;
+            case OpKind::SYMBOL:
+                values.push_back(heap->Make<Symbol>(std::string(op.name)));
+                break;
+            case OpKind::QUOTE: {
+                auto argument = heap->Make<Cell>(values.back(), nullptr);
+                values.back() = heap->Make<Cell>(heap->Make<Symbol>("quote"), argument);
+                break;
+            }
+            case OpKind::LIST:
+            case OpKind::DOTTED_LIST: {
+                Object* list = nullptr;
+                if (op.kind == OpKind::DOTTED_LIST) {
+                    list = values.back();
+                    values.pop_back();
+                }
+                for (size_t i = 0; i < op.count; ++i) {
+                    list = heap->Make<Cell>(values.back(), list);
+                    values.pop_back();
+                }
+                values.push_back(list);
+                break;
+            }
+        }
     }
-    throw SyntaxError("Unknown token");
+    return values.back();
 }
 
-Object* ReadList(Tokenizer* tokenizer) {
-    if (IsCloseBracket(tokenizer->GetToken())) {
-        tokenizer->Next();
-        return nullptr;
+Object* ReadDatum(Tokenizer* tokenizer, ReadStats* stats, bool inside_list, Heap* heap) {
+    auto& state = GetReaderState();
+    state.tape.clear();
+    state.frames.clear();
+
+    ReadStats local_stats;
+    if (stats == nullptr) {
+        stats = &local_stats;
     }
+    *stats = ReadStats();
+    size_t depth = 0;
 
-    Object* cell = GetInstance<Heap>().Make<Cell>();
-    Object* cur = cell;
+    if (inside_list) {
+        PushList(&state, stats, &depth);
+    }
 
-    bool flag_should_be_end = false;
+    while (true) {
+        bool is_value = false;
 
-    while (!IsCloseBracket(tokenizer->GetToken())) {
-        if (flag_should_be_end) {
-            throw SyntaxError("Dot in incorrect place");
+        if (!state.frames.empty() && state.frames.back().kind == FrameKind::LIST) {
+            auto& frame = state.frames.back();
+            CheckEnd(tokenizer);
+            const auto& token = tokenizer->GetToken();
+            if (IsCloseBracket(token)) {
+                tokenizer->Next();
+                bool is_dotted = frame.state == ListState::AFTER_TAIL;
+                state.tape.push_back({.kind = is_dotted ? OpKind::DOTTED_LIST : OpKind::LIST,
+                                      .count = frame.count});
+                stats->cells += frame.count;
+                state.frames.pop_back();
+                --depth;
+                is_value = true;
+            } else if (frame.state == ListState::AFTER_TAIL) {
+                throw SyntaxError("Dot in incorrect place");
+            } else if (frame.state == ListState::ITEMS && frame.count != 0 && IsDot(token)) {
+                tokenizer->Next();
+                frame.state = ListState::AFTER_DOT;
+            }
         }
 
-        auto tmp_token = Read(tokenizer);
-        CheckEnd(tokenizer);
-
-        if (IsDot(tokenizer->GetToken())) {
+        if (!is_value) {
+            auto token = tokenizer->GetToken();
+            CheckEnd(tokenizer);
             tokenizer->Next();
-            flag_should_be_end = true;
+            if (BracketToken* bracket = std::get_if<BracketToken>(&token)) {
+                if (*bracket == BracketToken::CLOSE) {
+                    throw SyntaxError("Closed bracket before open");
+                }
+                PushList(&state, stats, &depth);
+                continue;
+            }
+            if (ConstantToken* number = std::get_if<ConstantToken>(&token)) {
+                state.tape.push_back({.kind = OpKind::NUMBER, .number = number->value});
+            } else if (BigConstantToken* big = std::get_if<BigConstantToken>(&token)) {
+                state.tape.push_back({.kind = OpKind::BIG_NUMBER, .name = big->digits});
+            } else if (FloatToken* flonum = std::get_if<FloatToken>(&token)) {
+                state.tape.push_back({.kind = OpKind::FLOAT, .flonum = flonum->value});
+            } else if (SymbolToken* symbol = std::get_if<SymbolToken>(&token)) {
+                state.tape.push_back({.kind = OpKind::SYMBOL, .name = symbol->name});
+            } else if (std::get_if<QuoteToken>(&token) != nullptr) {
+                state.frames.push_back({.kind = FrameKind::QUOTE});
+                continue;
+            } else {
+                throw SyntaxError("Unknown token");
+            }
+            ++stats->atoms;
         }
 
-        if (flag_should_be_end) {
-            *(As<Cell>(cur)) = Cell(tmp_token, Read(tokenizer));
-            CheckEnd(tokenizer);
-        } else {
-            Object* tmp =
-                IsCloseBracket(tokenizer->GetToken()) ? nullptr : GetInstance<Heap>().Make<Cell>();
-            *(As<Cell>(cur)) = Cell(tmp_token, tmp);
-            cur = tmp;
+        if (Complete(&state, stats)) {
+            return Materialize(&state, *stats, heap);
         }
     }
+}
+
+}  // namespace
+
+Object* Read(Tokenizer* tokenizer, ReadStats* stats) {
+    return ReadDatum(tokenizer, stats, false, &GetInstance<Heap>());
+}
+
+Object* ReadList(Tokenizer* tokenizer, ReadStats* stats) {
+    return ReadDatum(tokenizer, stats, true, &GetInstance<Heap>());
+}
 
-    tokenizer->Next();
-    return cell;
+Object* Read(Tokenizer* tokenizer, Heap* heap, ReadStats* stats) {
+    return ReadDatum(tokenizer, stats, false, heap);
 }
 
-bool IsCloseBracket(Token token) {
-    if (BracketToken* bracket = std::get_if<BracketToken>(&token)) {
+bool IsCloseBracket(const Token& token) {
+    if (const BracketToken* bracket = std::get_if<BracketToken>(&token)) {
         return *bracket == BracketToken::CLOSE;
     }
     return false;
 }
 
-bool IsDot(Token token) {
+bool IsDot(const Token& token) {
     return std::get_if<DotToken>(&token) != nullptr;
 }
 
@@ -1,16 +1,31 @@
 #pragma once
 
+#include <cstddef>
 #include <memory>
 
 #include "object.h"
 #include "tokenizer.h"
 
-Object* Read(Tokenizer* tokenizer);
+struct ReadStats {
+    // Objects allocated on the heap for the datum, split by kind.
+    size_t cells = 0;
+    size_t atoms = 0;
+    // Deepest list nesting seen while reading.
+    size_t max_depth = 0;
+};
 
-Object* ReadList(Tokenizer* tokenizer);
+// Both readers keep their own stack of open lists instead of recursing, so the nesting
+// depth of the input is bounded only by memory.
+Object* Read(Tokenizer* tokenizer, ReadStats* stats = nullptr);
 
-bool IsCloseBracket(Token token);
+// Reads the rest of a list whose open bracket has already been consumed.
+Object* ReadList(Tokenizer* tokenizer, ReadStats* stats = nullptr);
 
-bool IsDot(Token token);
+// Same as Read, but allocates into the given heap instead of the interpreter's one.
+Object* Read(Tokenizer* tokenizer, Heap* heap, ReadStats* stats = nullptr);
+
+bool IsCloseBracket(const Token& token);
+
+bool IsDot(const Token& token);
 
 void CheckEnd(Tokenizer* tokenizer);
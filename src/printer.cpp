@@ -0,0 +1,192 @@
+#include "printer.h"
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <iomanip>
+#include <ostream>
+#include <string_view>
+#include <vector>
+#include "classes.h"
+#include "object.h"
+
+namespace {
+
+// Cells remember the epoch of the last scan that reached them, so marks never need clearing.
+// The counter is shared by all printers to keep their epochs distinct.
+uint64_t print_epoch_counter = 0;
+
+constexpr int64_t kNoLabel = -2;
+constexpr int64_t kNeedsLabel = -1;
+// Shared, but its second occurrence is cut off: laid out like a labelled cell, so the
+// output doesn't change, just without the label.
+constexpr int64_t kUnreferenced = -3;
+
+}  // namespace
+
+Printer::Printer(std::ostream* out, PrintOptions options) : out_(out), options_(options) {
+}
+
+void Printer::SetOutput(std::ostream* out) {
+    out_ = out;
+}
+
+void Printer::SetOptions(PrintOptions options) {
+    options_ = options;
+}
+
+void Printer::Visit(Object* obj) {
+    auto cell = As<Cell>(obj);
+    if (cell == nullptr) {
+        return;
+    }
+    if (cell->print_epoch_ == epoch_) {
+        if ((cell->print_on_stack_ || options_.label_shared) &&
+            cell->print_label_ != kNeedsLabel) {
+            cell->print_label_ = kNeedsLabel;
+            shared_.push_back(cell);
+        }
+        return;
+    }
+    cell->print_epoch_ = epoch_;
+    cell->print_on_stack_ = true;
+    cell->print_referenced_ = false;
+    cell->print_label_ = kNoLabel;
+    scan_stack_.push_back({cell, 0});
+}
+
+void Printer::Scan(Object* obj) {
+    epoch_ = ++print_epoch_counter;
+    next_label_ = 0;
+    scan_stack_.clear();
+    shared_.clear();
+
+    Visit(obj);
+    while (!scan_stack_.empty()) {
+        auto& frame = scan_stack_.back();
+        if (frame.stage == 0) {
+            frame.stage = 1;
+            Visit(frame.cell->first_);
+        } else if (frame.stage == 1) {
+            frame.stage = 2;
+            Visit(frame.cell->second_);
+        } else {
+            frame.cell->print_on_stack_ = false;
+            scan_stack_.pop_back();
+        }
+    }
+}
+
+void Printer::DropUnreferencedLabels(Object* obj) {
+    auto out = out_;
+    std::ostream null_stream(nullptr);
+    out_ = &null_stream;
+    Write(obj);
+    out_ = out;
+    for (auto cell : shared_) {
+        cell->print_label_ = cell->print_referenced_ ? kNeedsLabel : kUnreferenced;
+    }
+    next_label_ = 0;
+}
+
+void Printer::Print(Object* obj) {
+    Scan(obj);
+    if (!shared_.empty() && (options_.max_length != 0 || options_.max_depth != 0)) {
+        DropUnreferencedLabels(obj);
+    }
+    Write(obj);
+}
+
+void Printer::Write(Object* obj) {
+    print_stack_.clear();
+
+    Emit(obj);
+    while (!print_stack_.empty()) {
+        auto& frame = print_stack_.back();
+        auto rest = frame.rest;
+        if (rest == nullptr) {
+            *out_ << ')';
+            print_stack_.pop_back();
+            continue;
+        }
+        auto cell = As<Cell>(rest);
+        if (cell == nullptr) {
+            *out_ << " . ";
+            EmitAtom(rest);
+            *out_ << ')';
+            print_stack_.pop_back();
+            continue;
+        }
+        if (frame.count > 0) {
+            if (cell->print_label_ != kNoLabel) {
+                // A labelled tail has to be written as a dotted pair to keep the reference.
+                *out_ << " . ";
+                frame.rest = nullptr;
+                Emit(cell);
+                continue;
+            }
+            *out_ << ' ';
+            if (options_.max_length != 0 && frame.count >= options_.max_length) {
+                *out_ << "...";
+                frame.rest = nullptr;
+                continue;
+            }
+        }
+        ++frame.count;
+        frame.rest = cell->second_;
+        Emit(cell->first_);
+    }
+}
+
+void Printer::Emit(Object* obj) {
+    if (obj == nullptr) {
+        *out_ << "()";
+        return;
+    }
+    auto cell = As<Cell>(obj);
+    if (cell == nullptr) {
+        EmitAtom(obj);
+        return;
+    }
+    if (cell->print_label_ >= 0) {
+        cell->print_referenced_ = true;
+        *out_ << '#' << cell->print_label_ << '#';
+        return;
+    }
+    if (options_.max_depth != 0 && print_stack_.size() >= options_.max_depth) {
+        *out_ << "...";
+        return;
+    }
+    if (cell->print_label_ == kNeedsLabel) {
+        cell->print_label_ = next_label_++;
+        *out_ << '#' << cell->print_label_ << '=';
+    }
+    *out_ << '(';
+    print_stack_.push_back({cell, 0});
+}
+
+void Printer::EmitAtom(Object* obj) {
+    if (auto number = As<Number>(obj)) {
+        char buffer[32];
+        auto result = std::to_chars(buffer, buffer + sizeof(buffer), number->GetValue());
+        out_->write(buffer, result.ptr - buffer);
+    } else if (auto symbol = As<Symbol>(obj)) {
+        *out_ << symbol->GetName();
+    } else {
+        *out_ << obj->ToString();
+    }
+}
+
+void WriteJsonString(std::ostream* out, std::string_view text) {
+    *out << '"';
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            *out << '\\' << c;
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            *out << "\\u" << std::hex << std::setw(4) << std::setfill('0') << int(c) << std::dec
+                 << std::setfill(' ');
+        } else {
+            *out << c;
+        }
+    }
+    *out << '"';
+}
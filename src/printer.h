@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string_view>
+#include <vector>
+#include "classes.h"
+#include "object.h"
+
+struct PrintOptions {
+    // Elements printed per list before "..." (0 - unlimited).
+    size_t max_length = 0;
+    // Nesting levels printed before a sublist is replaced with "..." (0 - unlimited).
+    size_t max_depth = 0;
+    // Label every shared cell (write-shared), not only the ones that close a cycle.
+    bool label_shared = false;
+};
+
+// Writes objects straight into an ostream. Lists are walked along their spines with an
+// explicit stack, so neither long nor deeply nested lists recurse, and cells reachable twice
+// are printed with datum labels (#0=, #0#) so circular lists made with set-cdr! terminate.
+class Printer {
+public:
+    explicit Printer(std::ostream* out, PrintOptions options = PrintOptions());
+
+    void Print(Object* obj);
+
+    void SetOutput(std::ostream* out);
+
+    void SetOptions(PrintOptions options);
+
+private:
+    struct ScanFrame {
+        Cell* cell;
+        int stage;
+    };
+
+    struct PrintFrame {
+        Object* rest;
+        size_t count;
+    };
+
+    std::ostream* out_;
+    PrintOptions options_;
+    uint64_t epoch_ = 0;
+    int64_t next_label_ = 0;
+    std::vector<ScanFrame> scan_stack_;
+    std::vector<PrintFrame> print_stack_;
+    // Cells the scan found reachable twice.
+    std::vector<Cell*> shared_;
+
+    void Scan(Object* obj);
+
+    void Visit(Object* obj);
+
+    // With max_length or max_depth the second occurrence of a shared cell may never be
+    // written. A dry run finds such cells, and they are printed without a label.
+    void DropUnreferencedLabels(Object* obj);
+
+    void Write(Object* obj);
+
+    void Emit(Object* obj);
+
+    void EmitAtom(Object* obj);
+};
+
+// Writes text as a JSON string literal, quotes included, for the machine-readable reports.
+void WriteJsonString(std::ostream* out, std::string_view text);
@@ -0,0 +1,232 @@
+#include "profiler.h"
+#include <algorithm>
+#include <csignal>
+#include <iomanip>
+#include <sys/time.h>
+
+namespace {
+
+constexpr uint32_t kTopLevel = 0;
+constexpr uint32_t kAnonymousLambda = 1;
+constexpr int kNameWidth = 32;
+
+struct FunctionStats {
+    uint32_t name;
+    uint64_t calls = 0;
+    std::chrono::nanoseconds inclusive{0};
+    std::chrono::nanoseconds exclusive{0};
+    uint64_t self_samples = 0;
+    uint64_t total_samples = 0;
+};
+
+double Milliseconds(std::chrono::nanoseconds time) {
+    return std::chrono::duration<double, std::milli>(time).count();
+}
+
+}  // namespace
+
+Profiler::Profiler() {
+    Intern("toplevel");
+    Intern("lambda");
+    nodes_.emplace_back(kTopLevel, nullptr, false);
+    current_ = &nodes_.front();
+}
+
+void Profiler::Start(ProfileMode mode) {
+    Stop();
+    nodes_.clear();
+    nodes_.emplace_back(kTopLevel, nullptr, false);
+    current_ = &nodes_.front();
+    frames_.clear();
+    mode_ = mode;
+    if (mode_ == ProfileMode::OFF) {
+        return;
+    }
+    is_active_ = true;
+    if (mode_ == ProfileMode::SAMPLE) {
+        struct sigaction action = {};
+        action.sa_handler = OnSample;
+        action.sa_flags = SA_RESTART;
+        sigemptyset(&action.sa_mask);
+        sigaction(SIGPROF, &action, nullptr);
+
+        auto interval = std::chrono::duration_cast<std::chrono::microseconds>(kSampleInterval);
+        itimerval timer = {};
+        timer.it_interval.tv_usec = interval.count();
+        timer.it_value.tv_usec = interval.count();
+        setitimer(ITIMER_PROF, &timer, nullptr);
+    }
+}
+
+void Profiler::Stop() {
+    if (mode_ == ProfileMode::SAMPLE) {
+        itimerval timer = {};
+        setitimer(ITIMER_PROF, &timer, nullptr);
+        signal(SIGPROF, SIG_DFL);
+    }
+    is_active_ = false;
+}
+
+void Profiler::OnSample([[maybe_unused]] int signal) {
+    // Only atomics: the handler may interrupt Enter or Leave halfway.
+    auto node = GetInstance<Profiler>().current_.load(std::memory_order_relaxed);
+    node->samples.fetch_add(1, std::memory_order_relaxed);
+}
+
+uint32_t Profiler::Intern(const std::string& name) {
+    auto [it, is_new] = ids_.emplace(name, names_.size());
+    if (is_new) {
+        names_.push_back(name);
+    }
+    return it->second;
+}
+
+const std::string& Profiler::GetText(uint32_t name) const {
+    return names_[name];
+}
+
+void Profiler::SetName(Object* builtin, uint32_t name) {
+    builtins_[builtin] = name;
+}
+
+uint32_t Profiler::GetName(Object* function) const {
+    if (auto lambda = As<Lambda>(function)) {
+        return lambda->GetName() != Lambda::kAnonymous ? lambda->GetName() : kAnonymousLambda;
+    }
+    auto it = builtins_.find(function);
+    return it != builtins_.end() ? it->second : kNoName;
+}
+
+bool Profiler::IsTracked(Object* function) const {
+    return GetName(function) != kNoName;
+}
+
+bool Profiler::Enter(Object* function) {
+    auto name = GetName(function);
+    if (name == kNoName) {
+        return false;
+    }
+    auto parent = current_.load(std::memory_order_relaxed);
+    auto& child = parent->children[name];
+    if (child == nullptr) {
+        bool is_recursive = false;
+        for (auto node = parent; node != nullptr; node = node->parent) {
+            is_recursive |= node->name == name;
+        }
+        child = &nodes_.emplace_back(name, parent, is_recursive);
+    }
+    ++child->calls;
+    current_.store(child, std::memory_order_relaxed);
+    if (mode_ == ProfileMode::CALLS) {
+        frames_.push_back({child, std::chrono::steady_clock::now()});
+    }
+    return true;
+}
+
+void Profiler::Leave() {
+    auto node = current_.load(std::memory_order_relaxed);
+    if (mode_ == ProfileMode::CALLS) {
+        auto frame = frames_.back();
+        frames_.pop_back();
+        auto elapsed = std::chrono::steady_clock::now() - frame.start;
+        node->exclusive += elapsed - frame.children;
+        if (!node->is_recursive) {
+            node->inclusive += elapsed;
+        }
+        if (!frames_.empty()) {
+            frames_.back().children += elapsed;
+        }
+    }
+    current_.store(node->parent, std::memory_order_relaxed);
+}
+
+std::string Profiler::GetPath(const Node* node) const {
+    std::vector<uint32_t> path;
+    for (; node != nullptr; node = node->parent) {
+        path.push_back(node->name);
+    }
+    std::string result;
+    for (auto it = path.rbegin(); it != path.rend(); ++it) {
+        if (!result.empty()) {
+            result += ';';
+        }
+        result += names_[*it];
+    }
+    return result;
+}
+
+void Profiler::WriteReport(std::ostream* out) const {
+    std::unordered_map<uint32_t, FunctionStats> functions;
+    uint64_t total_samples = 0;
+    for (const auto& node : nodes_) {
+        auto samples = node.samples.load(std::memory_order_relaxed);
+        total_samples += samples;
+        if (node.parent == nullptr) {
+            continue;
+        }
+        auto& stats = functions[node.name];
+        stats.name = node.name;
+        stats.calls += node.calls;
+        stats.inclusive += node.inclusive;
+        stats.exclusive += node.exclusive;
+        stats.self_samples += samples;
+        // Every function on the path was running during the sample, each counted once.
+        std::vector<uint32_t> seen;
+        for (auto up = &node; up->parent != nullptr; up = up->parent) {
+            if (std::find(seen.begin(), seen.end(), up->name) == seen.end()) {
+                seen.push_back(up->name);
+                functions[up->name].total_samples += samples;
+            }
+        }
+    }
+
+    std::vector<FunctionStats> sorted;
+    for (const auto& [name, stats] : functions) {
+        sorted.push_back(stats);
+    }
+    bool is_sampled = mode_ == ProfileMode::SAMPLE;
+    std::sort(sorted.begin(), sorted.end(), [is_sampled](const auto& lhs, const auto& rhs) {
+        return is_sampled ? lhs.self_samples > rhs.self_samples : lhs.exclusive > rhs.exclusive;
+    });
+    sorted.resize(std::min(sorted.size(), kReportLimit));
+
+    *out << std::left << std::setw(kNameWidth) << "function" << std::right << std::setw(12)
+         << "calls";
+    if (is_sampled) {
+        *out << std::setw(10) << "self%" << std::setw(10) << "total%" << '\n';
+    } else {
+        *out << std::setw(16) << "inclusive ms" << std::setw(16) << "exclusive ms" << '\n';
+    }
+    *out << std::fixed << std::setprecision(1);
+    for (const auto& stats : sorted) {
+        *out << std::left << std::setw(kNameWidth) << names_[stats.name] << std::right
+             << std::setw(12) << stats.calls;
+        if (is_sampled) {
+            auto share = [total_samples](uint64_t samples) {
+                return total_samples != 0 ? 100.0 * samples / total_samples : 0.0;
+            };
+            *out << std::setw(9) << share(stats.self_samples) << '%' << std::setw(9)
+                 << share(stats.total_samples) << "%\n";
+        } else {
+            *out << std::setw(16) << Milliseconds(stats.inclusive) << std::setw(16)
+                 << Milliseconds(stats.exclusive) << '\n';
+        }
+    }
+    if (is_sampled) {
+        *out << total_samples << " samples\n";
+    }
+}
+
+void Profiler::WriteCollapsed(std::ostream* out) const {
+    for (const auto& node : nodes_) {
+        uint64_t value;
+        if (mode_ == ProfileMode::SAMPLE) {
+            value = node.samples.load(std::memory_order_relaxed);
+        } else {
+            value = std::chrono::duration_cast<std::chrono::microseconds>(node.exclusive).count();
+        }
+        if (value != 0) {
+            *out << GetPath(&node) << ' ' << value << '\n';
+        }
+    }
+}
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "classes.h"
+#include "object.h"
+
+enum class ProfileMode { OFF, CALLS, SAMPLE };
+
+// Attribution of run time to lambdas, named after the define that bound them, and builtins.
+// Both modes keep a call tree of the running functions. In CALLS mode every call is timed, for
+// calls, inclusive and exclusive time per function. In SAMPLE mode a call costs a push and a
+// pop only, and a SIGPROF timer counts, every kSampleInterval of CPU time, which node of the
+// tree is running. Either tree is also written as collapsed stacks ("toplevel;f;g 42", one line
+// per stack) for flamegraph.pl.
+//
+// Call paths check IsActive() and nothing else while the profiler is off.
+class Profiler {
+public:
+    static constexpr auto kSampleInterval = std::chrono::microseconds(1000);
+    // Functions listed in the report.
+    static constexpr size_t kReportLimit = 30;
+
+    // Name of functions the profiler doesn't track, e.g. special forms.
+    static constexpr uint32_t kNoName = -1;
+
+    Profiler();
+
+    static bool IsActive() {
+        return is_active_;
+    }
+
+    void Start(ProfileMode mode);
+
+    void Stop();
+
+    // Id of a function name, the same for the same name.
+    uint32_t Intern(const std::string& name);
+
+    const std::string& GetText(uint32_t name) const;
+
+    // Tracks calls of a builtin under the given name.
+    void SetName(Object* builtin, uint32_t name);
+
+    // Whether calls of function get a frame: lambdas and named builtins do, special forms don't.
+    bool IsTracked(Object* function) const;
+
+    // Whether a frame was entered: calls of untracked functions are ignored.
+    bool Enter(Object* function);
+
+    void Leave();
+
+    void WriteReport(std::ostream* out) const;
+
+    void WriteCollapsed(std::ostream* out) const;
+
+private:
+    struct Node {
+        uint32_t name;
+        Node* parent;
+        // The function also runs further up the path, so this time is already counted there.
+        bool is_recursive;
+        std::unordered_map<uint32_t, Node*> children;
+        uint64_t calls = 0;
+        std::chrono::nanoseconds inclusive{0};
+        std::chrono::nanoseconds exclusive{0};
+        std::atomic<uint64_t> samples{0};
+    };
+
+    struct Frame {
+        Node* node;
+        std::chrono::steady_clock::time_point start;
+        std::chrono::nanoseconds children{0};
+    };
+
+    static inline bool is_active_ = false;
+
+    ProfileMode mode_ = ProfileMode::OFF;
+    std::vector<std::string> names_;
+    std::unordered_map<std::string, uint32_t> ids_;
+    std::unordered_map<Object*, uint32_t> builtins_;
+    // A deque, so nodes never move while the signal handler may look at them.
+    std::deque<Node> nodes_;
+    std::atomic<Node*> current_;
+    std::vector<Frame> frames_;
+
+    static void OnSample(int signal);
+
+    uint32_t GetName(Object* function) const;
+
+    // Path of the node from the root, names separated by ';'.
+    std::string GetPath(const Node* node) const;
+};
+
+// A profiler frame for the lifetime of a call, left also when the call throws.
+class ProfiledCall {
+public:
+    explicit ProfiledCall(Object* function) : entered_(GetInstance<Profiler>().Enter(function)) {
+    }
+
+    ProfiledCall(const ProfiledCall& other) = delete;
+
+    ProfiledCall& operator=(const ProfiledCall& other) = delete;
+
+    ~ProfiledCall() {
+        if (entered_) {
+            GetInstance<Profiler>().Leave();
+        }
+    }
+
+private:
+    bool entered_;
+};
@@ -1,16 +1,42 @@
 #include "scheme.h"
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
 #include <iostream>
 #include <memory>
+#include <optional>
 #include <sstream>
+#include <unordered_set>
 
 #include "classes.h"
 #include "error.h"
+#include "form_cache.h"
 #include "object.h"
 #include "parser.h"
 #include "tokenizer.h"
 #include "heap.h"
+#include "hamt.h"
+#include "let.h"
+#include "lists.h"
 
-Interpreter::Interpreter() : scope_(GetInstance<Heap>().Make<Scope>(nullptr)) {
+namespace {
+
+// Builtins the profiler doesn't track: their time belongs to the code they evaluate.
+const std::unordered_set<std::string> kSpecialForms = {
+    "quote", "and", "or", "define", "set!", "if", "lambda", "let", "let*", "letrec", "do",
+};
+
+bool IsPrinted(PrintMode mode, bool is_last) {
+    return mode == PrintMode::ALL || (mode == PrintMode::LAST && is_last);
+}
+
+}  // namespace
+
+Interpreter::Interpreter()
+    : scope_(GetInstance<Heap>().Make<Scope>(nullptr)),
+      builtins_scope_(GetInstance<Heap>().Make<Scope>(nullptr)),
+      printer_(&output_),
+      optimizer_(As<Scope>(scope_)) {
     std::vector<std::pair<std::string, Object*>> functions = {
         {"boolean?", GetInstance<Heap>().Make<BooleanPredicate>()},
         {"not", GetInstance<Heap>().Make<NotFunction>()},
@@ -30,6 +56,7 @@ Interpreter::Interpreter() : scope_(GetInstance<Heap>().Make<Scope>(nullptr)) {
         {"min", GetInstance<Heap>().Make<Min>()},
         {"max", GetInstance<Heap>().Make<Max>()},
         {"abs", GetInstance<Heap>().Make<Abs>()},
+        {"exact->inexact", GetInstance<Heap>().Make<ExactToInexact>()},
         {"pair?", GetInstance<Heap>().Make<PairPredicate>()},
         {"null?", GetInstance<Heap>().Make<NullPredicate>()},
         {"list?", GetInstance<Heap>().Make<ListPredicate>()},
@@ -39,6 +66,16 @@ Interpreter::Interpreter() : scope_(GetInstance<Heap>().Make<Scope>(nullptr)) {
         {"list", GetInstance<Heap>().Make<ListFunction>()},
         {"list-ref", GetInstance<Heap>().Make<ListRef>()},
         {"list-tail", GetInstance<Heap>().Make<ListTail>()},
+        {"map", GetInstance<Heap>().Make<MapFunction>()},
+        {"filter", GetInstance<Heap>().Make<FilterFunction>()},
+        {"fold-left", GetInstance<Heap>().Make<FoldLeft>()},
+        {"fold-right", GetInstance<Heap>().Make<FoldRight>()},
+        {"for-each", GetInstance<Heap>().Make<ForEach>()},
+        {"append", GetInstance<Heap>().Make<Append>()},
+        {"reverse", GetInstance<Heap>().Make<Reverse>()},
+        {"length", GetInstance<Heap>().Make<Length>()},
+        {"apply", GetInstance<Heap>().Make<ApplyFunction>()},
+        {"sort", GetInstance<Heap>().Make<Sort>()},
         {"#t", GetInstance<Heap>().Make<Symbol>(true)},
         {"#f", GetInstance<Heap>().Make<Symbol>(false)},
         {"symbol?", GetInstance<Heap>().Make<SymbolPredicate>()},
@@ -46,11 +83,30 @@ Interpreter::Interpreter() : scope_(GetInstance<Heap>().Make<Scope>(nullptr)) {
         {"set!", GetInstance<Heap>().Make<SetVariable>()},
         {"if", GetInstance<Heap>().Make<IfFunc>()},
         {"lambda", GetInstance<Heap>().Make<LambdaDefinition>()},
+        {"let", GetInstance<Heap>().Make<Let>()},
+        {"let*", GetInstance<Heap>().Make<LetStar>()},
+        {"letrec", GetInstance<Heap>().Make<Letrec>()},
+        {"do", GetInstance<Heap>().Make<DoLoop>()},
         {"set-car!", GetInstance<Heap>().Make<SetCar>()},
         {"set-cdr!", GetInstance<Heap>().Make<SetCdr>()},
+        {"make-map", GetInstance<Heap>().Make<MakeMap>()},
+        {"map-assoc", GetInstance<Heap>().Make<MapAssoc>()},
+        {"map-dissoc", GetInstance<Heap>().Make<MapDissoc>()},
+        {"map-get", GetInstance<Heap>().Make<MapGet>()},
+        {"map-contains?", GetInstance<Heap>().Make<MapContains>()},
+        {"map-count", GetInstance<Heap>().Make<MapCount>()},
+        {"map?", GetInstance<Heap>().Make<MapPredicate>()},
+        {"map->list", GetInstance<Heap>().Make<MapToList>()},
+        {"gc-stats", GetInstance<Heap>().Make<GcStats>()},
     };
+    auto& profiler = GetInstance<Profiler>();
     for (auto& [name, value] : functions) {
         As<Scope>(scope_)->Add(name, value);
+        As<Scope>(builtins_scope_)->Add(name, value);
+        builtins_[name] = value;
+        if (!kSpecialForms.contains(name)) {
+            profiler.SetName(value, profiler.Intern(name));
+        }
     }
 }
 
@@ -59,25 +115,224 @@ Interpreter::~Interpreter() {
 }
 
 std::string Interpreter::Run(const std::string& str) {
-    std::stringstream stream(str);
-    Tokenizer tokenizer(&stream);
-    auto input_ast = Read(&tokenizer);
+    output_.str(std::string());
+    Run(str, &output_);
+    return output_.str();
+}
+
+void Interpreter::Run(const std::string& str, std::ostream* out) {
+    TraceScope trace("run", "interpreter");
+    Tokenizer tokenizer(str);
+    auto input_ast = TracedRead(&tokenizer);
     if (!tokenizer.IsEnd()) {
         throw SyntaxError("Read is end, but input is not null");
     }
+    auto output_ast = Evaluate(input_ast);
+
+    printer_.SetOutput(out);
+    printer_.Print(output_ast);
+    GetInstance<Heap>().Check({scope_, builtins_scope_});
+}
+
+void Interpreter::RunScript(std::string_view source, std::ostream* out, PrintMode mode) {
+    TraceScope trace("run", "interpreter");
+    printer_.SetOutput(out);
+    if (!form_cache_directory_.empty()) {
+        RunCachedScript(source, out, mode);
+        return;
+    }
+    Tokenizer tokenizer(source);
+    while (!tokenizer.IsEnd()) {
+        auto form = TracedRead(&tokenizer);
+        RunForm(form, out, IsPrinted(mode, tokenizer.IsEnd()));
+    }
+}
+
+void Interpreter::RunCachedScript(std::string_view source, std::ostream* out, PrintMode mode) {
+    auto hash = HashSource(source);
+    auto path = (std::filesystem::path(form_cache_directory_) / GetFormCacheName(hash)).string();
+    std::error_code error;
+    std::optional<MappedFile> file;
+    if (std::filesystem::exists(path, error)) {
+        try {
+            file.emplace(path);
+        } catch (const RuntimeError&) {
+            // Can't be read, e.g. no permission or a directory of that name: a miss.
+        }
+    }
+    if (file) {
+        FormCacheReader reader(file->GetData());
+        if (reader.IsValid(hash, source.size())) {
+            while (!reader.IsEnd()) {
+                Object* form;
+                {
+                    TraceScope trace("read", "reader");
+                    form = reader.Next(&last_read_stats_);
+                    trace.SetArg("cells", last_read_stats_.cells);
+                }
+                RunForm(form, out, IsPrinted(mode, reader.IsEnd()));
+            }
+            return;
+        }
+    }
+
+    // A miss: read the source as usual, keeping every form before it is evaluated. The cache
+    // is written only once the whole script ran, so it never holds part of a script.
+    FormCacheWriter writer;
+    Tokenizer tokenizer(source);
+    while (!tokenizer.IsEnd()) {
+        auto form = TracedRead(&tokenizer);
+        writer.Add(form, last_read_stats_);
+        RunForm(form, out, IsPrinted(mode, tokenizer.IsEnd()));
+    }
+    std::filesystem::create_directories(form_cache_directory_, error);
+    writer.Write(path, hash, source.size());
+}
+
+void Interpreter::RunForm(Object* form, std::ostream* out, bool print) {
+    auto output_ast = Evaluate(form);
+    if (print) {
+        printer_.Print(output_ast);
+        *out << '\n';
+    }
+    GetInstance<Heap>().Check({scope_, builtins_scope_});
+}
+
+Object* Interpreter::TracedRead(Tokenizer* tokenizer) {
+    TraceScope trace("read", "reader");
+    auto form = Read(tokenizer, &last_read_stats_);
+    trace.SetArg("cells", last_read_stats_.cells);
+    return form;
+}
+
+Object* Interpreter::Evaluate(Object* input_ast) {
+    TraceScope trace("eval", "interpreter");
     if (input_ast == nullptr) {
         throw RuntimeError("No command");
     }
 
+#ifdef SCHEME_TRACK_ALLOC_SITES
+    // Before the optimizer, so its copies keep the sites; the calls it builds can't be printed.
+    auto site = TagAllocationSites(input_ast);
+#endif
+    if (optimize_) {
+        input_ast = optimizer_.Optimize(input_ast, &last_optimize_stats_);
+        if (stats_output_ != nullptr) {
+            *stats_output_ << "unit " << ++units_ << ": folded " << last_optimize_stats_.folded
+                           << ", pruned " << last_optimize_stats_.pruned << ", inlined "
+                           << last_optimize_stats_.inlined << ", sites "
+                           << last_optimize_stats_.sites << '\n';
+        }
+    }
+
+#ifdef SCHEME_TRACK_ALLOC_SITES
+    InheritAllocationSites(input_ast, site);
+#endif
     input_ast->AddScope(scope_);
 
-    auto output_ast = input_ast->Calculate();
+    return input_ast->Calculate();
+}
 
-    if (output_ast == nullptr) {
-        return "()";
+BulkReadResult Interpreter::LoadData(const std::string& name, std::string_view source,
+                                     size_t threads) {
+    auto result = BulkRead(source, threads);
+    Object* list = nullptr;
+    for (auto it = result.forms.rbegin(); it != result.forms.rend(); ++it) {
+        list = GetInstance<Heap>().Make<Cell>(*it, list);
     }
+    As<Scope>(scope_)->Add(name, list);
+    return result;
+}
 
-    auto res = output_ast->ToString();
-    GetInstance<Heap>().Check(scope_);
-    return res;
+const ReadStats& Interpreter::GetLastReadStats() const {
+    return last_read_stats_;
+}
+
+void Interpreter::SetPrintOptions(PrintOptions options) {
+    printer_.SetOptions(options);
+}
+
+void Interpreter::SetFormCacheDirectory(std::string directory) {
+    form_cache_directory_ = std::move(directory);
+}
+
+void Interpreter::SetOptimize(bool optimize) {
+    optimize_ = optimize;
+}
+
+void Interpreter::SetStatsOutput(std::ostream* out) {
+    stats_output_ = out;
+}
+
+const OptimizeStats& Interpreter::GetLastOptimizeStats() const {
+    return last_optimize_stats_;
+}
+
+void Interpreter::SetProfileMode(ProfileMode mode) {
+    auto& profiler = GetInstance<Profiler>();
+    if (mode == ProfileMode::OFF) {
+        profiler.Stop();
+    } else {
+        profiler.Start(mode);
+    }
+}
+
+void Interpreter::SetTrace(bool enabled, std::chrono::nanoseconds lambda_threshold) {
+    auto& tracer = GetInstance<Tracer>();
+    if (enabled) {
+        tracer.Start(lambda_threshold);
+    } else {
+        tracer.Stop();
+    }
+}
+
+void Interpreter::WriteTrace(std::ostream* out) const {
+    GetInstance<Tracer>().Write(out);
+}
+
+void Interpreter::WriteHeapSnapshot(std::ostream* out) const {
+    GetInstance<Heap>().WriteSnapshot(scope_, out);
+}
+
+void Interpreter::SaveImage(const std::string& path) const {
+    // Written aside and renamed into place, so a failed save never leaves half an image.
+    auto temporary = path + ".tmp";
+    {
+        std::ofstream out(temporary, std::ios::binary);
+        if (!out) {
+            throw RuntimeError("Can't write file " + path);
+        }
+        try {
+            WriteImage(As<Scope>(scope_), builtins_, &out);
+        } catch (...) {
+            out.close();
+            std::remove(temporary.c_str());
+            throw;
+        }
+        out.close();
+        if (!out) {
+            std::remove(temporary.c_str());
+            throw RuntimeError("Can't write file " + path);
+        }
+    }
+    if (std::rename(temporary.c_str(), path.c_str()) != 0) {
+        std::remove(temporary.c_str());
+        throw RuntimeError("Can't write file " + path);
+    }
+}
+
+void Interpreter::LoadImage(const std::string& path) {
+    TraceScope trace("load-image", "reader");
+    MappedFile image(path);
+    ReadImage(image.GetData(), As<Scope>(scope_), builtins_);
+}
+
+void Interpreter::WriteProfile(std::ostream* report, std::ostream* stacks) const {
+    const auto& profiler = GetInstance<Profiler>();
+    if (report != nullptr) {
+        profiler.WriteReport(report);
+    }
+    if (stacks != nullptr) {
+        profiler.WriteCollapsed(stacks);
+    }
 }
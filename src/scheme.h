@@ -1,8 +1,23 @@
 #pragma once
 
+#include <chrono>
 #include <memory>
+#include <ostream>
+#include <sstream>
 #include <string>
+#include <string_view>
+#include "bulk_reader.h"
+#include "image.h"
 #include "object.h"
+#include "optimizer.h"
+#include "parser.h"
+#include "printer.h"
+#include "profiler.h"
+#include "tokenizer.h"
+#include "tracer.h"
+
+// Which results of a script's top-level forms get printed.
+enum class PrintMode { ALL, LAST, NONE };
 
 class Interpreter {
 public:
@@ -20,6 +35,82 @@ public:
 
     std::string Run(const std::string& str);
 
+    // Evaluates str and prints the result straight into out.
+    void Run(const std::string& str, std::ostream* out);
+
+    // Evaluates every top-level form of source in order with a single reader, printing one
+    // result per line into out as selected by mode.
+    void RunScript(std::string_view source, std::ostream* out, PrintMode mode = PrintMode::ALL);
+
+    // Reads every top-level datum of source without evaluating it, parsing chunks of the
+    // buffer on threads in parallel, and binds the list of them to name.
+    BulkReadResult LoadData(const std::string& name, std::string_view source,
+                            size_t threads = 0);
+
+    void SetPrintOptions(PrintOptions options);
+
+    // If set, RunScript keeps the parsed forms of every script in a file in directory, named
+    // by a hash of the source, and reads them from there when the same source runs again
+    // instead of parsing it; see form_cache.h.
+    void SetFormCacheDirectory(std::string directory);
+
+    // Turns the constant folding pass on or off; it is on by default.
+    void SetOptimize(bool optimize);
+
+    // If set, one line of optimizer statistics is written there per top-level form.
+    void SetStatsOutput(std::ostream* out);
+
+    const OptimizeStats& GetLastOptimizeStats() const;
+
+    // Allocation counts of the last top-level datum read.
+    const ReadStats& GetLastReadStats() const;
+
+    // Starts profiling calls of lambdas and builtins, or stops with ProfileMode::OFF.
+    void SetProfileMode(ProfileMode mode);
+
+    // The per-function report into report and collapsed stacks into stacks, either may be null.
+    void WriteProfile(std::ostream* report, std::ostream* stacks) const;
+
+    // Starts recording a timeline of runs, reads, collections and lambda calls of at least
+    // lambda_threshold, or stops.
+    void SetTrace(bool enabled,
+                  std::chrono::nanoseconds lambda_threshold = Tracer::kDefaultLambdaThreshold);
+
+    // The recorded timeline in the Chrome trace event format.
+    void WriteTrace(std::ostream* out) const;
+
+    // Everything reachable from the global scope, see Heap::WriteSnapshot.
+    void WriteHeapSnapshot(std::ostream* out) const;
+
+    // Saves the global definitions made so far into a heap image at path, see image.h.
+    void SaveImage(const std::string& path) const;
+
+    // Restores the definitions of a heap image written by SaveImage, as if the code that made
+    // them had been evaluated here.
+    void LoadImage(const std::string& path);
+
 private:
     Object* scope_;
+    // Binds the builtins_ for good, so they outlive a redefinition of their global name: images
+    // refer to them by pointer. A second root of every collection.
+    Object* builtins_scope_;
+    Builtins builtins_;
+    Printer printer_;
+    std::ostringstream output_;
+    ReadStats last_read_stats_;
+    Optimizer optimizer_;
+    bool optimize_ = true;
+    OptimizeStats last_optimize_stats_;
+    std::ostream* stats_output_ = nullptr;
+    size_t units_ = 0;
+    std::string form_cache_directory_;
+
+    void RunCachedScript(std::string_view source, std::ostream* out, PrintMode mode);
+
+    // Evaluates a top-level form, prints its result if print and collects garbage.
+    void RunForm(Object* form, std::ostream* out, bool print);
+
+    Object* TracedRead(Tokenizer* tokenizer);
+
+    Object* Evaluate(Object* input_ast);
 };
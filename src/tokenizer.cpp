@@ -1,13 +1,56 @@
 #include "error.h"
 #include "tokenizer.h"
-#include <cctype>
+#include <array>
+#include <charconv>
+#include <cstdint>
+#include <iterator>
 #include <string>
+#include <string_view>
+#include <system_error>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+enum CharClass : uint8_t {
+    kSpace = 1 << 0,
+    kDigit = 1 << 1,
+    kSymbolFirst = 1 << 2,
+    kSymbolRest = 1 << 3,
+};
+
+constexpr std::array<uint8_t, 256> MakeCharClasses() {
+    std::array<uint8_t, 256> classes{};
+    for (unsigned char c : std::string_view(" \t\n\v\f\r")) {
+        classes[c] |= kSpace;
+    }
+    for (int c = '0'; c <= '9'; ++c) {
+        classes[c] |= kDigit | kSymbolRest;
+    }
+    for (int c = 'a'; c <= 'z'; ++c) {
+        classes[c] |= kSymbolFirst | kSymbolRest;
+        classes[c - 'a' + 'A'] |= kSymbolFirst | kSymbolRest;
+    }
+    for (unsigned char c : std::string_view("<=>*/#")) {
+        classes[c] |= kSymbolFirst | kSymbolRest;
+    }
+    for (unsigned char c : std::string_view("?!-")) {
+        classes[c] |= kSymbolRest;
+    }
+    return classes;
+}
+
+constexpr auto kCharClasses = MakeCharClasses();
 
-SymbolToken::SymbolToken(std::string str) : name(str) {
+bool HasClass(char c, uint8_t char_class) {
+    return (kCharClasses[static_cast<unsigned char>(c)] & char_class) != 0;
 }
 
-SymbolToken::SymbolToken(char character) {
-    name += character;
+}  // namespace
+
+SymbolToken::SymbolToken(std::string_view str) : name(str) {
 }
 
 bool SymbolToken::operator==(const SymbolToken& other) const {
@@ -22,14 +65,32 @@ bool DotToken::operator==(const DotToken&) const {
     return true;
 }
 
-ConstantToken::ConstantToken(int val) : value(val) {
+ConstantToken::ConstantToken(int64_t val) : value(val) {
 }
 
 bool ConstantToken::operator==(const ConstantToken& other) const {
     return value == other.value;
 }
 
-Tokenizer::Tokenizer(std::istream* in) : in_(in), cur_token_(QuoteToken()), is_end_(false) {
+bool BigConstantToken::operator==(const BigConstantToken& other) const {
+    return digits == other.digits;
+}
+
+bool FloatToken::operator==(const FloatToken& other) const {
+    return value == other.value;
+}
+
+Tokenizer::Tokenizer(std::string_view source)
+    : source_(source), pos_(0), cur_token_(QuoteToken()), is_end_(false) {
+    Next();
+}
+
+Tokenizer::Tokenizer(std::istream* in)
+    : owned_(std::istreambuf_iterator<char>(*in), std::istreambuf_iterator<char>()),
+      source_(owned_),
+      pos_(0),
+      cur_token_(QuoteToken()),
+      is_end_(false) {
     Next();
 }
 
@@ -38,7 +99,11 @@ bool Tokenizer::IsEnd() {
 }
 
 bool Tokenizer::IsReachedEnd() {
-    return in_->eof();
+    return pos_ >= source_.size();
+}
+
+size_t Tokenizer::GetPosition() const {
+    return pos_;
 }
 
 void Tokenizer::Next() {
@@ -47,7 +112,8 @@ void Tokenizer::Next() {
         is_end_ = true;
         return;
     }
-    char character = in_->get();
+    size_t start = pos_;
+    char character = source_[pos_++];
     if (character == '\047') {  //  quote
         cur_token_ = QuoteToken();
     } else if (character == '(') {
@@ -56,62 +122,122 @@ void Tokenizer::Next() {
         cur_token_ = BracketToken::CLOSE;
     } else if (character == '.') {
         cur_token_ = DotToken();
-    } else if (std::isdigit(character)) {
-        in_->unget();
-        cur_token_ = ConstantToken(ReadInt());
+    } else if (HasClass(character, kDigit)) {
+        cur_token_ = ReadNumber(start);
     } else if (character == '+' || character == '-') {
         if (IsNextDigit()) {
-            cur_token_ = ConstantToken(ReadInt() * (character == '-' ? -1 : 1));
+            // from_chars accepts a leading minus but not a plus.
+            cur_token_ = ReadNumber(character == '-' ? start : pos_);
         } else {
-            cur_token_ = SymbolToken(character);
+            cur_token_ = SymbolToken(source_.substr(start, 1));
         }
-    } else if (IsSymbolF(character)) {
-        in_->unget();
-        cur_token_ = SymbolToken(ReadString());
+    } else if (HasClass(character, kSymbolFirst)) {
+        cur_token_ = SymbolToken(ReadString(start));
     } else {
         throw SyntaxError("Unknown symbol");
     }
 }
 
-Token Tokenizer::GetToken() {
+const Token& Tokenizer::GetToken() {
     return cur_token_;
 }
 
 void Tokenizer::RemoveSpaces() {
-    while (IsNextSpace() && !IsReachedEnd()) {
-        in_->get();
+    while (!IsReachedEnd() && HasClass(source_[pos_], kSpace)) {
+        ++pos_;
     }
 }
 
-bool Tokenizer::IsNextSpace() {
-    return std::isspace(in_->peek());
+bool Tokenizer::IsNextDigit(size_t offset) {
+    return pos_ + offset < source_.size() && HasClass(source_[pos_ + offset], kDigit);
 }
 
-bool Tokenizer::IsNextDigit() {
-    return std::isdigit(in_->peek());
+// A fraction or an exponent right after the integer digits: "1.5", "1e9", "2.5e-3".
+bool Tokenizer::IsFloatSuffix() {
+    if (IsReachedEnd()) {
+        return false;
+    }
+    if (source_[pos_] == '.') {
+        return IsNextDigit(1);
+    }
+    if (source_[pos_] == 'e' || source_[pos_] == 'E') {
+        return IsNextDigit(1) || (pos_ + 2 < source_.size() &&
+                                  (source_[pos_ + 1] == '+' || source_[pos_ + 1] == '-') &&
+                                  IsNextDigit(2));
+    }
+    return false;
 }
 
-int Tokenizer::ReadInt() {
-    int res = 0;
-    while (IsNextDigit() && !IsReachedEnd()) {
-        res *= 10;
-        res += in_->get() - '0';
+Token Tokenizer::ReadNumber(size_t start) {
+    while (IsNextDigit()) {
+        ++pos_;
+    }
+    if (IsFloatSuffix()) {
+        if (source_[pos_] == '.') {
+            ++pos_;
+            while (IsNextDigit()) {
+                ++pos_;
+            }
+        }
+        if (IsFloatSuffix()) {
+            pos_ += 2;
+            while (IsNextDigit()) {
+                ++pos_;
+            }
+        }
+        double value = 0;
+        auto [ptr, ec] = std::from_chars(source_.data() + start, source_.data() + pos_, value);
+        if (ec == std::errc::result_out_of_range) {
+            throw SyntaxError("Float literal is out of range");
+        }
+        return FloatToken{value};
+    }
+    int64_t res = 0;
+    auto [ptr, ec] = std::from_chars(source_.data() + start, source_.data() + pos_, res);
+    if (ec == std::errc::result_out_of_range) {
+        return BigConstantToken{source_.substr(start, pos_ - start)};
     }
-    return res;
+    return ConstantToken(res);
 }
 
-std::string Tokenizer::ReadString() {
-    std::string str;
-    while (IsSymbol(in_->peek()) && !IsReachedEnd()) {
-        str += in_->get();
+std::string_view Tokenizer::ReadString(size_t start) {
+    while (!IsReachedEnd() && HasClass(source_[pos_], kSymbolRest)) {
+        ++pos_;
     }
-    return str;
+    return source_.substr(start, pos_ - start);
 }
 
-bool Tokenizer::IsSymbolF(char c) {
-    return std::isalpha(c) || c == '<' || c == '=' || c == '>' || c == '*' || c == '/' || c == '#';
+///////////////////////////////////////////////////////////////////////////////////////////
+
+MappedFile::MappedFile(const std::string& path) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw RuntimeError("Can't open file " + path);
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0) {
+        close(fd);
+        throw RuntimeError("Can't stat file " + path);
+    }
+    size_ = info.st_size;
+    if (size_ != 0) {
+        void* data = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            close(fd);
+            throw RuntimeError("Can't map file " + path);
+        }
+        madvise(data, size_, MADV_SEQUENTIAL);
+        data_ = static_cast<char*>(data);
+    }
+    close(fd);
+}
+
+MappedFile::~MappedFile() {
+    if (data_ != nullptr) {
+        munmap(data_, size_);
+    }
 }
 
-bool Tokenizer::IsSymbol(char c) {
-    return IsSymbolF(c) || std::isdigit(c) || c == '?' || c == '!' || c == '-';
+std::string_view MappedFile::GetData() const {
+    return std::string_view(data_, size_);
 }
@@ -1,15 +1,18 @@
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
 #include <variant>
 #include <optional>
 #include <istream>
+#include <string>
+#include <string_view>
 
+// Symbol names point into the source buffer, so the buffer has to outlive the token.
 struct SymbolToken {
-    std::string name;
+    std::string_view name;
 
-    SymbolToken(char character);
-
-    SymbolToken(std::string str);
+    SymbolToken(std::string_view str);
 
     bool operator==(const SymbolToken& other) const;
 };
@@ -25,43 +28,85 @@ struct DotToken {
 enum class BracketToken { OPEN, CLOSE };
 
 struct ConstantToken {
-    int value;
+    int64_t value;
 
-    ConstantToken(int val);
+    ConstantToken(int64_t val);
 
     bool operator==(const ConstantToken& other) const;
 };
 
-using Token = std::variant<ConstantToken, BracketToken, SymbolToken, QuoteToken, DotToken>;
+// Integer literal that does not fit into int64_t; digits include the sign and point into the
+// source buffer.
+struct BigConstantToken {
+    std::string_view digits;
+
+    bool operator==(const BigConstantToken& other) const;
+};
 
+struct FloatToken {
+    double value;
+
+    bool operator==(const FloatToken& other) const;
+};
+
+using Token = std::variant<ConstantToken, BracketToken, SymbolToken, QuoteToken, DotToken,
+                           BigConstantToken, FloatToken>;
+
+// Tokenizes a contiguous buffer in place, without copying it or the symbols it contains.
 class Tokenizer {
 public:
-    Tokenizer(std::istream* in);
+    explicit Tokenizer(std::string_view source);
+
+    // Reads the whole stream into an owned buffer first.
+    explicit Tokenizer(std::istream* in);
+
+    Tokenizer(const Tokenizer& other) = delete;
+
+    Tokenizer& operator=(const Tokenizer& other) = delete;
 
     bool IsEnd();
 
     void Next();
 
-    Token GetToken();
+    const Token& GetToken();
+
+    // Offset of the first character after the current token.
+    size_t GetPosition() const;
 
 private:
-    std::istream* in_;
+    std::string owned_;
+    std::string_view source_;
+    size_t pos_;
     Token cur_token_;
     bool is_end_;
 
     void RemoveSpaces();
 
-    bool IsNextSpace();
+    bool IsNextDigit(size_t offset = 0);
 
-    bool IsNextDigit();
+    bool IsFloatSuffix();
 
-    int ReadInt();
+    Token ReadNumber(size_t start);
 
-    std::string ReadString();
+    std::string_view ReadString(size_t start);
 
     bool IsReachedEnd();
+};
+
+// Read-only memory mapping of a whole file, used as a zero-copy tokenizer source.
+class MappedFile {
+public:
+    explicit MappedFile(const std::string& path);
 
-    bool IsSymbolF(char c);
+    MappedFile(const MappedFile& other) = delete;
 
-    bool IsSymbol(char c);
+    MappedFile& operator=(const MappedFile& other) = delete;
+
+    ~MappedFile();
+
+    std::string_view GetData() const;
+
+private:
+    char* data_ = nullptr;
+    size_t size_ = 0;
 };
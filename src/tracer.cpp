@@ -0,0 +1,127 @@
+#include "tracer.h"
+#include <iomanip>
+#include <string>
+#include "object.h"
+#include "printer.h"
+#include "profiler.h"
+
+namespace {
+
+void WriteMicroseconds(std::ostream* out, int64_t nanoseconds) {
+    *out << nanoseconds / 1000 << '.' << std::setw(3) << std::setfill('0') << nanoseconds % 1000
+         << std::setfill(' ');
+}
+
+}  // namespace
+
+void Tracer::Start(std::chrono::nanoseconds lambda_threshold) {
+    start_ = std::chrono::steady_clock::now();
+    lambda_threshold_ = lambda_threshold;
+    GetBuffer();
+    is_active_.store(true, std::memory_order_relaxed);
+}
+
+void Tracer::Stop() {
+    is_active_.store(false, std::memory_order_relaxed);
+}
+
+std::chrono::nanoseconds Tracer::GetLambdaThreshold() const {
+    return lambda_threshold_;
+}
+
+int64_t Tracer::Now() const {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() -
+                                                                start_)
+        .count();
+}
+
+Tracer::Buffer* Tracer::GetBuffer() {
+    if (thread_buffer_ == nullptr) {
+        std::lock_guard lock(mutex_);
+        auto& buffer = buffers_.emplace_back(std::make_unique<Buffer>());
+        buffer->thread = buffers_.size();
+        buffer->events.resize(kBufferEvents);
+        thread_buffer_ = buffer.get();
+    }
+    return thread_buffer_;
+}
+
+void Tracer::Record(const Event& event) {
+    auto buffer = GetBuffer();
+    auto written = buffer->written.load(std::memory_order_relaxed);
+    buffer->events[written % kBufferEvents] = event;
+    buffer->written.store(written + 1, std::memory_order_release);
+}
+
+void Tracer::Write(std::ostream* out) const {
+    const auto& profiler = GetInstance<Profiler>();
+    std::lock_guard lock(mutex_);
+    uint64_t dropped = 0;
+    bool is_first = true;
+    *out << "{\"traceEvents\": [\n";
+    for (const auto& buffer : buffers_) {
+        *out << (is_first ? "" : ",\n") << R"({"name": "thread_name", "ph": "M", "pid": 1, )"
+             << "\"tid\": " << buffer->thread << R"(, "args": {"name": ")"
+             << (buffer->thread == 1 ? "main" : "thread " + std::to_string(buffer->thread))
+             << "\"}}";
+        is_first = false;
+
+        auto written = buffer->written.load(std::memory_order_acquire);
+        auto first = written > kBufferEvents ? written - kBufferEvents : 0;
+        dropped += first;
+        for (auto i = first; i < written; ++i) {
+            const auto& event = buffer->events[i % kBufferEvents];
+            *out << ",\n{\"name\": ";
+            if (event.name != nullptr) {
+                WriteJsonString(out, event.name);
+            } else {
+                WriteJsonString(out, event.lambda != Lambda::kAnonymous
+                                         ? profiler.GetText(event.lambda)
+                                         : std::string("lambda"));
+            }
+            *out << ", \"cat\": \"" << event.category << R"(", "ph": "X", "pid": 1, "tid": )"
+                 << buffer->thread << ", \"ts\": ";
+            WriteMicroseconds(out, event.start);
+            *out << ", \"dur\": ";
+            WriteMicroseconds(out, event.duration);
+            if (event.arg_name != nullptr) {
+                *out << ", \"args\": {\"" << event.arg_name << "\": " << event.arg << '}';
+            }
+            *out << '}';
+        }
+    }
+    *out << "\n],\n\"displayTimeUnit\": \"ms\",\n\"otherData\": {\"dropped_events\": \"" << dropped
+         << "\"}}\n";
+}
+
+TraceScope::TraceScope(const char* name, const char* category)
+    : name_(Tracer::IsActive() ? name : nullptr), category_(category) {
+    start_ = name_ != nullptr ? GetInstance<Tracer>().Now() : 0;
+}
+
+TraceScope::~TraceScope() {
+    if (name_ != nullptr && Tracer::IsActive()) {
+        auto& tracer = GetInstance<Tracer>();
+        tracer.Record({name_, category_, 0, start_, tracer.Now() - start_, arg_name_, arg_});
+    }
+}
+
+void TraceScope::SetArg(const char* name, int64_t value) {
+    arg_name_ = name;
+    arg_ = value;
+}
+
+TracedCall::TracedCall(uint32_t lambda)
+    : lambda_(lambda), start_(Tracer::IsActive() ? GetInstance<Tracer>().Now() : -1) {
+}
+
+TracedCall::~TracedCall() {
+    if (start_ < 0 || !Tracer::IsActive()) {
+        return;
+    }
+    auto& tracer = GetInstance<Tracer>();
+    auto duration = tracer.Now() - start_;
+    if (duration >= tracer.GetLambdaThreshold().count()) {
+        tracer.Record({nullptr, "lambda", lambda_, start_, duration, nullptr, 0});
+    }
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <vector>
+#include "classes.h"
+
+// Timeline of what the interpreter did, written in the Chrome trace event format (load it in
+// chrome://tracing or ui.perfetto.dev). Records top-level runs and evaluations, reads, heap
+// collections with their pauses, and calls of lambdas that took at least a threshold.
+//
+// Every thread records into its own ring buffer of kBufferEvents, so recording takes no lock;
+// once a buffer is full the oldest events are overwritten. Call paths check IsActive() and
+// nothing else while the tracer is off.
+class Tracer {
+public:
+    static constexpr size_t kBufferEvents = 1 << 16;
+    static constexpr auto kDefaultLambdaThreshold = std::chrono::microseconds(100);
+
+    // A finished span. name and category point to string literals; a lambda span has no name
+    // but the profiler name id of the lambda.
+    struct Event {
+        const char* name;
+        const char* category;
+        uint32_t lambda;
+        int64_t start;
+        int64_t duration;
+        // One optional integer argument, shown with the event.
+        const char* arg_name;
+        int64_t arg;
+    };
+
+    static bool IsActive() {
+        return is_active_.load(std::memory_order_relaxed);
+    }
+
+    // Starts recording on the calling thread, which is named the main thread in the trace.
+    void Start(std::chrono::nanoseconds lambda_threshold = kDefaultLambdaThreshold);
+
+    void Stop();
+
+    std::chrono::nanoseconds GetLambdaThreshold() const;
+
+    // Nanoseconds since Start.
+    int64_t Now() const;
+
+    void Record(const Event& event);
+
+    void Write(std::ostream* out) const;
+
+private:
+    struct Buffer {
+        uint32_t thread;
+        std::vector<Event> events;
+        // Events ever recorded; the last kBufferEvents of them are kept.
+        std::atomic<uint64_t> written{0};
+    };
+
+    static inline std::atomic<bool> is_active_ = false;
+    static inline thread_local Buffer* thread_buffer_ = nullptr;
+
+    std::chrono::steady_clock::time_point start_;
+    std::chrono::nanoseconds lambda_threshold_ = kDefaultLambdaThreshold;
+    // Taken only to add the buffer of a new thread and to write the trace.
+    mutable std::mutex mutex_;
+    std::vector<std::unique_ptr<Buffer>> buffers_;
+
+    Buffer* GetBuffer();
+};
+
+// A span from construction to destruction, recorded if the tracer was active at its start.
+class TraceScope {
+public:
+    TraceScope(const char* name, const char* category);
+
+    TraceScope(const TraceScope& other) = delete;
+
+    TraceScope& operator=(const TraceScope& other) = delete;
+
+    ~TraceScope();
+
+    void SetArg(const char* name, int64_t value);
+
+private:
+    const char* name_;
+    const char* category_;
+    int64_t start_;
+    const char* arg_name_ = nullptr;
+    int64_t arg_ = 0;
+};
+
+// A call of a lambda, recorded only if it took at least the lambda threshold.
+class TracedCall {
+public:
+    explicit TracedCall(uint32_t lambda);
+
+    TracedCall(const TracedCall& other) = delete;
+
+    TracedCall& operator=(const TracedCall& other) = delete;
+
+    ~TracedCall();
+
+private:
+    uint32_t lambda_;
+    int64_t start_;
+};